@@ -16,3 +16,29 @@ __ass_scan( void)
     return tmp;
 }
 
+uint64_t
+__ass_pow( uint64_t base, uint64_t exp)
+{
+    /* Negative exponent gives 1 / base^n truncated toward zero */
+    if ( (int64_t)exp < 0 )
+    {
+        if ( base == 1 )
+            return 1;
+
+        if ( (int64_t)base == -1 )
+            return exp & 1 ? base : 1;
+
+        return 0;
+    }
+
+    uint64_t result = 1;
+    for ( ; exp; exp >>= 1 )
+    {
+        if ( exp & 1 )
+            result *= base;
+
+        base *= base;
+    }
+
+    return result;
+}
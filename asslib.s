@@ -1,16 +1,20 @@
 global __ass_print
 global __ass_scan
-;global __ass_pow
+global __ass_pow
 
 extern printf
 extern scanf
 
 section .text
+; Arguments are passed in rdi, rsi as in SysV ABI.
+; Callers keep the stack aligned to 0x10 before the call
 __ass_print:
+        sub rsp, 0x8
+        mov rsi, rdi
         lea rdi, print_fmt
-        mov rsi, [rsp + 0x8]
         xor rax, rax
         call printf
+        add rsp, 0x8
         ret
         
 section .rodata
@@ -18,11 +22,13 @@ print_fmt db `%ld\n\0`
 
 section .text
 __ass_scan:
+        sub rsp, 0x8
         lea rdi, scan_fmt
         lea rsi, scan
         xor rax, rax
         call scanf
         mov rax, qword [scan]
+        add rsp, 0x8
         ret
 
 section .rodata
@@ -31,3 +37,37 @@ scan_fmt db `%ld\0`
 section .data
 scan dq 0
 
+
+section .text
+; Exponentiation by squaring: base is in rdi, exponent is in rsi.
+; Negative exponent gives 1 / base^n truncated toward zero.
+__ass_pow:
+        mov rdx, rdi
+        mov rcx, rsi
+        mov rax, 1
+        test rcx, rcx
+        js .negative
+
+.loop:
+        test rcx, 1
+        jz .square
+        imul rax, rdx
+.square:
+        imul rdx, rdx
+        shr rcx, 1
+        jnz .loop
+        ret
+
+.negative:
+        cmp rdx, 1
+        je .done
+        cmp rdx, -1
+        jne .zero
+        test rcx, 1
+        jz .done
+        neg rax
+.done:
+        ret
+.zero:
+        xor rax, rax
+        ret
@@ -0,0 +1,445 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <logs.h>
+#include <iommap.h>
+#include <intern.h>
+
+#include <ast/tree.h>
+#include <ast/keyword.h>
+
+/*
+ * Binary tree format.
+ *
+ * +-----------------+ 0
+ * | ast_bin_header  |
+ * +-----------------+ sizeof(ast_bin_header)
+ * | string table    | 'n_strs' null-terminated identifiers
+ * +-----------------+ aligned to 8 bytes
+ * | ast_bin_node    | 'n_nodes' records in pre-order, 'n_words' in total
+ * | ...             |
+ * +-----------------+
+ *
+ * Identifier record stores the index of its string in the table.
+ * Each identifier is stored only once. Number which doesn't fit
+ * 32 bits is marked AST_BIN_WIDE and stored in the next word.
+ */
+
+static const char     AST_BIN_MAGIC[4] = {'A', 'S', 'T', 'B'};
+static const uint32_t AST_BIN_VERSION  = 1;
+
+struct ast_bin_header {
+        char     magic[4]    = {0};
+        uint32_t version     = 0;
+        uint32_t n_nodes     = 0;
+        uint32_t n_words     = 0;
+        uint32_t n_strs      = 0;
+        uint32_t strtab_size = 0;
+};
+
+enum ast_bin_flags {
+        AST_BIN_LEFT  = 0x01,
+        AST_BIN_RIGHT = 0x02,
+        AST_BIN_WIDE  = 0x04,
+};
+
+struct ast_bin_node {
+        uint8_t  type     = 0;
+        uint8_t  flags    = 0;
+        uint16_t reserved = 0;
+        int32_t  data     = 0;
+};
+
+static_assert(sizeof(ast_bin_header) == 24, "Binary header layout changed");
+static_assert(sizeof(ast_bin_node)   == 8,  "Binary node layout changed");
+static_assert(sizeof(ast_bin_node)   == sizeof(int64_t), "Wide number takes one word");
+
+/*
+ * Output state. Identifiers are interned by the frontend,
+ * so they are deduplicated by pointer.
+ */
+struct ast_bin_writer {
+        ast_bin_node *nodes = nullptr;
+        size_t n_nodes      = 0;
+        size_t n_words      = 0;
+        size_t nodes_cap    = 0;
+
+        char  *strtab       = nullptr;
+        size_t strtab_size  = 0;
+        size_t strtab_cap   = 0;
+        size_t n_strs       = 0;
+
+        const char **keys   = nullptr;
+        uint32_t    *ids    = nullptr;
+        size_t keys_cap     = 0;
+};
+
+static inline size_t align8(size_t size)
+{
+        return (size + 7) & ~(size_t)7;
+}
+
+static ast_node *format_error(const char *msg)
+{
+        fprintf(stderr, ascii(RED, "Binary tree is corrupted: %s\n"), msg);
+        return nullptr;
+}
+
+static bool is_ast_keyword(int64_t id)
+{
+#define AST(name, keyword, str) case AST_##name:
+
+        switch (id) {
+#include "../AST"
+                return true;
+        default:
+                return false;
+        }
+
+#undef AST
+}
+
+static void *grow(void *buf, size_t *cap, size_t need, size_t elem, size_t init)
+{
+        assert(cap);
+
+        if (need <= *cap)
+                return buf;
+
+        size_t size = *cap ? *cap : init;
+        while (size < need)
+                size *= 2;
+
+        buf = realloc(buf, size * elem);
+        if (buf)
+                *cap = size;
+
+        return buf;
+}
+
+static int write_ident(ast_bin_writer *const w, const char *ident, int32_t *id)
+{
+        assert(w);
+        assert(ident);
+        assert(id);
+
+        if (w->n_strs >= INT32_MAX)
+                return -1;
+
+        /* Keep load factor below 1/2 */
+        if (2 * (w->n_strs + 1) > w->keys_cap) {
+                size_t cap = w->keys_cap ? 2 * w->keys_cap : 64;
+                const char **keys = (const char **)calloc(cap, sizeof(const char *));
+                uint32_t      *ids = (uint32_t *)calloc(cap, sizeof(uint32_t));
+                if (!keys || !ids) {
+                        free(keys);
+                        free(ids);
+                        return -1;
+                }
+
+                for (size_t i = 0; i < w->keys_cap; i++) {
+                        if (!w->keys[i])
+                                continue;
+
+                        size_t j = ((uintptr_t)w->keys[i] >> 3) & (cap - 1);
+                        while (keys[j])
+                                j = (j + 1) & (cap - 1);
+
+                        keys[j] = w->keys[i];
+                        ids[j]  = w->ids[i];
+                }
+
+                free(w->keys);
+                free(w->ids);
+                w->keys = keys;
+                w->ids  = ids;
+                w->keys_cap = cap;
+        }
+
+        size_t mask = w->keys_cap - 1;
+        size_t i = ((uintptr_t)ident >> 3) & mask;
+        for ( ; w->keys[i]; i = (i + 1) & mask) {
+                if (w->keys[i] == ident) {
+                        *id = (int32_t)w->ids[i];
+                        return 0;
+                }
+        }
+
+        size_t len = strlen(ident) + 1;
+        char *strtab = (char *)grow(w->strtab, &w->strtab_cap,
+                                    w->strtab_size + len, sizeof(char), 0x400);
+        if (!strtab)
+                return -1;
+
+        w->strtab = strtab;
+        memcpy(w->strtab + w->strtab_size, ident, len);
+        w->strtab_size += len;
+
+        w->keys[i] = ident;
+        w->ids[i]  = (uint32_t)w->n_strs;
+
+        *id = (int32_t)w->n_strs++;
+        return 0;
+}
+
+static int write_node(ast_bin_writer *const w, ast_node *const node)
+{
+        assert(w);
+        assert(node);
+
+        /* Reserve the room for a wide number */
+        ast_bin_node *nodes = (ast_bin_node *)grow(w->nodes, &w->nodes_cap, w->n_words + 2,
+                                                   sizeof(ast_bin_node), 0x400);
+        if (!nodes)
+                return -1;
+
+        w->nodes = nodes;
+        ast_bin_node *rec = w->nodes + w->n_words++;
+        w->n_nodes++;
+        *rec = {};
+
+        rec->type = (uint8_t)node->type;
+        if (node->left)
+                rec->flags |= AST_BIN_LEFT;
+        if (node->right)
+                rec->flags |= AST_BIN_RIGHT;
+
+        switch (node->type) {
+        case AST_NODE_IDENT: {
+                int32_t id = 0;
+                if (write_ident(w, ast_ident(node), &id))
+                        return -1;
+
+                rec->data = id;
+                break;
+        }
+        case AST_NODE_NUMBER: {
+                num_t number = ast_number(node);
+                if (number >= INT32_MIN && number <= INT32_MAX) {
+                        rec->data = (int32_t)number;
+                        break;
+                }
+
+                rec->flags |= AST_BIN_WIDE;
+                memcpy((void *)(w->nodes + w->n_words++), &number, sizeof(number));
+                break;
+        }
+        case AST_NODE_KEYWORD:
+                rec->data = ast_keyword(node);
+                break;
+        default:
+                assert(0);
+                break;
+        }
+
+        if (node->left && write_node(w, node->left))
+                return -1;
+        if (node->right && write_node(w, node->right))
+                return -1;
+
+        return 0;
+}
+
+int save_ast_binary(const char *file, ast_node *const tree)
+{
+        assert(file);
+        assert(tree);
+
+        ast_bin_writer w = {};
+        mmap_data md = {0};
+        int error = -1;
+
+        if (write_node(&w, tree))
+                goto cleanup;
+
+        if (w.n_words > UINT32_MAX || w.strtab_size > UINT32_MAX)
+                goto cleanup;
+
+        {
+                ast_bin_header header = {};
+                memcpy(header.magic, AST_BIN_MAGIC, sizeof(AST_BIN_MAGIC));
+                header.version     = AST_BIN_VERSION;
+                header.n_nodes     = (uint32_t)w.n_nodes;
+                header.n_words     = (uint32_t)w.n_words;
+                header.n_strs      = (uint32_t)w.n_strs;
+                header.strtab_size = (uint32_t)w.strtab_size;
+
+                size_t nodes_off = align8(sizeof(header) + w.strtab_size);
+
+                md.size = nodes_off + w.n_words * sizeof(ast_bin_node);
+                error = mmap_out(&md, file);
+                if (error)
+                        goto cleanup;
+
+                memcpy(md.buf, &header, sizeof(header));
+                if (w.strtab_size)
+                        memcpy(md.buf + sizeof(header), w.strtab, w.strtab_size);
+
+                memset(md.buf + sizeof(header) + w.strtab_size, 0,
+                       nodes_off - sizeof(header) - w.strtab_size);
+                memcpy(md.buf + nodes_off, w.nodes, w.n_words * sizeof(ast_bin_node));
+
+                mmap_free(&md);
+                error = 0;
+        }
+
+cleanup:
+        free(w.nodes);
+        free(w.strtab);
+        free(w.keys);
+        free(w.ids);
+
+        if (error)
+                fprintf(stderr, ascii(RED, "Can't save binary tree: %s\n"), file);
+
+        return error;
+}
+
+bool is_ast_binary(const char *buf, size_t size)
+{
+        assert(buf);
+        return size >= sizeof(ast_bin_header) &&
+               !memcmp(buf, AST_BIN_MAGIC, sizeof(AST_BIN_MAGIC));
+}
+
+ast_node *read_ast_binary(const char *buf, size_t size, intern_table *const idents)
+{
+        assert(buf);
+        assert(idents);
+
+        if (!is_ast_binary(buf, size))
+                return format_error("bad magic");
+
+        ast_bin_header header = {};
+        memcpy(&header, buf, sizeof(header));
+
+        if (header.version != AST_BIN_VERSION)
+                return format_error("unsupported version");
+
+        if (header.strtab_size > size - sizeof(header))
+                return format_error("string table is out of bounds");
+
+        size_t nodes_off = align8(sizeof(header) + header.strtab_size);
+        if (nodes_off > size ||
+            (size - nodes_off) / sizeof(ast_bin_node) < header.n_words)
+                return format_error("nodes are out of bounds");
+
+        if (!header.n_nodes || header.n_nodes > header.n_words)
+                return format_error("bad number of nodes");
+
+        const char **strs  = (const char **)calloc(header.n_strs + 1, sizeof(const char *));
+        ast_node ***slots  = (ast_node ***)calloc(header.n_nodes + 1, sizeof(ast_node **));
+        ast_node   *root   = nullptr;
+        ast_node   *result = nullptr;
+        size_t n_slots = 0;
+
+        const char *str = buf + sizeof(header);
+        const char *end = str + header.strtab_size;
+        const ast_bin_node *rec = (const ast_bin_node *)(const void *)(buf + nodes_off);
+        const ast_bin_node *last = rec + header.n_words;
+
+        if (!strs || !slots) {
+                fprintf(stderr, ascii(RED, "Core error"));
+                goto cleanup;
+        }
+
+        for (size_t i = 0; i < header.n_strs; i++) {
+                const char *nul = (const char *)memchr(str, '\0', (size_t)(end - str));
+                if (!nul) {
+                        format_error("string table is not terminated");
+                        goto cleanup;
+                }
+
+                strs[i] = intern(idents, str, (size_t)(nul - str));
+                if (!strs[i])
+                        goto cleanup;
+
+                str = nul + 1;
+        }
+
+        /* Pre-order: every record fills the last pending child slot */
+        slots[n_slots++] = &root;
+        for (size_t i = 0; i < header.n_nodes; i++, rec++) {
+                if (!n_slots || rec == last) {
+                        format_error("too many nodes");
+                        goto cleanup;
+                }
+
+                uint8_t flags  = rec->flags;
+                ast_node *node = nullptr;
+                switch (rec->type) {
+                case AST_NODE_IDENT:
+                        if (rec->data < 0 || (uint32_t)rec->data >= header.n_strs) {
+                                format_error("bad identifier index");
+                                goto cleanup;
+                        }
+
+                        node = create_ast_ident(strs[rec->data]);
+                        break;
+                case AST_NODE_NUMBER: {
+                        num_t number = rec->data;
+                        if (flags & AST_BIN_WIDE) {
+                                if (rec + 1 == last) {
+                                        format_error("wide number is out of bounds");
+                                        goto cleanup;
+                                }
+
+                                memcpy(&number, ++rec, sizeof(number));
+                        }
+
+                        node = create_ast_number(number);
+                        break;
+                }
+                case AST_NODE_KEYWORD:
+                        if (!is_ast_keyword(rec->data)) {
+                                format_error("bad keyword");
+                                goto cleanup;
+                        }
+
+                        node = create_ast_keyword((int)rec->data);
+                        break;
+                default:
+                        format_error("bad node type");
+                        goto cleanup;
+                }
+
+                if (!node)
+                        goto cleanup;
+
+                *slots[--n_slots] = node;
+
+                if (flags & AST_BIN_RIGHT)
+                        slots[n_slots++] = &node->right;
+                if (flags & AST_BIN_LEFT)
+                        slots[n_slots++] = &node->left;
+
+                if (n_slots > header.n_nodes - i - 1) {
+                        format_error("too few nodes");
+                        goto cleanup;
+                }
+        }
+
+        if (n_slots) {
+                format_error("too few nodes");
+                goto cleanup;
+        }
+
+        result = root;
+
+cleanup:
+        free(strs);
+        free(slots);
+        return result;
+}
+
+ast_node *load_ast_tree(char *buf, size_t size, intern_table *const idents)
+{
+        assert(buf);
+        assert(idents);
+
+        if (is_ast_binary(buf, size))
+                return read_ast_binary(buf, size, idents);
+
+        return read_ast_tree(&buf, idents);
+}
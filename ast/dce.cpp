@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <logs.h>
+#include <trace.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <ast/keyword.h>
+
+/*
+ * Dead code elimination.
+ *
+ * Statement lists are linked from the last statement to the first one
+ * through 'left'. Backends can't compile an empty list, so the only
+ * statement of a list is never removed.
+ */
+
+struct dce_func {
+        const char *name   = nullptr;   /* interned */
+        ast_node   *define = nullptr;
+        bool  reachable    = false;
+};
+
+static bool is_keyword(const ast_node *node, int keyword)
+{
+        return node && node->type == AST_NODE_KEYWORD && ast_keyword(node) == keyword;
+}
+
+static bool is_number(const ast_node *node)
+{
+        return node && node->type == AST_NODE_NUMBER;
+}
+
+static ast_node *trim_block(ast_node *block, size_t *n_dead);
+
+bool is_terminating(const ast_node *stmt)
+{
+        assert(stmt);
+
+        if (is_keyword(stmt, AST_RETURN))
+                return true;
+
+        /* There is no 'break', such loop is left by return only */
+        if (is_keyword(stmt, AST_WHILE))
+                return is_number(stmt->left) && ast_number(stmt->left);
+
+        if (!is_keyword(stmt, AST_IF))
+                return false;
+
+        const ast_node *decision = stmt->right;
+        bool then_returns = false;
+        for (const ast_node *iter = decision->left; iter; iter = iter->left)
+                then_returns = then_returns || is_terminating(iter->right);
+
+        if (is_number(stmt->left) && ast_number(stmt->left))
+                return then_returns;
+
+        bool else_returns = false;
+        for (const ast_node *iter = decision->right; iter; iter = iter->left)
+                else_returns = else_returns || is_terminating(iter->right);
+
+        return then_returns && else_returns;
+}
+
+/*
+ * Branches with folded conditions. Returns true if the whole statement is dead.
+ */
+static bool trim_stmt(ast_node *stmt, size_t *n_dead)
+{
+        assert(stmt);
+
+        switch (stmt->type == AST_NODE_KEYWORD ? ast_keyword(stmt) : AST_NULL) {
+        case AST_DEFINE:
+                if (stmt->right)
+                        stmt->right = trim_block(stmt->right, n_dead);
+                return false;
+
+        case AST_WHILE:
+                if (is_number(stmt->left) && !ast_number(stmt->left))
+                        return true;
+
+                stmt->right = trim_block(stmt->right, n_dead);
+                return false;
+
+        case AST_IF: {
+                ast_node *decision = stmt->right;
+                assert(is_keyword(decision, AST_DECISN));
+
+                if (is_number(stmt->left) && ast_number(stmt->left) && decision->right) {
+                        *n_dead += calc_tree_size(decision->right);
+                        decision->right = nullptr;
+                }
+
+                if (is_number(stmt->left) && !ast_number(stmt->left)) {
+                        if (!decision->right)
+                                return true;
+
+                        /* if (0) A else B is if (1) B, so B keeps its own scope */
+                        *n_dead += calc_tree_size(decision->left);
+                        set_ast_number(stmt->left, 1);
+                        decision->left  = decision->right;
+                        decision->right = nullptr;
+                }
+
+                decision->left = trim_block(decision->left, n_dead);
+                if (decision->right)
+                        decision->right = trim_block(decision->right, n_dead);
+                return false;
+        }
+
+        default:
+                return false;
+        }
+}
+
+/*
+ * Returns the new last statement of the list.
+ */
+static ast_node *trim_block(ast_node *block, size_t *n_dead)
+{
+        assert(block);
+
+        /* Everything after the first terminating statement is unreachable */
+        ast_node *last = block;
+        for (ast_node *stmt = block; stmt; stmt = stmt->left) {
+                if (stmt->right && is_terminating(stmt->right))
+                        last = stmt;
+        }
+
+        for (ast_node *stmt = block; stmt != last; stmt = stmt->left)
+                *n_dead += 1 + calc_tree_size(stmt->right);
+
+        block = last;
+
+        ast_node **link = &block;
+        while (*link) {
+                ast_node *stmt = *link;
+                bool only = stmt == block && !stmt->left;
+
+                if (stmt->right && trim_stmt(stmt->right, n_dead) && !only) {
+                        *n_dead += 1 + calc_tree_size(stmt->right);
+                        *link = stmt->left;
+                        continue;
+                }
+
+                link = &stmt->left;
+        }
+
+        return block;
+}
+
+static int compare_funcs(const void *lhs, const void *rhs)
+{
+        const char *lname = ((const dce_func *)lhs)->name;
+        const char *rname = ((const dce_func *)rhs)->name;
+
+        return lname < rname ? -1 : lname > rname;
+}
+
+static dce_func *find_func(array *funcs, const char *name)
+{
+        if (!funcs->size)
+                return nullptr;
+
+        dce_func key = {};
+        key.name = name;
+
+        return (dce_func *)bsearch(&key, funcs->data, funcs->size,
+                                   sizeof(dce_func), compare_funcs);
+}
+
+/*
+ * Marks functions called from 'node' and pushes them to 'queue'.
+ * Returns nonzero if there is no memory.
+ */
+static int mark_calls(ast_node *node, array *funcs, array *queue)
+{
+        if (!node)
+                return 0;
+
+        if (is_keyword(node, AST_CALL) && node->left && node->left->type == AST_NODE_IDENT) {
+                dce_func *func = find_func(funcs, ast_ident(node->left));
+                if (func && !func->reachable) {
+                        func->reachable = true;
+                        if (!array_push(queue, &func, sizeof(dce_func *)))
+                                return -1;
+                }
+        }
+
+        if (mark_calls(node->left, funcs, queue))
+                return -1;
+
+        return mark_calls(node->right, funcs, queue);
+}
+
+static const char *func_name(ast_node *define)
+{
+        ast_node *func = define->left;
+        if (!is_keyword(func, AST_FUNC) || !func->left || func->left->type != AST_NODE_IDENT)
+                return nullptr;
+
+        return ast_ident(func->left);
+}
+
+/*
+ * Call graph is rooted at main() and global initializers.
+ * Returns nonzero if there is no main(), some function is
+ * defined twice or there is no memory.
+ */
+static int mark_reachable(ast_node *root, array *funcs)
+{
+        for (ast_node *stmt = root; stmt; stmt = stmt->left) {
+                if (!is_keyword(stmt->right, AST_DEFINE))
+                        continue;
+
+                dce_func func = {};
+                func.name   = func_name(stmt->right);
+                func.define = stmt->right;
+
+                if (func.name && !array_push(funcs, &func, sizeof(dce_func)))
+                        return -1;
+        }
+
+        if (funcs->size)
+                qsort(funcs->data, funcs->size, sizeof(dce_func), compare_funcs);
+
+        /* Double definition is reported by backends, keep it for them */
+        dce_func *main = nullptr;
+        for (size_t i = 0; i < funcs->size; i++) {
+                dce_func *func = (dce_func *)funcs->data + i;
+                if (i && func->name == func[-1].name)
+                        return -1;
+
+                if (!strcmp(func->name, "main"))
+                        main = func;
+        }
+
+        if (!main)
+                return -1;
+
+        array queue = {0};
+        main->reachable = true;
+        int error = !array_push(&queue, &main, sizeof(dce_func *));
+
+        for (ast_node *stmt = root; stmt && !error; stmt = stmt->left) {
+                if (!is_keyword(stmt->right, AST_DEFINE))
+                        error = mark_calls(stmt->right, funcs, &queue);
+        }
+
+        while (queue.size && !error) {
+                dce_func *func = *(dce_func **)array_top(&queue, sizeof(dce_func *));
+                array_pop(&queue, sizeof(dce_func *));
+                trace_point(TRACE_FRONTEND, func->define);
+
+                error = mark_calls(func->define->right, funcs, &queue);
+        }
+
+        free_array(&queue, sizeof(dce_func *));
+        return error ? -1 : 0;
+}
+
+ast_node *eliminate_dead_code(ast_node *root, size_t *n_dead)
+{
+        assert(root);
+
+        size_t dead = 0;
+        for (ast_node *stmt = root; stmt; stmt = stmt->left) {
+                if (stmt->right)
+                        trim_stmt(stmt->right, &dead);
+        }
+
+        array funcs = {0};
+        if (!mark_reachable(root, &funcs)) {
+                ast_node **link = &root;
+                while (*link) {
+                        ast_node *stmt = *link;
+                        if (is_keyword(stmt->right, AST_DEFINE) && func_name(stmt->right) &&
+                            !find_func(&funcs, func_name(stmt->right))->reachable) {
+                                dead += 1 + calc_tree_size(stmt->right);
+                                *link = stmt->left;
+                                continue;
+                        }
+
+                        link = &stmt->left;
+                }
+        }
+
+        free_array(&funcs, sizeof(dce_func));
+
+        if (n_dead)
+                *n_dead = dead;
+
+        return root;
+}
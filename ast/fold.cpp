@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <logs.h>
+#include <trace.h>
+
+#include <ast/tree.h>
+#include <ast/keyword.h>
+
+/*
+ * Constant folding and algebraic simplification.
+ *
+ * Values are 64-bit integers wrapping on overflow, '&&' and '||' are
+ * bitwise as both backends compile them. The AST standard has no unary
+ * minus, so '0 - x' is the negation and backends recognize it.
+ *
+ * Subtrees with calls, scan() or division which may trap are never dropped.
+ */
+
+static bool is_number(const ast_node *node, num_t value)
+{
+        return node->type == AST_NODE_NUMBER && ast_number(node) == value;
+}
+
+static bool is_keyword(const ast_node *node, int keyword)
+{
+        return node->type == AST_NODE_KEYWORD && ast_keyword(node) == keyword;
+}
+
+/*
+ * 0 - x
+ */
+static bool is_neg(const ast_node *node)
+{
+        return is_keyword(node, AST_SUB) && node->left && is_number(node->left, 0);
+}
+
+static bool is_pure(const ast_node *node)
+{
+        assert(node);
+
+        if (is_keyword(node, AST_CALL) || is_keyword(node, AST_IN))
+                return false;
+
+        /* Division by zero traps */
+        if (is_keyword(node, AST_DIV) && (node->right->type != AST_NODE_NUMBER ||
+                                          !ast_number(node->right)))
+                return false;
+
+        return (!node->left  || is_pure(node->left)) &&
+               (!node->right || is_pure(node->right));
+}
+
+static bool is_cmp(int keyword)
+{
+        switch (keyword) {
+        case AST_EQUAL:
+        case AST_NEQUAL:
+        case AST_GREAT:
+        case AST_LOW:
+        case AST_GEQUAL:
+        case AST_LEQUAL:
+                return true;
+        default:
+                return false;
+        }
+}
+
+/*
+ * !(a < b) is (a >= b) and so on.
+ */
+static int invert_cmp(int keyword)
+{
+        switch (keyword) {
+        case AST_EQUAL:  return AST_NEQUAL;
+        case AST_NEQUAL: return AST_EQUAL;
+        case AST_GREAT:  return AST_LEQUAL;
+        case AST_LOW:    return AST_GEQUAL;
+        case AST_GEQUAL: return AST_LOW;
+        case AST_LEQUAL: return AST_GREAT;
+        default:
+                assert(0);
+                return AST_NULL;
+        }
+}
+
+/*
+ * Same as __ass_pow: negative exponent gives 1 / base^n truncated toward zero.
+ */
+static num_t power(num_t base, num_t exp)
+{
+        if (exp < 0) {
+                if (base == 1)
+                        return 1;
+                if (base == -1)
+                        return exp & 1 ? -1 : 1;
+
+                return 0;
+        }
+
+        uint64_t result = 1;
+        uint64_t ubase  = (uint64_t)base;
+        for (uint64_t n = (uint64_t)exp; n; n >>= 1) {
+                if (n & 1)
+                        result *= ubase;
+
+                ubase *= ubase;
+        }
+
+        return (num_t)result;
+}
+
+/*
+ * Evaluates 'keyword' on numbers. Returns false if it's not possible
+ * to do at compile time, e.g. on division by zero.
+ */
+static bool evaluate(int keyword, num_t lhs, num_t rhs, num_t *value)
+{
+        assert(value);
+
+        /* Signed overflow is undefined, unsigned one wraps */
+        uint64_t ulhs = (uint64_t)lhs;
+        uint64_t urhs = (uint64_t)rhs;
+
+        switch (keyword) {
+        case AST_ADD:    *value = (num_t)(ulhs + urhs); return true;
+        case AST_SUB:    *value = (num_t)(ulhs - urhs); return true;
+        case AST_MUL:    *value = (num_t)(ulhs * urhs); return true;
+        case AST_POW:    *value = power(lhs, rhs);      return true;
+        case AST_AND:    *value = lhs & rhs;  return true;
+        case AST_OR:     *value = lhs | rhs;  return true;
+        case AST_EQUAL:  *value = lhs == rhs; return true;
+        case AST_NEQUAL: *value = lhs != rhs; return true;
+        case AST_GREAT:  *value = lhs >  rhs; return true;
+        case AST_LOW:    *value = lhs <  rhs; return true;
+        case AST_GEQUAL: *value = lhs >= rhs; return true;
+        case AST_LEQUAL: *value = lhs <= rhs; return true;
+        case AST_DIV:
+                /* Both trap at runtime, leave it there */
+                if (!rhs || (lhs == INT64_MIN && rhs == -1))
+                        return false;
+
+                *value = lhs / rhs;
+                return true;
+        default:
+                return false;
+        }
+}
+
+/*
+ * Turns the operator node into the number. Its operands are dropped.
+ */
+static ast_node *fold_number(ast_node *node, num_t value, size_t *n_folded)
+{
+        *n_folded += calc_tree_size(node->left) + calc_tree_size(node->right);
+
+        node->type  = AST_NODE_NUMBER;
+        node->left  = nullptr;
+        node->right = nullptr;
+        set_ast_number(node, value);
+
+        return node;
+}
+
+/*
+ * Replaces the operator node with its operand 'keep', the other one is dropped.
+ */
+static ast_node *fold_operand(ast_node *node, ast_node *keep, size_t *n_folded)
+{
+        ast_node *drop = keep == node->left ? node->right : node->left;
+        *n_folded += 1 + calc_tree_size(drop);
+
+        return keep;
+}
+
+static ast_node *fold_not(ast_node *node, size_t *n_folded)
+{
+        ast_node *operand = node->right;
+        assert(operand);
+
+        /* Backends agree on booleans only: legacy one flips the lowest bit */
+        if (is_number(operand, 0) || is_number(operand, 1))
+                return fold_number(node, !ast_number(operand), n_folded);
+
+        if (operand->type != AST_NODE_KEYWORD)
+                return node;
+
+        if (is_cmp(ast_keyword(operand))) {
+                set_ast_keyword(operand, invert_cmp(ast_keyword(operand)));
+                *n_folded += 1;
+                return operand;
+        }
+
+        /* !!(a < b) */
+        if (ast_keyword(operand) == AST_NOT && operand->right->type == AST_NODE_KEYWORD &&
+            is_cmp(ast_keyword(operand->right))) {
+                *n_folded += 2;
+                return operand->right;
+        }
+
+        return node;
+}
+
+static bool is_commutative(int keyword)
+{
+        switch (keyword) {
+        case AST_ADD:
+        case AST_MUL:
+        case AST_AND:
+        case AST_OR:
+        case AST_EQUAL:
+        case AST_NEQUAL:
+                return true;
+        default:
+                return false;
+        }
+}
+
+static ast_node *fold_expr(ast_node *node, size_t *n_folded)
+{
+        int keyword = ast_keyword(node);
+        if (keyword == AST_NOT)
+                return fold_not(node, n_folded);
+
+        if (!node->left || !node->right)
+                return node;
+
+        num_t value = 0;
+        if (node->left->type == AST_NODE_NUMBER && node->right->type == AST_NODE_NUMBER) {
+                if (evaluate(keyword, ast_number(node->left), ast_number(node->right), &value))
+                        return fold_number(node, value, n_folded);
+
+                return node;
+        }
+
+        /* Constant goes to the right, so the rules below and backends check one side */
+        if (is_commutative(keyword) && node->left->type == AST_NODE_NUMBER) {
+                ast_node *number = node->left;
+                node->left  = node->right;
+                node->right = number;
+        }
+
+        ast_node *lhs = node->left;
+        ast_node *rhs = node->right;
+
+        switch (keyword) {
+        case AST_ADD:
+                /* x + 0 */
+                if (is_number(rhs, 0))
+                        return fold_operand(node, lhs, n_folded);
+
+                /* x + (0 - y) is x - y */
+                if (is_neg(rhs)) {
+                        set_ast_keyword(node, AST_SUB);
+                        node->right = rhs->right;
+                        *n_folded += 2;
+                        return node;
+                }
+
+                /* (x + c1) + c2 is x + (c1 + c2) */
+                if (rhs->type == AST_NODE_NUMBER && is_keyword(lhs, AST_ADD) &&
+                    lhs->right->type == AST_NODE_NUMBER) {
+                        evaluate(AST_ADD, ast_number(lhs->right), ast_number(rhs), &value);
+                        set_ast_number(rhs, value);
+                        node->left = lhs->left;
+                        *n_folded += 2;
+                        return fold_expr(node, n_folded);
+                }
+                break;
+
+        case AST_SUB:
+                /* x - 0 */
+                if (is_number(rhs, 0))
+                        return fold_operand(node, lhs, n_folded);
+
+                /* 0 - (0 - x) */
+                if (is_number(lhs, 0) && is_neg(rhs)) {
+                        *n_folded += 3;
+                        return rhs->right;
+                }
+
+                /* x - (0 - y) is x + y */
+                if (is_neg(rhs)) {
+                        set_ast_keyword(node, AST_ADD);
+                        node->right = rhs->right;
+                        *n_folded += 2;
+                        return fold_expr(node, n_folded);
+                }
+                break;
+
+        case AST_MUL:
+                /* x * 1 */
+                if (is_number(rhs, 1))
+                        return fold_operand(node, lhs, n_folded);
+
+                /* x * 0 */
+                if (is_number(rhs, 0) && is_pure(lhs))
+                        return fold_operand(node, rhs, n_folded);
+
+                /* x * -1 is 0 - x */
+                if (is_number(rhs, -1)) {
+                        set_ast_keyword(node, AST_SUB);
+                        set_ast_number(rhs, 0);
+                        node->left  = rhs;
+                        node->right = lhs;
+                        return fold_expr(node, n_folded);
+                }
+
+                /* (x * c1) * c2 is x * (c1 * c2) */
+                if (rhs->type == AST_NODE_NUMBER && is_keyword(lhs, AST_MUL) &&
+                    lhs->right->type == AST_NODE_NUMBER) {
+                        evaluate(AST_MUL, ast_number(lhs->right), ast_number(rhs), &value);
+                        set_ast_number(rhs, value);
+                        node->left = lhs->left;
+                        *n_folded += 2;
+                        return fold_expr(node, n_folded);
+                }
+                break;
+
+        case AST_POW:
+                /* x ^ 1 */
+                if (is_number(rhs, 1))
+                        return fold_operand(node, lhs, n_folded);
+
+                /* x ^ 0 */
+                if (is_number(rhs, 0) && is_pure(lhs)) {
+                        set_ast_number(rhs, 1);
+                        return fold_operand(node, rhs, n_folded);
+                }
+                break;
+
+        case AST_DIV:
+                /* x / 1 */
+                if (is_number(rhs, 1))
+                        return fold_operand(node, lhs, n_folded);
+
+                /* 0 / x is not folded: x may be zero */
+                break;
+
+        case AST_AND:
+                /* x && 0 */
+                if (is_number(rhs, 0) && is_pure(lhs))
+                        return fold_operand(node, rhs, n_folded);
+                break;
+
+        case AST_OR:
+                /* x || 0 */
+                if (is_number(rhs, 0))
+                        return fold_operand(node, lhs, n_folded);
+                break;
+
+        default:
+                break;
+        }
+
+        return node;
+}
+
+/*
+ * Returns the node which replaces 'node'.
+ */
+static ast_node *fold(ast_node *node, size_t *n_folded)
+{
+        assert(node);
+
+        /* Identifier's left is the const mark, the right one is the index */
+        if (node->type == AST_NODE_IDENT) {
+                if (node->right)
+                        node->right = fold(node->right, n_folded);
+
+                return node;
+        }
+
+        if (node->type != AST_NODE_KEYWORD)
+                return node;
+
+        if (node->left)
+                node->left  = fold(node->left,  n_folded);
+        if (node->right)
+                node->right = fold(node->right, n_folded);
+
+        switch (ast_keyword(node)) {
+        case AST_ADD:
+        case AST_SUB:
+        case AST_MUL:
+        case AST_DIV:
+        case AST_POW:
+        case AST_NOT:
+        case AST_AND:
+        case AST_OR:
+        case AST_EQUAL:
+        case AST_NEQUAL:
+        case AST_GREAT:
+        case AST_LOW:
+        case AST_GEQUAL:
+        case AST_LEQUAL:
+                trace_point(TRACE_FRONTEND, node);
+                return fold_expr(node, n_folded);
+        default:
+                return node;
+        }
+}
+
+ast_node *fold_tree(ast_node *root, size_t *n_folded)
+{
+        assert(root);
+
+        size_t folded = 0;
+        root = fold(root, &folded);
+
+        if (n_folded)
+                *n_folded = folded;
+
+        return root;
+}
@@ -0,0 +1,694 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <logs.h>
+#include <trace.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <ast/keyword.h>
+
+/*
+ * Inlining of small leaf functions.
+ *
+ * Body of a single return is substituted right into the expression if
+ * all the arguments are numbers or variables. Otherwise the call must be
+ * the whole expression of return, assignment, out() or call statement:
+ * arguments are assigned to the callee parameters, the body is spliced
+ * before the statement and its returns store the result.
+ *
+ * Callee locals are renamed to "callee.name". Dots never appear in the
+ * source, so these names can't clash with the caller ones.
+ *
+ * Legacy backend sees a global only after its declaration. Functions
+ * using globals declared between the functions are never inlined.
+ */
+
+struct inline_func {
+        const char *name   = nullptr;   /* interned */
+        ast_node   *define = nullptr;
+        size_t    n_params = 0;
+
+        array locals = {};              /* const char *: parameters and assigned names */
+        array frees  = {};              /* const char *: the other names, globals */
+
+        bool inlinable   = false;
+        bool single_expr = false;       /* the body is 'return expr' */
+};
+
+struct inline_ctx {
+        intern_table *idents = nullptr;
+        array funcs   = {};             /* inline_func, sorted by name */
+        array globals = {};             /* const char *: declared before any function */
+        array late    = {};             /* const char *: declared between the functions */
+
+        size_t budget    = 0;
+        size_t n_inlined = 0;
+};
+
+static bool is_keyword(const ast_node *node, int keyword)
+{
+        return node && node->type == AST_NODE_KEYWORD && ast_keyword(node) == keyword;
+}
+
+static int compare_names(const void *lhs, const void *rhs)
+{
+        const char *lname = *(const char *const *)lhs;
+        const char *rname = *(const char *const *)rhs;
+
+        return lname < rname ? -1 : lname > rname;
+}
+
+/*
+ * Names are interned, the pointer order is enough for the binary search.
+ */
+static void sort_names(array *names)
+{
+        if (!names->size)
+                return;
+
+        const char **data = (const char **)names->data;
+        qsort(data, names->size, sizeof(const char *), compare_names);
+
+        size_t n_unique = 0;
+        for (size_t i = 0; i < names->size; i++) {
+                if (!n_unique || data[n_unique - 1] != data[i])
+                        data[n_unique++] = data[i];
+        }
+
+        names->size = n_unique;
+}
+
+static bool has_name(const array *names, const char *name)
+{
+        if (!names->size)
+                return false;
+
+        return bsearch(&name, names->data, names->size,
+                       sizeof(const char *), compare_names);
+}
+
+static int push_name(array *names, const char *name)
+{
+        return array_push(names, &name, sizeof(const char *)) ? 0 : -1;
+}
+
+static int compare_funcs(const void *lhs, const void *rhs)
+{
+        const char *lname = ((const inline_func *)lhs)->name;
+        const char *rname = ((const inline_func *)rhs)->name;
+
+        return lname < rname ? -1 : lname > rname;
+}
+
+static inline_func *find_func(inline_ctx *ctx, const char *name)
+{
+        if (!ctx->funcs.size)
+                return nullptr;
+
+        inline_func key = {};
+        key.name = name;
+
+        return (inline_func *)bsearch(&key, ctx->funcs.data, ctx->funcs.size,
+                                      sizeof(inline_func), compare_funcs);
+}
+
+static const char *func_name(ast_node *define)
+{
+        ast_node *func = define->left;
+        if (!is_keyword(func, AST_FUNC) || !func->left || func->left->type != AST_NODE_IDENT)
+                return nullptr;
+
+        return ast_ident(func->left);
+}
+
+/*
+ * Parameters and the assigned names which are not globals.
+ */
+static int collect_locals(inline_ctx *ctx, ast_node *node, array *locals)
+{
+        if (!node)
+                return 0;
+
+        if (is_keyword(node, AST_ASSIGN) && node->left && node->left->type == AST_NODE_IDENT) {
+                const char *name = ast_ident(node->left);
+                if (!has_name(&ctx->globals, name) && push_name(locals, name))
+                        return -1;
+        }
+
+        if (collect_locals(ctx, node->left, locals))
+                return -1;
+
+        return collect_locals(ctx, node->right, locals);
+}
+
+static int collect_params(ast_node *define, array *locals, size_t *n_params)
+{
+        for (ast_node *param = define->left->right; param; param = param->left) {
+                if (!param->right || param->right->type != AST_NODE_IDENT)
+                        return -1;
+
+                if (push_name(locals, ast_ident(param->right)))
+                        return -1;
+
+                (*n_params)++;
+        }
+
+        return 0;
+}
+
+static bool is_param(ast_node *define, const char *name)
+{
+        for (ast_node *param = define->left->right; param; param = param->left) {
+                if (ast_ident(param->right) == name)
+                        return true;
+        }
+
+        return false;
+}
+
+/*
+ * Checks the body can be copied anywhere: no calls, the other names
+ * are globals declared before any function and parameters are never
+ * indexed.
+ */
+static bool scan_body(inline_ctx *ctx, inline_func *func, ast_node *node)
+{
+        if (!node)
+                return true;
+
+        if (is_keyword(node, AST_CALL))
+                return false;
+
+        if (node->type == AST_NODE_IDENT) {
+                const char *name = ast_ident(node);
+                if (has_name(&ctx->late, name))
+                        return false;
+
+                if (has_name(&func->locals, name)) {
+                        if (node->right && is_param(func->define, name))
+                                return false;
+                } else if (!has_name(&ctx->globals, name) || push_name(&func->frees, name)) {
+                        return false;
+                }
+        }
+
+        return scan_body(ctx, func, node->left) && scan_body(ctx, func, node->right);
+}
+
+static void analyze_func(inline_ctx *ctx, inline_func *func)
+{
+        ast_node *body = func->define->right;
+        if (!body || !strcmp(func->name, "main"))
+                return;
+
+        if (calc_tree_size(body) > ctx->budget)
+                return;
+
+        if (collect_params(func->define, &func->locals, &func->n_params) ||
+            collect_locals(ctx, body, &func->locals))
+                return;
+
+        sort_names(&func->locals);
+        if (!scan_body(ctx, func, body))
+                return;
+
+        sort_names(&func->frees);
+
+        /* Falling off the end is not defined */
+        bool terminates = false;
+        for (ast_node *stmt = body; stmt; stmt = stmt->left)
+                terminates = terminates || (stmt->right && is_terminating(stmt->right));
+
+        if (!terminates)
+                return;
+
+        func->single_expr = !body->left && is_keyword(body->right, AST_RETURN);
+        func->inlinable   = true;
+}
+
+static int collect_funcs(inline_ctx *ctx, ast_node *root)
+{
+        /* Top level is linked from the last statement */
+        array stmts = {0};
+        for (ast_node *stmt = root; stmt; stmt = stmt->left) {
+                if (!array_push(&stmts, &stmt, sizeof(ast_node *))) {
+                        free_array(&stmts, sizeof(ast_node *));
+                        return -1;
+                }
+        }
+
+        int error = 0;
+        bool defined = false;
+        for (size_t i = stmts.size; i > 0 && !error; i--) {
+                ast_node *stmt = ((ast_node **)stmts.data)[i - 1]->right;
+
+                if (is_keyword(stmt, AST_ASSIGN) && stmt->left->type == AST_NODE_IDENT) {
+                        error = push_name(defined ? &ctx->late : &ctx->globals, ast_ident(stmt->left));
+                        continue;
+                }
+
+                if (!is_keyword(stmt, AST_DEFINE))
+                        continue;
+
+                defined = true;
+
+                inline_func func = {};
+                func.name   = func_name(stmt);
+                func.define = stmt;
+
+                if (func.name && !array_push(&ctx->funcs, &func, sizeof(inline_func)))
+                        error = -1;
+        }
+
+        free_array(&stmts, sizeof(ast_node *));
+        if (error)
+                return -1;
+
+        sort_names(&ctx->globals);
+        sort_names(&ctx->late);
+        if (ctx->funcs.size)
+                qsort(ctx->funcs.data, ctx->funcs.size, sizeof(inline_func), compare_funcs);
+
+        inline_func *funcs = (inline_func *)ctx->funcs.data;
+        for (size_t i = 0; i < ctx->funcs.size; i++) {
+                /* Double definition is reported by backends */
+                if (i && funcs[i].name == funcs[i - 1].name)
+                        return -1;
+        }
+
+        for (size_t i = 0; i < ctx->funcs.size; i++)
+                analyze_func(ctx, funcs + i);
+
+        return 0;
+}
+
+static const char *local_name(inline_ctx *ctx, const char *func, const char *name)
+{
+        char buf[256] = {0};
+        int len = snprintf(buf, sizeof(buf), "%s.%s", func, name);
+        if (len < 0 || (size_t)len >= sizeof(buf))
+                return nullptr;
+
+        return intern(ctx->idents, buf, (size_t)len);
+}
+
+/*
+ * Callee is inlined into the caller, which has its own locals.
+ */
+static inline_func *find_callee(inline_ctx *ctx, ast_node *call, const array *caller_locals)
+{
+        if (!call->left || call->left->type != AST_NODE_IDENT)
+                return nullptr;
+
+        inline_func *callee = find_func(ctx, ast_ident(call->left));
+        if (!callee || !callee->inlinable)
+                return nullptr;
+
+        size_t n_args = 0;
+        for (ast_node *arg = call->right; arg; arg = arg->left)
+                n_args++;
+
+        if (n_args != callee->n_params)
+                return nullptr;
+
+        /* Global used by the callee must not be hidden by the caller local */
+        const char **frees = (const char **)callee->frees.data;
+        for (size_t i = 0; i < callee->frees.size; i++) {
+                if (has_name(caller_locals, frees[i]))
+                        return nullptr;
+        }
+
+        return callee;
+}
+
+static bool is_simple_arg(const ast_node *arg)
+{
+        return arg->type == AST_NODE_NUMBER || (arg->type == AST_NODE_IDENT && !arg->right);
+}
+
+/*
+ * Replaces parameters of the copied expression with the arguments.
+ */
+static ast_node *substitute(ast_node *node, ast_node *params, ast_node *args)
+{
+        if (node->type == AST_NODE_IDENT && !node->right) {
+                ast_node *arg = args;
+                for (ast_node *param = params; param; param = param->left, arg = arg->left) {
+                        if (ast_ident(param->right) == ast_ident(node))
+                                return copy_tree(arg->right);
+                }
+
+                return node;
+        }
+
+        /* Identifier's left is the const mark, the right one is the index */
+        if (node->left && node->type != AST_NODE_IDENT) {
+                node->left = substitute(node->left, params, args);
+                if (!node->left)
+                        return nullptr;
+        }
+
+        if (node->right) {
+                node->right = substitute(node->right, params, args);
+                if (!node->right)
+                        return nullptr;
+        }
+
+        return node;
+}
+
+/*
+ * f(a, 2) is replaced with the body expression of f.
+ */
+static bool inline_expr(inline_ctx *ctx, ast_node *call, const array *caller_locals)
+{
+        inline_func *callee = find_callee(ctx, call, caller_locals);
+        if (!callee || !callee->single_expr)
+                return false;
+
+        for (ast_node *arg = call->right; arg; arg = arg->left) {
+                if (!is_simple_arg(arg->right))
+                        return false;
+        }
+
+        ast_node *expr = copy_tree(callee->define->right->right->right);
+        if (!expr)
+                return false;
+
+        expr = substitute(expr, callee->define->left->right, call->right);
+        if (!expr)
+                return false;
+
+        trace_point(TRACE_FRONTEND, call);
+        *call = *expr;
+        ctx->n_inlined++;
+        return true;
+}
+
+/*
+ * Calls are inlined bottom-up, so the arguments go first.
+ */
+static void inline_exprs(inline_ctx *ctx, ast_node *node, const array *caller_locals)
+{
+        if (!node)
+                return;
+
+        /* Identifier's left is the const mark */
+        if (node->type == AST_NODE_IDENT) {
+                inline_exprs(ctx, node->right, caller_locals);
+                return;
+        }
+
+        inline_exprs(ctx, node->left,  caller_locals);
+        inline_exprs(ctx, node->right, caller_locals);
+
+        if (is_keyword(node, AST_CALL))
+                inline_expr(ctx, node, caller_locals);
+}
+
+static void rename_locals(ast_node *node, const array *locals, const array *renamed)
+{
+        if (!node)
+                return;
+
+        if (node->type == AST_NODE_IDENT && locals->size) {
+                const char **names = (const char **)locals->data;
+                const char **found = (const char **)bsearch(&node->data.ident, names, locals->size,
+                                                            sizeof(const char *), compare_names);
+                if (found)
+                        set_ast_ident(node, ((const char **)renamed->data)[found - names]);
+        }
+
+        rename_locals(node->left,  locals, renamed);
+        rename_locals(node->right, locals, renamed);
+}
+
+static bool block_terminates(const ast_node *block)
+{
+        for (const ast_node *stmt = block; stmt; stmt = stmt->left) {
+                if (stmt->right && is_terminating(stmt->right))
+                        return true;
+        }
+
+        return false;
+}
+
+/*
+ * Turns returns of the copied body into assignments to 'result'.
+ * Return is allowed at the very end of the body only, so 'if (c) return x;'
+ * takes the rest of the block as its else branch first. 'tail' is set if
+ * the function ends right after the block.
+ */
+static bool lower_returns(ast_node **block, bool tail, const char *result)
+{
+        array stmts = {0};
+        for (ast_node *stmt = *block; stmt; stmt = stmt->left) {
+                if (!array_push(&stmts, &stmt, sizeof(ast_node *))) {
+                        free_array(&stmts, sizeof(ast_node *));
+                        return false;
+                }
+        }
+
+        /* Statements are linked from the last one, go in the source order */
+        ast_node **order = (ast_node **)stmts.data;
+        bool lowered = true;
+        for (size_t i = stmts.size; i > 0 && lowered; i--) {
+                ast_node *node = order[i - 1];
+                ast_node *stmt = node->right;
+                bool last = i == 1;
+
+                if (is_keyword(stmt, AST_IF)) {
+                        ast_node *decision = stmt->right;
+                        if (!last && !decision->right && block_terminates(decision->left)) {
+                                order[i - 2]->left = nullptr;
+                                decision->right = order[0];
+                                *block = node;
+                                last   = true;
+                        }
+
+                        lowered = lower_returns(&decision->left, tail && last, result);
+                        if (lowered && decision->right)
+                                lowered = lower_returns(&decision->right, tail && last, result);
+                } else if (is_keyword(stmt, AST_WHILE)) {
+                        lowered = lower_returns(&stmt->right, false, result);
+                } else if (is_keyword(stmt, AST_RETURN)) {
+                        if (!tail || !last) {
+                                lowered = false;
+                        } else {
+                                set_ast_keyword(stmt, AST_ASSIGN);
+                                stmt->left = create_ast_ident(result);
+                                lowered = stmt->left;
+                        }
+                }
+
+                if (last)
+                        break;
+        }
+
+        free_array(&stmts, sizeof(ast_node *));
+        return lowered;
+}
+
+static ast_node *create_assign(const char *name, ast_node *expr)
+{
+        ast_node *assign = create_ast_keyword(AST_ASSIGN);
+        if (!assign)
+                return nullptr;
+
+        assign->left  = create_ast_ident(name);
+        assign->right = expr;
+
+        return assign->left ? assign : nullptr;
+}
+
+/*
+ * Appends the statement to the list linked from the last one.
+ */
+static int append_stmt(ast_node **last, ast_node *stmt)
+{
+        ast_node *node = create_ast_keyword(AST_STMT);
+        if (!node || !stmt)
+                return -1;
+
+        node->left  = *last;
+        node->right = stmt;
+        *last = node;
+
+        return 0;
+}
+
+/*
+ * Returns the call which is the whole expression of the statement.
+ */
+static ast_node **stmt_call(ast_node *stmt)
+{
+        if (is_keyword(stmt, AST_RETURN) || is_keyword(stmt, AST_ASSIGN) || is_keyword(stmt, AST_OUT)) {
+                if (is_keyword(stmt->right, AST_CALL))
+                        return &stmt->right;
+        }
+
+        return nullptr;
+}
+
+/*
+ * Replaces the statement '*link' with the callee body. Returns the new
+ * last statement of the spliced part or nullptr if the call is kept.
+ *
+ *      return f(x, y);         assert(f.b = y);
+ *                              assert(f.a = x);
+ *                              body of f
+ *
+ *      assert(z = f(x, y));    assert(f.return = 0);
+ *                              assert(f.b = y);
+ *                              assert(f.a = x);
+ *                              body of f, return e is assert(f.return = e)
+ *                              assert(z = f.return);
+ */
+static ast_node *inline_stmt(inline_ctx *ctx, ast_node *node, const array *caller_locals)
+{
+        ast_node *stmt = node->right;
+        ast_node **callp = is_keyword(stmt, AST_CALL) ? &node->right : stmt_call(stmt);
+        if (!callp)
+                return nullptr;
+
+        ast_node *call = *callp;
+        inline_func *callee = find_callee(ctx, call, caller_locals);
+        if (!callee)
+                return nullptr;
+
+        array renamed = {0};
+        const char **locals = (const char **)callee->locals.data;
+        for (size_t i = 0; i < callee->locals.size; i++) {
+                const char *name = local_name(ctx, callee->name, locals[i]);
+                if (!name || push_name(&renamed, name)) {
+                        free_array(&renamed, sizeof(const char *));
+                        return nullptr;
+                }
+        }
+
+        ast_node *body = copy_tree(callee->define->right);
+        bool returns = is_keyword(stmt, AST_RETURN);
+        const char *result = returns ? nullptr : local_name(ctx, callee->name, "return");
+
+        if (!body || (!returns && (!result || !lower_returns(&body, true, result)))) {
+                free_array(&renamed, sizeof(const char *));
+                return nullptr;
+        }
+
+        rename_locals(body, &callee->locals, &renamed);
+
+        ast_node *last = node->left;
+        int error = result ? append_stmt(&last, create_assign(result, create_ast_number(0))) : 0;
+
+        /* Arguments are evaluated in the list order as compile_call() does */
+        ast_node *param = callee->define->left->right;
+        for (ast_node *arg = call->right; arg && !error; arg = arg->left, param = param->left) {
+                const char *name = local_name(ctx, callee->name, ast_ident(param->right));
+                error = name ? append_stmt(&last, create_assign(name, arg->right)) : -1;
+        }
+
+        free_array(&renamed, sizeof(const char *));
+
+        ast_node *value = returns ? nullptr : create_ast_ident(result);
+        if (error || (!returns && !value))
+                return nullptr;
+
+        ast_node *first = body;
+        while (first->left)
+                first = first->left;
+
+        first->left = last;
+
+        trace_point(TRACE_FRONTEND, call);
+        ctx->n_inlined++;
+
+        /* Result of the call statement is dropped */
+        if (returns || callp == &node->right)
+                return body;
+
+        *callp = value;
+        node->left = body;
+        return node;
+}
+
+static void inline_block(inline_ctx *ctx, ast_node **block, const array *caller_locals)
+{
+        ast_node **link = block;
+        while (*link) {
+                ast_node *node = *link;
+                ast_node *stmt = node->right;
+
+                if (is_keyword(stmt, AST_IF)) {
+                        inline_block(ctx, &stmt->right->left, caller_locals);
+                        if (stmt->right->right)
+                                inline_block(ctx, &stmt->right->right, caller_locals);
+                } else if (is_keyword(stmt, AST_WHILE)) {
+                        inline_block(ctx, &stmt->right, caller_locals);
+                } else if (stmt) {
+                        /* Spliced statements are not inlined again: nested
+                           calls of the same callee share its locals */
+                        ast_node *prev = node->left;
+                        ast_node *last = inline_stmt(ctx, node, caller_locals);
+                        if (last) {
+                                *link = last;
+                                while (*link != prev)
+                                        link = &(*link)->left;
+                                continue;
+                        }
+                }
+
+                link = &node->left;
+        }
+}
+
+static void inline_define(inline_ctx *ctx, ast_node *define)
+{
+        if (!define->right)
+                return;
+
+        array caller_locals = {0};
+        size_t n_params = 0;
+        if (!collect_params(define, &caller_locals, &n_params) &&
+            !collect_locals(ctx, define->right, &caller_locals)) {
+                sort_names(&caller_locals);
+
+                inline_exprs(ctx, define->right, &caller_locals);
+                inline_block(ctx, &define->right, &caller_locals);
+        }
+
+        free_array(&caller_locals, sizeof(const char *));
+}
+
+ast_node *inline_calls(ast_node *root, intern_table *idents, size_t budget, size_t *n_inlined)
+{
+        assert(root);
+        assert(idents);
+
+        inline_ctx ctx = {};
+        ctx.idents = idents;
+        ctx.budget = budget;
+
+        if (!collect_funcs(&ctx, root)) {
+                for (ast_node *stmt = root; stmt; stmt = stmt->left) {
+                        if (is_keyword(stmt->right, AST_DEFINE))
+                                inline_define(&ctx, stmt->right);
+                }
+        }
+
+        inline_func *funcs = (inline_func *)ctx.funcs.data;
+        for (size_t i = 0; i < ctx.funcs.size; i++) {
+                free_array(&funcs[i].locals, sizeof(const char *));
+                free_array(&funcs[i].frees,  sizeof(const char *));
+        }
+
+        free_array(&ctx.funcs,   sizeof(inline_func));
+        free_array(&ctx.globals, sizeof(const char *));
+        free_array(&ctx.late,    sizeof(const char *));
+
+        if (n_inlined)
+                *n_inlined = ctx.n_inlined;
+
+        return root;
+}
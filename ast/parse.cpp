@@ -6,6 +6,7 @@
 #include <ctype.h>
 #include <logs.h>
 #include <array.h>
+#include <intern.h>
 
 #include <ast/tree.h>
 #include <ast/keyword.h>
@@ -13,12 +14,12 @@
 static ast_node *syntax_error(char *str);
 static ast_node *core_error();
 
-static ast_node *read_ast_node(char **str, array *const idents);
+static ast_node *read_ast_node(char **str, intern_table *const idents);
 
 static ast_node *read_keyword(char *str, size_t length);
-static ast_node *read_data(char **str, array *const idents);
+static ast_node *read_data(char **str, intern_table *const idents);
 
-static ast_node *create_ident(const char *str, array *const idents, const size_t len);
+static ast_node *create_ident(const char *str, intern_table *const idents, const size_t len);
 
 static char *find_bracket(char *str);
 static char *rfind(char *str, char ch);
@@ -27,7 +28,7 @@ static inline void skip_spaces(char **str);
 static inline void move(char **str);
 static inline char cur(char **str);
 
-ast_node *read_ast_tree(char **str, array *const idents)
+ast_node *read_ast_tree(char **str, intern_table *const idents)
 {
         assert(str);
         assert(idents);
@@ -42,7 +43,7 @@ ast_node *read_ast_tree(char **str, array *const idents)
         return tree;
 }
 
-static ast_node *read_ast_node(char **str, array *const idents)
+static ast_node *read_ast_node(char **str, intern_table *const idents)
 {
         assert(str);
         assert(idents);
@@ -116,30 +117,14 @@ static ast_node *core_error()
         return nullptr;
 }
 
-static ast_node *create_ident(const char *str, array *const idents, const size_t len)
+static ast_node *create_ident(const char *str, intern_table *const idents, const size_t len)
 {
         assert(str);
         assert(idents);
 
-        char *ident = nullptr;
-        char **keys = (char **)idents->data;
-        for (size_t i = 0; i < idents->size; i++) {
-                if (strlen(keys[i]) == len && !strncmp(keys[i], str, len)) {
-                        ident = keys[i];
-                        break;
-                }
-        }
-
-        if (!ident) {
-                ident = (char *)calloc(len + 1, sizeof(char));
-                if (!ident)
-                        return core_error();
-
-                strncpy(ident, str, len);
-                ident[len] = '\0';
-
-                array_push(idents, &ident, sizeof(char *));
-        }
+        const char *ident = intern(idents, str, len);
+        if (!ident)
+                return core_error();
 
         ast_node *root = create_ast_ident(ident);
         if (!root)
@@ -148,7 +133,7 @@ static ast_node *create_ident(const char *str, array *const idents, const size_t
         return root;
 }
 
-static ast_node *read_data(char **str, array *const idents)
+static ast_node *read_data(char **str, intern_table *const idents)
 {
         assert(str);
         assert(idents);
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <assert.h>
+#include <logs.h>
+#include <trace.h>
+
+#include <ast/tree.h>
+#include <ast/keyword.h>
+
+/*
+ * Self tail calls.
+ *
+ * Both backends compile 'return f(...)' in f as the jump to the function
+ * body. 'return e + f(...)' and 'return e * f(...)' are tail calls too if
+ * 'e' has no side effects and reads nothing the call can change: 'e' is
+ * accumulated before the jump and every other return of f applies the
+ * accumulator. Both operations wrap, so they are associative and the
+ * result is the same.
+ */
+
+static bool is_keyword(const ast_node *node, int keyword)
+{
+        return node && node->type == AST_NODE_KEYWORD && ast_keyword(node) == keyword;
+}
+
+static bool is_param(const char *ident, const ast_node *params)
+{
+        for ( ; params; params = params->left) {
+                const ast_node *name = params->right;
+                if (name && name->type == AST_NODE_IDENT && ast_ident(name) == ident)
+                        return true;
+        }
+
+        return false;
+}
+
+/*
+ * The operand is evaluated before the call instead of after it,
+ * so it must not print, read or trap. The call may write globals,
+ * so the operand reads only the parameters: other names can't be
+ * told from globals without the whole program.
+ */
+static bool is_pure(const ast_node *node, const ast_node *params)
+{
+        if (!node)
+                return true;
+
+        if (node->type == AST_NODE_IDENT && !is_param(ast_ident(node), params))
+                return false;
+
+        if (is_keyword(node, AST_CALL) || is_keyword(node, AST_IN))
+                return false;
+
+        if (is_keyword(node, AST_DIV) && (!node->right || node->right->type != AST_NODE_NUMBER ||
+                                          !ast_number(node->right)))
+                return false;
+
+        return is_pure(node->left, params) && is_pure(node->right, params);
+}
+
+static bool is_self_call(const ast_node *node, const char *func, size_t n_params)
+{
+        if (!is_keyword(node, AST_CALL) || !node->left || node->left->type != AST_NODE_IDENT)
+                return false;
+
+        if (ast_ident(node->left) != func)
+                return false;
+
+        size_t n_args = 0;
+        for (const ast_node *arg = node->right; arg; arg = arg->left)
+                n_args++;
+
+        return n_args == n_params;
+}
+
+bool match_tail_call(const ast_node *ret, const char *func, const ast_node *params,
+                     ast_tail_call *tail)
+{
+        assert(tail);
+
+        if (!is_keyword(ret, AST_RETURN) || !ret->right || !func)
+                return false;
+
+        size_t n_params = 0;
+        for (const ast_node *param = params; param; param = param->left)
+                n_params++;
+
+        ast_node *expr = ret->right;
+        if (is_self_call(expr, func, n_params)) {
+                tail->call    = expr;
+                tail->operand = nullptr;
+                tail->op      = AST_NULL;
+                return true;
+        }
+
+        if (!is_keyword(expr, AST_ADD) && !is_keyword(expr, AST_MUL))
+                return false;
+
+        if (is_self_call(expr->left, func, n_params) && is_pure(expr->right, params)) {
+                tail->call    = expr->left;
+                tail->operand = expr->right;
+        } else if (is_self_call(expr->right, func, n_params) && is_pure(expr->left, params)) {
+                tail->call    = expr->right;
+                tail->operand = expr->left;
+        } else {
+                return false;
+        }
+
+        tail->op = ast_keyword(expr);
+        return true;
+}
+
+static int find_accumulator(ast_node *node, const char *func, const ast_node *params, int op)
+{
+        if (!node || op < 0)
+                return op;
+
+        ast_tail_call tail = {};
+        if (match_tail_call(node, func, params, &tail) && tail.operand) {
+                /* Returns can't apply two accumulators */
+                if (op != AST_NULL && op != tail.op)
+                        return -1;
+
+                return tail.op;
+        }
+
+        op = find_accumulator(node->left, func, params, op);
+        return find_accumulator(node->right, func, params, op);
+}
+
+int tail_accumulator(const ast_node *define)
+{
+        assert(is_keyword(define, AST_DEFINE));
+
+        const ast_node *func = define->left;
+        if (!is_keyword(func, AST_FUNC) || !func->left || func->left->type != AST_NODE_IDENT)
+                return AST_NULL;
+
+        trace_point(TRACE_FRONTEND, define);
+        int op = find_accumulator(define->right, ast_ident(func->left), func->right, AST_NULL);
+        return op < 0 ? AST_NULL : op;
+}
@@ -3,30 +3,98 @@
 #include <stdlib.h>
 #include <logs.h>
 #include <errno.h>
-#include <stack.h>
+#include <stats.h>
 
 #include <ast/tree.h>
 #include <ast/keyword.h>
 
+static const size_t INIT_CHUNK_NODES = 0x100;
+static const size_t MAX_CHUNK_NODES  = 0x10000;
 
-static stack ALLOC = {0};
+struct ast_chunk {
+        ast_chunk *next = nullptr;
+        size_t size     = 0;
+        size_t used     = 0;
+};
 
-__attribute__((constructor))
-static void init_memstack()
-{ 
-        construct_stack(&ALLOC);
+/*
+ * Arena the current thread allocates nodes from.
+ */
+static thread_local ast_arena *ARENA = nullptr;
+
+ast_arena *bind_ast_arena(ast_arena *arena)
+{
+        ast_arena *prev = ARENA;
+        ARENA = arena;
+        return prev;
+}
+
+void free_ast_arena(ast_arena *arena)
+{
+        assert(arena);
+
+        ast_chunk *chunk = arena->chunks;
+        while (chunk) {
+                ast_chunk *next = chunk->next;
+                free(chunk);
+                chunk = next;
+        }
+
+        arena->chunks  = nullptr;
+        arena->n_nodes = 0;
+}
+
+void merge_ast_arena(ast_arena *dst, ast_arena *src)
+{
+        assert(dst);
+        assert(src);
+
+        if (!src->chunks)
+                return;
+
+        /* Nodes are still allocated from the first chunk of 'dst' */
+        ast_chunk *last = src->chunks;
+        while (last->next)
+                last = last->next;
+
+        if (dst->chunks) {
+                last->next = dst->chunks->next;
+                dst->chunks->next = src->chunks;
+        } else {
+                dst->chunks = src->chunks;
+        }
+
+        dst->n_nodes += src->n_nodes;
+
+        src->chunks  = nullptr;
+        src->n_nodes = 0;
 }
 
-__attribute__((destructor))
-static void free_memstack()
+static ast_node *arena_alloc(ast_arena *arena)
 {
-        $(dump_stack(&ALLOC);)
-        while (ALLOC.size) {
-                void *item = pop_stack(&ALLOC);
-                free(item);
+        assert(arena);
+
+        ast_chunk *chunk = arena->chunks;
+        if (!chunk || chunk->used == chunk->size) {
+                /* Chunks grow twice up to MAX_CHUNK_NODES */
+                size_t size = chunk ? 2 * chunk->size : INIT_CHUNK_NODES;
+                if (size > MAX_CHUNK_NODES)
+                        size = MAX_CHUNK_NODES;
+
+                chunk = (ast_chunk *)malloc(sizeof(ast_chunk) + size * sizeof(ast_node));
+                if (!chunk)
+                        return nullptr;
+
+                stats_alloc(sizeof(ast_chunk) + size * sizeof(ast_node));
+
+                chunk->size = size;
+                chunk->used = 0;
+                chunk->next = arena->chunks;
+                arena->chunks = chunk;
         }
 
-        destruct_stack(&ALLOC);
+        arena->n_nodes++;
+        return (ast_node *)(chunk + 1) + chunk->used++;
 }
 
 void save_ast_tree(FILE *file, ast_node *const node)
@@ -130,6 +198,36 @@ int ast_keyword( const ast_node *n)
         return 0;
 }
 
+size_t calc_tree_size(ast_node *n)
+{
+        if (!n)
+                return 0;
+
+        return 1 + calc_tree_size(n->left) + calc_tree_size(n->right);
+}
+
+ast_node *compare_trees(ast_node *t1, ast_node *t2)
+{
+        if (!t1 || !t2)
+                return t1 ? t1 : t2;
+
+        if (t1->type != t2->type)
+                return t1;
+
+        if (t1->type == AST_NODE_IDENT) {
+                if (strcmp(t1->data.ident, t2->data.ident))
+                        return t1;
+        } else if (t1->data.number != t2->data.number) {
+                return t1;
+        }
+
+        ast_node *diff = compare_trees(t1->left, t2->left);
+        if (diff)
+                return diff;
+
+        return compare_trees(t1->right, t2->right);
+}
+
 ast_node *copy_tree(ast_node *n)
 {
         assert(n);
@@ -143,36 +241,19 @@ ast_node *copy_tree(ast_node *n)
 
         if (n->left) {
                 newbie->left  = copy_tree(n->left);
-                if (!newbie->left) {
-                        free_tree(newbie);
+                if (!newbie->left)
                         return nullptr;
-                }
         }
 
         if (n->right) {
                 newbie->right = copy_tree(n->right);
-                if (!newbie->right) {
-                        free_tree(newbie);
+                if (!newbie->right)
                         return nullptr;
-                }
         }
 
         return newbie;
 }
 
-void free_tree(ast_node *root)
-{
-        assert(root);
-
-        if (root->left)
-                free_tree(root->left);
-        if (root->right)
-                free_tree(root->right);
-
-
-        free(root);
-}
-
 ast_node *create_ast_keyword(int keyword) 
 {
         ast_node *newbie = create_ast_node(AST_NODE_KEYWORD);
@@ -209,7 +290,9 @@ ast_node *create_ast_node(int type)
                type == AST_NODE_NUMBER  ||
                type == AST_NODE_KEYWORD );
 
-$       (ast_node *newbie = (ast_node *)calloc(1, sizeof(ast_node));)
+        assert(ARENA && "Bind nodes arena first");
+
+$       (ast_node *newbie = arena_alloc(ARENA);)
         if (!newbie) {
                 fprintf(logs, "Can't create ast_node\n");
                 return nullptr;
@@ -221,8 +304,6 @@ $       (ast_node *newbie = (ast_node *)calloc(1, sizeof(ast_node));)
         newbie->right      = nullptr;
         newbie->data.ident = nullptr;
 
-        push_stack(&ALLOC, newbie);
-
         return newbie;
 }
 
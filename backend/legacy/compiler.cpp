@@ -5,15 +5,17 @@
 #include <string.h>
 #include <array.h>
 #include <iommap.h>
-#include <stack.h>
 #include <assert.h>
 #include <logs.h>
+#include <stats.h>
+#include <trace.h>
 
 #include <ast/tree.h>
 #include <ast/keyword.h>
 
 #include <backend/legacy/backend.h>
 #include <backend/legacy/elf64.h>
+#include <backend/legacy/symtab.h>
 
 static int       keyword(ast_node *node);
 static double    *number(ast_node *node);
@@ -42,91 +44,335 @@ static ast_node *dump_code (ast_node *root);
                 return syntax_error(root);                      \
         } while (0)
 
-static ac_symbol *find_symbol(stack *symtabs, const char *ident);
+static ast_node *compile_stdcall(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm, const int sym_index);
+static ast_node *compile_define (ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm);
+static ast_node *compile_return (ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm);
+static ast_node *compile_assign (ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm);
+static ast_node *compile_expr   (ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm);
+static ast_node *compile_while  (ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm);
+static ast_node *compile_call   (ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm);
+static ast_node *compile_stmt   (ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm);
+static ast_node *compile_if     (ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm);
 
-static ast_node *compile_stdcall(ast_node *root, stack *symtabs, ac_virtual_memory *vm, const int sym_index);
-static ast_node *compile_define (ast_node *root, stack *symtabs, ac_virtual_memory *vm);
-static ast_node *compile_return (ast_node *root, stack *symtabs, ac_virtual_memory *vm);
-static ast_node *compile_assign (ast_node *root, stack *symtabs, ac_virtual_memory *vm);
-static ast_node *compile_expr   (ast_node *root, stack *symtabs, ac_virtual_memory *vm);
-static ast_node *compile_while  (ast_node *root, stack *symtabs, ac_virtual_memory *vm);
-static ast_node *compile_call   (ast_node *root, stack *symtabs, ac_virtual_memory *vm);
-static ast_node *compile_stmt   (ast_node *root, stack *symtabs, ac_virtual_memory *vm);
-static ast_node *compile_if     (ast_node *root, stack *symtabs, ac_virtual_memory *vm);
+static void compile_start(ac_symtab *symtabs, ac_virtual_memory *vm);
 
-static void compile_start(stack *symtabs, ac_virtual_memory *vm);
+static ptrdiff_t compile_prologue(ac_virtual_memory *vm);
+static void      compile_epilogue(ac_virtual_memory *vm);
+static void      compile_frame_size(ac_virtual_memory *vm, ptrdiff_t sub_addr);
 
-static ast_node *compile_load_num(ast_node *root, stack *symtabs, ac_virtual_memory *vm);
+static ast_node *compile_load_num(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm);
 
-static ast_node *compile_stack_store(ast_node *root, stack *symtabs, ac_virtual_memory *vm, ac_symbol *sym);
-static ast_node *compile_stack_load (ast_node *root, stack *symtabs, ac_virtual_memory *vm, ac_symbol *sym);
+static ast_node *compile_stack_store(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm, ac_symbol *sym);
+static ast_node *compile_stack_load (ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm, ac_symbol *sym);
 
-static ast_node *compile_data_store(ast_node *root, stack *symtabs, ac_virtual_memory *vm, ac_symbol *sym);
-static ast_node *compile_data_load (ast_node *root, stack *symtabs, ac_virtual_memory *vm, ac_symbol *sym);
+static ast_node *compile_data_store(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm, ac_symbol *sym);
+static ast_node *compile_data_load (ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm, ac_symbol *sym);
 
-static void dump_symtab(stack *symtabs); 
+static ast_node *declare_functions(ast_node *root, ac_symtab *symtabs);
+static ast_node *resolve_fixups(ac_symtab *symtabs, ac_virtual_memory *vm);
 
-static ast_node *declare_functions(ast_node *root, stack *symtabs);
+static void emit(ac_virtual_memory *vm, void *instruction, size_t size);
+static void emit_pinned(ac_virtual_memory *vm, void *instruction, size_t size);
 
-static char *emit(ac_virtual_memory *vm, void *instruction, size_t size);
+/*
+ * Registers allocation order. Assert functions clobber all of r8-r15,
+ * but r12-r15 survive the standard library calls.
+ */
+static const ubyte REGISTERS[AC_N_REGS] = { 4, 5, 6, 7, 0, 1, 2, 3 };
 
-static inline ubyte register_top(ac_virtual_memory *vm)
+/* r8-r11 are caller-saved in the standard library */
+static const unsigned STDCALL_CLOBBERED = 0x0f;
+
+static const ubyte ARG_REGISTERS[AC_N_ARG_REGS] = {
+        IE64_RDI, IE64_RSI, IE64_RDX, IE64_RCX, IE64_R8, IE64_R9
+};
+
+/*
+ * Number of the first arguments which are passed in registers.
+ */
+static inline size_t arg_registers(const ac_symbol *func)
+{
+        assert(func && func->type == AC_SYM_FUNC);
+
+        if (!func->leaf)
+                return 0;
+
+        return func->info < AC_N_ARG_REGS ? (size_t)func->info : AC_N_ARG_REGS;
+}
+
+static inline size_t register_depth(ac_virtual_memory *vm)
+{
+        assert(vm);
+        return vm->reg.stack.size;
+}
+
+static inline ac_operand *register_operand(ac_virtual_memory *vm, size_t depth)
+{
+        assert(vm);
+        assert(depth < vm->reg.stack.size);
+        return (ac_operand *)vm->reg.stack.data + depth;
+}
+
+/*
+ * Spill and reload code must not release popped registers,
+ * that's why they don't use emit() directly.
+ */
+static void emit_frame_move(ac_virtual_memory *vm, ubyte opcode, ubyte reg, imm32 slot)
+{
+        assert(vm);
+
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x4c; /* 1001100b */
+                ubyte opcode       = 0x89;
+                ie64_modrm modrm   = { .rm = IE64_RBP, .reg = 0b000, .mod = 0b10 };
+                imm32 imm          = 0;   
+        } __mov64;
+
+        __mov64.opcode    = opcode;
+        __mov64.modrm.reg = reg & 0b111;
+        __mov64.imm       = slot;
+
+        unsigned hold = vm->reg.hold;
+        vm->reg.hold = 0;
+        emit(vm, &__mov64, sizeof(__mov64));
+        vm->reg.hold = hold;
+}
+
+static void register_spill(ac_virtual_memory *vm, ac_operand *op)
+{
+        assert(vm);
+        assert(op && op->reg >= 0);
+
+        array *slots = &vm->reg.slots;
+        if (slots->size) {
+                op->slot = *(imm32 *)array_top(slots, sizeof(imm32));
+                array_pop(slots, sizeof(imm32));
+        } else {
+                /* New slot in the current stack frame */
+                elf64_section *frame = vm->secs + SEC_NULL;
+                frame->size += 8;
+                op->slot = -(imm32)frame->size;
+        }
+
+        /* mov [rbp + slot], r */
+        emit_frame_move(vm, 0x89, (ubyte)op->reg, op->slot);
+
+        vm->reg.busy &= ~(1u << op->reg);
+        op->reg = -1;
+}
+
+static ubyte register_alloc(ac_virtual_memory *vm)
+{
+        assert(vm);
+
+        unsigned used = vm->reg.busy | vm->reg.hold;
+        for (int i = 0; i < AC_N_REGS; i++) {
+                if (!(used & (1u << REGISTERS[i]))) {
+                        vm->reg.busy |= 1u << REGISTERS[i];
+                        return REGISTERS[i];
+                }
+        }
+
+        /* Spill the deepest operand. It is needed last. */
+        for (size_t i = 0; i < register_depth(vm); i++) {
+                ac_operand *op = register_operand(vm, i);
+                if (op->reg >= 0 && !(vm->reg.hold & (1u << op->reg))) {
+                        ubyte reg = (ubyte)op->reg;
+                        register_spill(vm, op);
+
+                        vm->reg.busy |= 1u << reg;
+                        return reg;
+                }
+        }
+
+        assert(0 && "Operands stack has no registers to spill");
+        return 0;
+}
+
+static void register_load(ac_virtual_memory *vm, ac_operand *op)
+{
+        assert(vm);
+        assert(op);
+
+        if (op->reg >= 0)
+                return;
+
+        ubyte reg = register_alloc(vm);
+
+        /* mov r, [rbp + slot] */
+        emit_frame_move(vm, 0x8b, reg, op->slot);
+        array_push(&vm->reg.slots, &op->slot, sizeof(imm32));
+
+        op->reg = reg;
+}
+
+/*
+ * Spills the deepest 'depth' operands which live in 'clobbered' registers.
+ * They are loaded back only when they are used.
+ */
+static void register_save(ac_virtual_memory *vm, unsigned clobbered, size_t depth)
+{
+        assert(vm && depth <= register_depth(vm));
+
+        for (size_t i = 0; i < depth; i++) {
+                ac_operand *op = register_operand(vm, i);
+                if (op->reg >= 0 && (clobbered & (1u << op->reg)))
+                        register_spill(vm, op);
+        }
+}
+
+static ubyte register_push(ac_virtual_memory *vm)
 {
-        assert(vm || vm->reg.stack >= 0);
-        return (ubyte)vm->reg.stack;        
+        assert(vm);
+
+        ac_operand op = {};
+        op.reg = register_alloc(vm);
+        array_push(&vm->reg.stack, &op, sizeof(ac_operand));
+
+        return (ubyte)op.reg;
 }
 
-static inline ubyte register_push(ac_virtual_memory *vm)
+static ubyte register_top(ac_virtual_memory *vm)
 {
-        assert(vm || vm->reg.stack >= 0);
-        return (ubyte)++vm->reg.stack;                
+        assert(vm && register_depth(vm));
+
+        ac_operand *op = register_operand(vm, register_depth(vm) - 1);
+        register_load(vm, op);
+
+        return (ubyte)op->reg;
 }
 
-static inline ubyte register_pop(ac_virtual_memory *vm)
+/*
+ * Popped register is held until the next emitted instruction,
+ * so it is safe to ask for other operands before emit().
+ */
+static ubyte register_pop(ac_virtual_memory *vm)
 {
-        assert(vm || vm->reg.stack >= 0);
-        return (ubyte)vm->reg.stack--;                        
+        assert(vm && register_depth(vm));
+
+        ubyte reg = register_top(vm);
+        array_pop(&vm->reg.stack, sizeof(ac_operand));
+
+        vm->reg.busy &= ~(1u << reg);
+        vm->reg.hold |=   1u << reg;
+
+        return reg;
 }
 
+/* Operands live in r8-r15, instructions encode the low bits only */
 #define register_pop( __vm) (register_pop (__vm) & 0b111)
 #define register_top( __vm) (register_top (__vm) & 0b111)
 #define register_push(__vm) (register_push(__vm) & 0b111)
 
-ast_node *compile_tree(ast_node *tree, elf64_section *secs, elf64_symbol *syms)
+/*
+ * Swaps two top operands. No code is emitted.
+ */
+static void register_swap(ac_virtual_memory *vm)
+{
+        assert(vm && register_depth(vm) >= 2);
+
+        ac_operand *top = register_operand(vm, register_depth(vm) - 1);
+        ac_operand tmp = top[0];
+        top[0]  = top[-1];
+        top[-1] = tmp;
+}
+
+/*
+ * mov arg, r (0x89) or mov r, arg (0x8b). 'arg' is any of rax-r15.
+ */
+static void emit_arg_move(ac_virtual_memory *vm, ubyte opcode, ubyte reg, ubyte arg)
+{
+        assert(vm);
+
+        struct __attribute__((packed)) {
+                ubyte rex          = 0x4c; /* 1001100b */
+                ubyte opcode       = 0x89;
+                ie64_modrm modrm   = { .rm = 0b000, .reg = 0b000, .mod = 0b11 };
+        } __mov64;
+
+        __mov64.rex      |= (ubyte)(arg >> 3);
+        __mov64.opcode    = opcode;
+        __mov64.modrm.rm  = arg & 0x7;
+        __mov64.modrm.reg = reg & 0b111;
+
+        emit(vm, &__mov64, sizeof(__mov64));
+}
+
+/*
+ * Moves 'n_args' top operands to the argument registers, the top one is
+ * the first argument. Other operands in 'clobbered' registers are spilled.
+ * Returns the mask of r8-r15 registers taken by the arguments, they are
+ * busy until the call.
+ */
+static unsigned register_args(ac_virtual_memory *vm, size_t n_args, unsigned clobbered)
+{
+        assert(vm);
+        assert(n_args <= AC_N_ARG_REGS && n_args <= register_depth(vm));
+
+        size_t depth = register_depth(vm);
+        register_save(vm, clobbered, depth - n_args);
+
+        /* The sixth argument is moved last, r8 takes the fifth one before */
+        if (n_args == AC_N_ARG_REGS) {
+                ac_operand *op = register_operand(vm, depth - n_args);
+                if (op->reg == ARG_REGISTERS[4] - IE64_R8)
+                        register_spill(vm, op);
+        }
+
+        unsigned taken = 0;
+        for (size_t i = 0; i < n_args; i++) {
+                ubyte arg = ARG_REGISTERS[i];
+                emit_arg_move(vm, 0x89, register_pop(vm), arg);
+
+                if (arg >= IE64_R8) {
+                        taken        |= 1u << (arg - IE64_R8);
+                        vm->reg.busy |= 1u << (arg - IE64_R8);
+                }
+        }
+
+        return taken;
+}
+
+static void register_reset(ac_virtual_memory *vm)
+{
+        assert(vm);
+
+        free_array(&vm->fixups, sizeof(ac_fixup));
+        free_array(&vm->reg.stack, sizeof(ac_operand));
+        free_array(&vm->reg.slots, sizeof(imm32));
+        vm->reg.busy = 0;
+        vm->reg.hold = 0;
+}
+
+ast_node *compile_tree(ast_node *tree, elf64_section *secs, elf64_symbol *syms, bool peephole)
 {
         assert(tree);
         assert(secs);
         assert(syms);
         
         ast_node *error = nullptr;
-$$
+        trace_point(TRACE_LEGACY, tree);
         ac_virtual_memory vm = {};
         vm.secs = secs;
         vm.syms = syms;
-$$
+        vm.peep.enabled = peephole;
 
-        stack symtab = {};
-        construct_stack(&symtab);
-$$
+        ac_symtab symtab = {};
 
-        /* Init global scope table to declare functions */
-        array func_scope = {};
-        push_stack(&symtab, &func_scope);
-$$
+        /* Functions' scope goes first, so functions can be called before definition */
+        symtab_push_scope(&symtab);
         declare_functions(tree, &symtab);
 
-        ac_symbol *functions = (ac_symbol *)func_scope.data;
-        for (size_t i = 0; i < func_scope.size; i++) {
-                if (!strncmp(functions[i].ident, "main", sizeof("main"))) {
-                        vm.main = functions + i;
+        for (size_t i = 0; i < symtab_size(&symtab); i++) {
+                const char *ident = symtab_symbol(&symtab, i)->ident;
+                if (!strncmp(ident, "main", sizeof("main"))) {
+                        vm.main = ident;
                         break;
                 }
         }
 
-        dump_symtab(&symtab);
-$$
-        array globals_scope = {};
-        push_stack(&symtab, &globals_scope);
+        trace_dump(dump_symtab(&symtab));
+        symtab_push_scope(&symtab);
 
         if (!vm.main) {
                 fprintf(stderr, ascii(RED, "Can't find main function. Abort.\n"));
@@ -138,38 +384,78 @@ $$
                 fprintf(stderr, ascii(RED, "Compilation error.\n"));
                 goto cleanup;
         }
-$$
-$       (dump_symtab(&symtab);)
-
-        section_free(vm.secs + SEC_TEXT);
-        section_free(vm.secs + SEC_BSS);
-        section_free(vm.secs + SEC_RELA_TEXT);
-$$
-        free_array(&globals_scope, sizeof(ac_symbol));
-$$
-        if (vm.reg.stack) {
+        trace_dump(dump_symtab(&symtab));
+
+        if (register_depth(&vm)) {
                 fprintf(stderr, ascii(RED, "Unbalanced register stack (vm.reg.stack)\n"));
+                error = tree;
                 goto cleanup;
         }
 
-        compile_stmt(tree, &symtab, &vm);      
-$$
+        /* All the functions are placed, forward calls can be resolved */
+        error = resolve_fixups(&symtab, &vm);
+        if (error)
+                goto cleanup;
+
         compile_start(&symtab, &vm);
         syms[SYM_START].value = vm._start;
-$$
+        peephole_flush(&vm.peep, secs + SEC_TEXT);
 
 cleanup:
-        free_array   (&func_scope, sizeof(ac_symbol));
-        free_array(&globals_scope, sizeof(ac_symbol));
-        destruct_stack(&symtab);
-$$
+        free_symtab(&symtab);
+        register_reset(&vm);
         return error;
 }
 
-static inline int is_global_scope(stack *symtabs) 
+int compile_elf64(ast_node *tree, const char *file_name, bool peephole)
 {
-        /* Functions' and globals' symtables are in stack */
-        return symtabs->size <= 2;
+        assert(tree);
+        assert(file_name);
+
+        elf64_section *secs = (elf64_section *)calloc(SEC_NUM, sizeof(elf64_section));
+        elf64_symbol  *syms = (elf64_symbol  *)calloc(SYM_NUM, sizeof(elf64_symbol));
+
+        ast_node *err = nullptr;
+        size_t phase = 0;
+        size_t size  = 0;
+        int error = -1;
+        if (!secs || !syms)
+                goto cleanup;
+
+        fill_sections_names(secs);
+        fill_symbols_info(secs, syms, file_name);
+
+        phase = stats_begin("compile_tree");
+        err = compile_tree(tree, secs, syms, peephole);
+        stats_end(phase, secs[SEC_TEXT].size, "text bytes");
+        if (err)
+                goto cleanup;
+
+        for (size_t i = 0; i < SEC_NUM; i++)
+                size += secs[i].size;
+
+        /* create_elf64() reports errno */
+        errno = 0;
+        phase = stats_begin("create_elf64");
+        error = create_elf64(secs, syms, file_name);
+        stats_end(phase, size, "section bytes");
+
+cleanup:
+        if (secs) {
+                for (size_t i = 0; i < SEC_NUM; i++)
+                        if (secs[i].data)
+                                section_free(secs + i);
+        }
+
+        free(syms);
+        free(secs);
+        return error;
+}
+
+static inline int is_global_scope(ac_symtab *symtabs) 
+{
+        /* Functions' and globals' scopes */
+        return symtab_depth(symtabs) <= 2;
 }
 
 static inline void patch(ac_virtual_memory *vm, ptrdiff_t addr, void *instruction, size_t size)
@@ -179,31 +465,102 @@ static inline void patch(ac_virtual_memory *vm, ptrdiff_t addr, void *instructio
         memcpy(vm->secs[SEC_TEXT].data + addr, instruction, size);
 }
 
+/*
+ * Patches rel32 of the forward calls. Every declared function is
+ * compiled by now, so the offset is unknown only for the broken tree.
+ */
+static ast_node *resolve_fixups(ac_symtab *symtabs, ac_virtual_memory *vm)
+{
+        assert(symtabs);
+        assert(vm);
+
+        ac_fixup *fixups = (ac_fixup *)vm->fixups.data;
+        for (size_t i = 0; i < vm->fixups.size; i++) {
+                const ac_symbol *sym = symtab_find(symtabs, fixups[i].ident);
+                assert(sym && sym->type == AC_SYM_FUNC);
+                if (sym->offset < 0)
+                        return syntax_error(sym->node);
+
+                imm32 rel = (imm32)(sym->offset - fixups[i].addr - (imm32)sizeof(imm32));
+                patch(vm, fixups[i].addr, &rel, sizeof(rel));
+        }
+
+        return success(nullptr);
+}
+
 /* Returns the current rip register value.
    i.e. returns the offset of the start of 
-   the next command on the given. */
+   the next command on the given. 
+   Peephole can't move the code before it. */
 static inline ptrdiff_t rip(ac_virtual_memory *vm) 
 {
         assert(vm); 
+        peephole_flush(&vm->peep, vm->secs + SEC_TEXT);
         return (ptrdiff_t)vm->secs[SEC_TEXT].size; 
 }
 
 static void emit_syscall(ac_virtual_memory *vm, const ubyte rax);
 
-static inline char *emit(ac_virtual_memory *vm, void *instruction, size_t size)
+static inline void emit(ac_virtual_memory *vm, void *instruction, size_t size)
+{
+        assert(vm);
+        assert(instruction);
+
+        /* Popped registers are consumed by this instruction */
+        unsigned dead = vm->reg.hold & ~vm->reg.busy;
+        vm->reg.hold = 0;
+        peephole_emit(&vm->peep, vm->secs + SEC_TEXT, instruction, size, dead);
+}
+
+/*
+ * The instruction is patched or relocated later, so it's emitted as is.
+ */
+static inline void emit_pinned(ac_virtual_memory *vm, void *instruction, size_t size)
 {
         assert(vm);
         assert(instruction);
-        return section_memcpy(vm->secs + SEC_TEXT, instruction, size);
+
+        vm->reg.hold = 0;
+        peephole_emit(&vm->peep, vm->secs + SEC_TEXT, instruction, size, 0, true);
 }
 
-static void compile_start(stack *symtabs, ac_virtual_memory *vm) 
+/*
+ * Emits jcc rel32 to be patched by patch_branch(). Returns its address.
+ * je and jne after the comparison are fused with it.
+ */
+static ptrdiff_t emit_branch(ac_virtual_memory *vm, ubyte opcode)
+{
+        assert(vm);
+
+        struct __attribute__((packed)) {
+                const ubyte prefix = 0x0f;
+                ubyte opcode       = 0x84;
+                imm32 imm          = 0;
+        } __jcc;
+
+        __jcc.opcode = peephole_branch(&vm->peep, opcode);
+
+        ptrdiff_t __jcc_addr = rip(vm);
+        emit_pinned(vm, &__jcc, sizeof(__jcc));
+        return __jcc_addr;
+}
+
+static void patch_branch(ac_virtual_memory *vm, ptrdiff_t addr, ptrdiff_t target)
+{
+        assert(vm);
+
+        /* jcc rel32 is 6 bytes long */
+        imm32 rel = (imm32)(target - addr - 6);
+        patch(vm, addr + 2, &rel, sizeof(rel));
+}
+
+static void compile_start(ac_symtab *symtabs, ac_virtual_memory *vm) 
 {
         assert(symtabs);
         assert(vm);
 
-        array *global_symtab = (array *)top_stack(symtabs);
-        ac_symbol *globals = (ac_symbol *)global_symtab->data;
+        size_t n_symbols = symtab_size(symtabs);
+        size_t globals   = symtab_scope_begin(symtabs, symtab_depth(symtabs) - 1);
 
         /* Compile _start code at the 
            end of the .text section. */
@@ -216,14 +573,14 @@ static void compile_start(stack *symtabs, ac_virtual_memory *vm)
         } __call;
         
         /* Compile startup initialization of global variables. */
-        for (size_t i = 0; i < global_symtab->size; i++) {
-                __call.imm = (imm32)(globals[i].offset - rip(vm) - (imm32)sizeof(__call));
-                emit(vm, &__call, sizeof(__call));                
+        for (size_t i = globals; i < n_symbols; i++) {
+                __call.imm = (imm32)(symtab_symbol(symtabs, i)->offset - rip(vm) - (imm32)sizeof(__call));
+                emit_pinned(vm, &__call, sizeof(__call));
         }
 
         /* Call the main() function. */
-        __call.imm = (imm32)(vm->main->offset - rip(vm) - (imm32)sizeof(__call));
-        emit(vm, &__call, sizeof(__call));
+        __call.imm = (imm32)(symtab_find(symtabs, vm->main)->offset - rip(vm) - (imm32)sizeof(__call));
+        emit_pinned(vm, &__call, sizeof(__call));
 
         /* Move rax to rdi */        
         struct __attribute__((packed)) {
@@ -258,46 +615,30 @@ static void emit_syscall(ac_virtual_memory *vm, const ubyte rax)
         emit(vm, &__syscall, sizeof(__syscall));
 }
 
-static ast_node *compile_store(ast_node *root, stack *symtabs, ac_virtual_memory *vm, ac_symbol *sym)
+static ast_node *compile_store(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm, ac_symbol *sym)
 {
         assert(vm);
         assert(sym);
         assert(root);
         assert(symtabs); 
-        ast_node *error = nullptr;
 
         if (sym->vis == AC_VIS_LOCAL) {
                 return compile_stack_store(root, symtabs, vm, sym);      
         } else if (sym->vis == AC_VIS_GLOBAL) {
-                
-                error = compile_data_store(root, symtabs, vm, sym);
-                if (error)
-                        return error;
-
-                /* Compile ret for the startup initialization */
-                if (is_global_scope(symtabs)) {
-                        struct __attribute__((packed)) {
-                                ubyte opcode = 0xc3; /* ret */    
-                        } __ret;                
-
-                        emit(vm, &__ret, sizeof(__ret));
-                }
-
-                return success(root);
+                return compile_data_store(root, symtabs, vm, sym);
         }        
 
         return syntax_error(root);
 }
 
-static ast_node *compile_assign(ast_node *root, stack *symtabs, ac_virtual_memory *vm)
+static ast_node *compile_assign(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm)
 {
         assert(vm);
         assert(root);
         assert(symtabs); 
         ast_node *error = nullptr;
-$$
+        trace_point(TRACE_LEGACY, root);
         require(root, AST_ASSIGN);        
-$$
         require_ident(root->left);
         ac_symbol sym = {
                 .type   = AC_SYM_VAR,
@@ -309,11 +650,16 @@ $$
                 .info   = 8,               
         };
 
+        /* Global initialization is called from _start. 
+           It needs its own stack frame for the spilled operands. */
+        ptrdiff_t __sub_addr = 0;
+        if (is_global_scope(symtabs))
+                __sub_addr = compile_prologue(vm);
+
         error = compile_expr(root->right, symtabs, vm);
         if (error)
                 return error;
-$$
-        ac_symbol *exist = find_symbol(symtabs, ast_ident(root->left));
+        ac_symbol *exist = symtab_find(symtabs, ast_ident(root->left));
         if (exist) {
                 /* Can't reassign variables at global scope */
                 if (is_global_scope(symtabs))
@@ -321,13 +667,11 @@ $$
 
                 return compile_store(root->left, symtabs, vm, exist);
         }
-$$
         ast_node *size = root->left->right;
         if (size) {
                 require_number(size);
                 sym.info = 8 * (ast_number(size) + 1);
         }
-$$
         elf64_section *sec = nullptr;
         if (is_global_scope(symtabs)) {
                 sym.vis    = AC_VIS_GLOBAL;
@@ -340,11 +684,20 @@ $$
         }
 
         sec->size += (size_t)sym.info;
-$$
-        array_push((array *)top_stack(symtabs), &sym, sizeof(ac_symbol));
-$       (dump_symtab(symtabs);)
-$$
-        return compile_store(root->left, symtabs, vm, &sym);
+        if (!symtab_insert(symtabs, &sym))
+                return syntax_error(root);
+
+        trace_dump(dump_symtab(symtabs));
+        error = compile_store(root->left, symtabs, vm, &sym);
+        if (error)
+                return error;
+
+        if (sym.vis == AC_VIS_GLOBAL) {
+                compile_epilogue(vm);
+                compile_frame_size(vm, __sub_addr);
+        }
+
+        return success(root);
 }
 
 static ast_node *compile_expr_add(ast_node *root, ac_virtual_memory *vm)
@@ -355,7 +708,7 @@ static ast_node *compile_expr_add(ast_node *root, ac_virtual_memory *vm)
                 const ubyte opcode = 0x01; /* add */
                 ie64_modrm modrm   = { .rm = 0b000, .reg = 0b000, .mod = 0b11 };
         } __add;
-$$
+        trace_point(TRACE_LEGACY, root);
         __add.modrm.reg = register_pop(vm);//register_pop(vm);
         __add.modrm.rm  = register_top(vm);//register_top(vm);
 
@@ -374,7 +727,7 @@ static ast_node *compile_expr_sub(ast_node *root, ac_virtual_memory *vm)
                  /* Register/register mode */
                 ie64_modrm modrm   = { .rm = 0b000, .reg = 0b000, .mod = 0b11 };
         } __sub;
-$$
+        trace_point(TRACE_LEGACY, root);
         __sub.modrm.reg = register_pop(vm);
         __sub.modrm.rm  = register_top(vm);
 
@@ -391,7 +744,7 @@ static ast_node *compile_expr_mul(ast_node *root, ac_virtual_memory *vm)
                 const ubyte opcode = 0xaf;
                 ie64_modrm modrm   = { .rm = 0b000, .reg = 0b000, .mod = 0b11 };
         } __imul;
-$$
+        trace_point(TRACE_LEGACY, root);
         __imul.modrm.rm  = register_pop(vm);
         __imul.modrm.reg = register_top(vm);
 
@@ -408,7 +761,10 @@ static ast_node *compile_expr_div(ast_node *root, ac_virtual_memory *vm)
                 ie64_modrm modrm   = { .rm = IE64_RAX, .reg = 0b000, .mod = 0b11 };
         } __mov32;
 
-        __mov32.modrm.reg = (register_top(vm) - 1) & 0b111;
+        ubyte divisor  = register_pop(vm);
+        ubyte dividend = register_top(vm);
+
+        __mov32.modrm.reg = dividend & 0b111;
         emit(vm, &__mov32, sizeof(__mov32));
 
         /* Sign extend rax to rdx:rax */
@@ -424,7 +780,7 @@ static ast_node *compile_expr_div(ast_node *root, ac_virtual_memory *vm)
                 ie64_modrm modrm   = { .rm = 0b000, .reg = 0b111, .mod = 0b11 };
         } __idiv;
 
-        __idiv.modrm.rm = register_pop(vm);
+        __idiv.modrm.rm = divisor & 0b111;
         emit(vm, &__idiv, sizeof(__idiv));
                       
         struct __attribute__((packed)) {
@@ -433,7 +789,7 @@ static ast_node *compile_expr_div(ast_node *root, ac_virtual_memory *vm)
                 ie64_modrm modrm   = { .rm = 0b000, .reg = IE64_RAX, .mod = 0b11 };
         } __mov64;
 
-        __mov64.modrm.rm = register_top(vm);
+        __mov64.modrm.rm = dividend & 0b111;
         emit(vm, &__mov64, sizeof(__mov64));
 
         return success(root);        
@@ -490,6 +846,7 @@ static ast_node *compile_expr_cmp(ast_node *root, ac_virtual_memory *vm)
                 const ubyte opcode = 0x39;
                 ie64_modrm modrm   = { .rm = 0b000, .reg = 0b000, .mod = 0b11 };
         } __cmp;
+        trace_point(TRACE_LEGACY, root);
 
         __cmp.modrm.reg = register_pop(vm);
         __cmp.modrm.rm  = register_top(vm);
@@ -543,15 +900,341 @@ static ast_node *compile_expr_cmp(ast_node *root, ac_virtual_memory *vm)
                 __cmov.opcode = 0x4e;
                 break;
         default:
-$$              return syntax_error(root);
+                return syntax_error(root);
+        }
+        emit(vm, &__cmov, sizeof(__cmov));
+        
+        return success(root);        
+}
+
+/*
+ * Returns k if 'node' is the number 2^k, k > 0. Otherwise -1.
+ */
+static int power_of_two(ast_node *node)
+{
+        assert(node);
+
+        if (node->type != AST_NODE_NUMBER)
+                return -1;
+
+        num_t n = ast_number(node);
+        if (n <= 1 || (n & (n - 1)))
+                return -1;
+
+        return __builtin_ctzll((unsigned long long)n);
+}
+
+/* Exponents below are raised to the power inline, others call __ass_pow */
+static const num_t POW_INLINE_MAX = 64;
+
+static bool is_inline_pow(ast_node *root)
+{
+        assert(root);
+
+        if (keyword(root) != AST_POW || !root->left || !root->right)
+                return false;
+
+        if (root->right->type != AST_NODE_NUMBER)
+                return false;
+
+        num_t n = ast_number(root->right);
+        return n >= 0 && n < POW_INLINE_MAX;
+}
+
+/*
+ * Folding pass leaves constants on the right, negation is '0 - x'.
+ * These operators need the only operand in register.
+ */
+static ast_node *unary_operand(ast_node *root)
+{
+        assert(root);
+
+        switch (keyword(root)) {
+        case AST_SUB:
+                if (root->left && root->right && root->left->type == AST_NODE_NUMBER &&
+                    !ast_number(root->left))
+                        return root->right;
+                return nullptr;
+        case AST_MUL:
+        case AST_DIV:
+                if (root->left && root->right && power_of_two(root->right) > 0)
+                        return root->left;
+                return nullptr;
+        case AST_POW:
+                return is_inline_pow(root) ? root->left : nullptr;
+        default:
+                return nullptr;
+        }
+}
+
+static ast_node *compile_expr_neg(ast_node *root, ac_virtual_memory *vm)
+{
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x49; /* 1001001b */
+                const ubyte opcode = 0xf7;
+                ie64_modrm modrm   = { .rm = 0b000, .reg = 0b011, .mod = 0b11 };
+        } __neg;
+        trace_point(TRACE_LEGACY, root);
+
+        __neg.modrm.rm = register_top(vm);
+        emit(vm, &__neg, sizeof(__neg));
+
+        return success(root);
+}
+
+static ast_node *compile_expr_shl(ast_node *root, ac_virtual_memory *vm)
+{
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x49; /* 1001001b */
+                const ubyte opcode = 0xc1;
+                ie64_modrm modrm   = { .rm = 0b000, .reg = 0b100, .mod = 0b11 };
+                imm8 imm           = 0;
+        } __shl;
+        trace_point(TRACE_LEGACY, root);
+
+        __shl.modrm.rm = register_top(vm);
+        __shl.imm      = (imm8)power_of_two(root->right);
+        emit(vm, &__shl, sizeof(__shl));
+
+        return success(root);
+}
+
+/*
+ * Exponentiation by squaring unrolled for the constant exponent:
+ * rax accumulates the result, base stays in its register.
+ */
+static ast_node *compile_expr_pow(ast_node *root, ac_virtual_memory *vm)
+{
+        uint64_t n = (uint64_t)ast_number(root->right);
+        ubyte base = register_top(vm);
+        trace_point(TRACE_LEGACY, root);
+
+        if (n == 0) {
+                /* mov r, 1 */
+                struct __attribute__((packed)) {
+                        const ubyte rex    = 0x41; /* 1000001b */
+                        ubyte opcode       = 0xb8;
+                        const imm32 imm    = 1;
+                } __one;
+
+                __one.opcode += base;
+                emit(vm, &__one, sizeof(__one));
+                return success(root);
+        }
+
+        if (n == 1)
+                return success(root);
+
+        /* mov rax, base */
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x4c; /* 0b01001100 */
+                const ubyte opcode = 0x89;
+                ie64_modrm modrm   = { .rm = IE64_RAX, .reg = 0b000, .mod = 0b11 };
+        } __mov;
+
+        __mov.modrm.reg = base & 0b111;
+        emit(vm, &__mov, sizeof(__mov));
+
+        /* imul rax, rax */
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x48; /* 0b01001000 */
+                const ubyte prefix = 0x0f;
+                const ubyte opcode = 0xaf;
+                ie64_modrm modrm   = { .rm = IE64_RAX, .reg = IE64_RAX, .mod = 0b11 };
+        } __square;
+
+        /* imul rax, base */
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x49; /* 0b01001001 */
+                const ubyte prefix = 0x0f;
+                const ubyte opcode = 0xaf;
+                ie64_modrm modrm   = { .rm = 0b000, .reg = IE64_RAX, .mod = 0b11 };
+        } __imul;
+
+        __imul.modrm.rm = base & 0b111;
+
+        /* Left-to-right binary method: square for every bit below the highest one */
+        for (int bit = 62 - __builtin_clzll(n); bit >= 0; bit--) {
+                emit(vm, &__square, sizeof(__square));
+                if (n & (1ull << bit))
+                        emit(vm, &__imul, sizeof(__imul));
+        }
+
+        /* mov base, rax */
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x49; /* 0b01001001 */
+                const ubyte opcode = 0x89;
+                ie64_modrm modrm   = { .rm = 0b000, .reg = IE64_RAX, .mod = 0b11 };
+        } __result;
+
+        __result.modrm.rm = base & 0b111;
+        emit(vm, &__result, sizeof(__result));
+
+        return success(root);
+}
+
+/*
+ * Signed division by 2^k rounds toward zero, so negative
+ * dividend is biased by 2^k - 1 before the arithmetic shift.
+ */
+static ast_node *compile_expr_sar(ast_node *root, ac_virtual_memory *vm)
+{
+        imm8 shift = (imm8)power_of_two(root->right);
+        ubyte dividend = register_top(vm);
+        trace_point(TRACE_LEGACY, root);
+
+        /* mov rax, dividend */
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x4c; /* 0b01001100 */
+                const ubyte opcode = 0x89;
+                ie64_modrm modrm   = { .rm = IE64_RAX, .reg = 0b000, .mod = 0b11 };
+        } __mov;
+
+        __mov.modrm.reg = dividend & 0b111;
+        emit(vm, &__mov, sizeof(__mov));
+
+        /* sar rax, 63: all ones if negative */
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x48;
+                const ubyte opcode = 0xc1;
+                ie64_modrm modrm   = { .rm = IE64_RAX, .reg = 0b111, .mod = 0b11 };
+                const imm8 imm     = 63;
+        } __sign;
+        emit(vm, &__sign, sizeof(__sign));
+
+        /* shr rax, 64 - k: the bias */
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x48;
+                const ubyte opcode = 0xc1;
+                ie64_modrm modrm   = { .rm = IE64_RAX, .reg = 0b101, .mod = 0b11 };
+                imm8 imm           = 0;
+        } __bias;
+
+        __bias.imm = (imm8)(64 - shift);
+        emit(vm, &__bias, sizeof(__bias));
+
+        /* add dividend, rax */
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x49; /* 0b01001001 */
+                const ubyte opcode = 0x01;
+                ie64_modrm modrm   = { .rm = 0b000, .reg = IE64_RAX, .mod = 0b11 };
+        } __add;
+
+        __add.modrm.rm = dividend & 0b111;
+        emit(vm, &__add, sizeof(__add));
+
+        /* sar dividend, k */
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x49; /* 0b01001001 */
+                const ubyte opcode = 0xc1;
+                ie64_modrm modrm   = { .rm = 0b000, .reg = 0b111, .mod = 0b11 };
+                imm8 imm           = 0;
+        } __sar;
+
+        __sar.modrm.rm = dividend & 0b111;
+        __sar.imm      = shift;
+        emit(vm, &__sar, sizeof(__sar));
+
+        return success(root);
+}
+
+/* 
+ * Subtrees deeper than this are considered as the heaviest ones.
+ * It keeps the operands order choice linear.
+ */
+static const int WEIGHT_DEPTH = 6;
+
+/*
+ * Sethi-Ullman number: how many registers the expression needs.
+ * Calls clobber all the registers.
+ */
+static int expr_weight(ast_node *root, int depth)
+{
+        assert(root);
+
+        if (!depth)
+                return AC_N_REGS;
+
+        if (root->type == AST_NODE_NUMBER)
+                return 1;
+
+        if (root->type == AST_NODE_IDENT) {
+                if (!root->right)
+                        return 1;
+
+                return expr_weight(root->right, depth - 1);
+        }
+
+        if (keyword(root) == AST_CALL || keyword(root) == AST_IN)
+                return AC_N_REGS;
+
+        /* __ass_pow clobbers r8-r11 */
+        if (keyword(root) == AST_POW && !is_inline_pow(root))
+                return AC_N_REGS;
+
+        int left  = root->left  ? expr_weight(root->left,  depth - 1) : 0;
+        int right = root->right ? expr_weight(root->right, depth - 1) : 0;
+
+        int weight = left == right ? left + 1 : (left > right ? left : right);
+        return weight < AC_N_REGS ? weight : AC_N_REGS;
+}
+
+static bool expr_calls(ast_node *root, int depth)
+{
+        assert(root);
+
+        if (!depth)
+                return true;
+
+        if (keyword(root) == AST_CALL || keyword(root) == AST_IN)
+                return true;
+
+        return (root->left  && expr_calls(root->left,  depth - 1)) ||
+               (root->right && expr_calls(root->right, depth - 1));
+}
+
+static bool expr_globals(ast_node *root, ac_symtab *symtabs, int depth)
+{
+        assert(root);
+        assert(symtabs);
+
+        if (!depth)
+                return true;
+
+        if (root->type == AST_NODE_IDENT) {
+                ac_symbol *sym = symtab_find(symtabs, ast_ident(root));
+                if (!sym || sym->vis != AC_VIS_LOCAL)
+                        return true;
         }
-$$
-        emit(vm, &__cmov, sizeof(__cmov));
-        
-        return success(root);        
+
+        return (root->left  && expr_globals(root->left,  symtabs, depth - 1)) ||
+               (root->right && expr_globals(root->right, symtabs, depth - 1));
+}
+
+/*
+ * Heavier operand is evaluated first, so the lighter one 
+ * doesn't occupy a register meanwhile. It's only possible 
+ * if the left one can't observe side effects of the right one.
+ */
+static bool reorder_operands(ast_node *root, ac_symtab *symtabs)
+{
+        assert(root);
+        assert(symtabs);
+
+        if (!root->left || !root->right)
+                return false;
+
+        if (expr_weight(root->right, WEIGHT_DEPTH) <= expr_weight(root->left, WEIGHT_DEPTH))
+                return false;
+
+        if (expr_calls(root->left, WEIGHT_DEPTH))
+                return false;
+
+        return !expr_calls(root->right, WEIGHT_DEPTH) || 
+               !expr_globals(root->left, symtabs, WEIGHT_DEPTH);
 }
 
-static ast_node *compile_expr(ast_node *root, stack *symtabs, ac_virtual_memory *vm)
+static ast_node *compile_expr(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm)
 {
         assert(vm);
         assert(root);
@@ -560,26 +1243,55 @@ static ast_node *compile_expr(ast_node *root, stack *symtabs, ac_virtual_memory
 
         if (keyword(root) == AST_CALL)
                 return compile_call(root, symtabs, vm);
-$$
+        trace_point(TRACE_LEGACY, root);
+
+        ast_node *operand = unary_operand(root);
+        if (operand) {
+                error = compile_expr(operand, symtabs, vm);
+                if (error)
+                        return error;
+
+                switch (keyword(root)) {
+                case AST_SUB:
+                        return compile_expr_neg(root, vm);
+                case AST_MUL:
+                        return compile_expr_shl(root, vm);
+                case AST_DIV:
+                        return compile_expr_sar(root, vm);
+                case AST_POW:
+                        return compile_expr_pow(root, vm);
+                default:
+                        return syntax_error(root);
+                }
+        }
+
         if (keyword(root)) {
-                if (root->left) {
-                        error = compile_expr(root->left, symtabs, vm);
+                bool reorder = reorder_operands(root, symtabs);
+
+                ast_node *first  = reorder ? root->right : root->left;
+                ast_node *second = reorder ? root->left  : root->right;
+
+                if (first) {
+                        error = compile_expr(first, symtabs, vm);
                         if (error)
                                 return error;
                 }
-$$
-                if (root->right) {
-                        error = compile_expr(root->right, symtabs, vm);
+                if (second) {
+                        error = compile_expr(second, symtabs, vm);
                         if (error)
                                 return error;
                 }
+
+                /* Operands are evaluated in the reverse order */
+                if (reorder)
+                        register_swap(vm);
         }        
 
         if (root->type == AST_NODE_NUMBER)
                 return compile_load_num(root, symtabs, vm);
         
         if (root->type == AST_NODE_IDENT) {
-                ac_symbol *sym = find_symbol(symtabs, ast_ident(root));
+                ac_symbol *sym = symtab_find(symtabs, ast_ident(root));
                 if (!sym)
                         return syntax_error(root);
 
@@ -602,6 +1314,8 @@ $$
                 return compile_expr_mul(root, vm);
         case AST_DIV:
                 return compile_expr_div(root, vm);
+        case AST_POW:
+                return compile_stdcall (root, symtabs, vm, SYM_POW);
         case AST_NOT:
                 return compile_expr_not(root, vm);
         case AST_AND:
@@ -630,7 +1344,7 @@ $$
       └─┼───jmp     
         └─> ...        
 */    
-static ast_node *compile_while(ast_node *root, stack *symtabs, ac_virtual_memory *vm)
+static ast_node *compile_while(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm)
 {
         assert(vm);
         assert(root);
@@ -642,8 +1356,8 @@ static ast_node *compile_while(ast_node *root, stack *symtabs, ac_virtual_memory
         if (!root->left)
                 return syntax_error(root);
 
-        array symtab = {};
-        push_stack(symtabs, &symtab);
+        if (symtab_push_scope(symtabs))
+                return syntax_error(root);
 
         /* Store the start of the condition code */
         ptrdiff_t cond_addr = rip(vm);
@@ -664,16 +1378,8 @@ static ast_node *compile_while(ast_node *root, stack *symtabs, ac_virtual_memory
 
         emit(vm, &__test, sizeof(__test));
 
-        struct __attribute__((packed)) {
-                const ubyte prefix = 0x0f;
-                const ubyte opcode = 0x84;
-                imm32 imm          = 0;
-        } __je;
-
-        ptrdiff_t __je_addr = rip(vm);
-        
         /* Jump to the end of cycle */
-        emit(vm, &__je, sizeof(__je));
+        ptrdiff_t __je_addr = emit_branch(vm, 0x84);
 
         /* Compile body loop */
         error = compile_stmt(root->right, symtabs, vm);
@@ -688,14 +1394,12 @@ static ast_node *compile_while(ast_node *root, stack *symtabs, ac_virtual_memory
         __jmp.imm = (imm32)(cond_addr - rip(vm) - (imm32)sizeof(__jmp));
 
         /* Jump to the condition expression */
-        emit(vm, &__jmp, sizeof(__jmp));
+        emit_pinned(vm, &__jmp, sizeof(__jmp));
 
         /* Patch jump to the end of loop */
-        __je.imm = (imm32)(-__je_addr - (imm32)sizeof(__je) + rip(vm));
-        patch(vm, __je_addr, &__je, sizeof(__je));
+        patch_branch(vm, __je_addr, rip(vm));
 
-        pop_stack(symtabs);
-        free_array(&symtab, sizeof(ac_symbol));
+        symtab_pop_scope(symtabs);
 
         return success(root);
 }
@@ -711,7 +1415,7 @@ static ast_node *compile_while(ast_node *root, stack *symtabs, ac_virtual_memory
                               │ └> (false body)
                               └──> ...     
 */  
-static ast_node *compile_if(ast_node *root, stack *symtabs, ac_virtual_memory *vm)
+static ast_node *compile_if(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm)
 {
         assert(vm);
         assert(root);
@@ -720,8 +1424,8 @@ static ast_node *compile_if(ast_node *root, stack *symtabs, ac_virtual_memory *v
         ast_node *error = nullptr;
         require(root, AST_IF);
 
-        array symtab = {};
-        push_stack(symtabs, &symtab);
+        if (symtab_push_scope(symtabs))
+                return syntax_error(root);
 
         error = compile_expr(root->left, symtabs, vm);
         if (error)
@@ -738,22 +1442,14 @@ static ast_node *compile_if(ast_node *root, stack *symtabs, ac_virtual_memory *v
 
         emit(vm, &__test, sizeof(__test));
 
-        struct __attribute__((packed)) {
-                const ubyte prefix = 0x0f;
-                const ubyte opcode = 0x84;
-                imm32 imm          = 0;
-        } __je;
-
-        ptrdiff_t __je_addr = rip(vm);
-        emit(vm, &__je, sizeof(__je));
+        ptrdiff_t __je_addr = emit_branch(vm, 0x84);
         
         ast_node *decision = root->right;
         if (!decision)
                 return syntax_error(root);
-$$
+        trace_point(TRACE_LEGACY, root);
         if (!decision->left)
                 return syntax_error(root);     
-$$
         error = compile_stmt(decision->left, symtabs, vm);
         if (error)
                 return error;
@@ -766,10 +1462,9 @@ $$
                 } __jmp;
 
                 ptrdiff_t __jmp_addr = rip(vm);
-                emit(vm, &__jmp, sizeof(__jmp));
+                emit_pinned(vm, &__jmp, sizeof(__jmp));
                 
-                __je.imm = (imm32)(rip(vm) - __je_addr - (imm32)sizeof(__je));
-                patch(vm, __je_addr, &__je, sizeof(__je));
+                patch_branch(vm, __je_addr, rip(vm));
 
                 error = compile_stmt(decision->right, symtabs, vm);
                 if (error)
@@ -779,38 +1474,33 @@ $$
                 patch(vm, __jmp_addr, &__jmp, sizeof(__jmp));
                 
         } else {
-                __je.imm = (imm32)(rip(vm) - __je_addr - (imm32)sizeof(__je));
-                patch(vm, __je_addr, &__je, sizeof(__je));
+                patch_branch(vm, __je_addr, rip(vm));
         }
 
-        pop_stack(symtabs);
-        free_array(&symtab, sizeof(ac_symbol));
+        symtab_pop_scope(symtabs);
 
         return success(root);
 }
 
-static ast_node *compile_load_num(ast_node *root, stack *symtabs, ac_virtual_memory *vm)
+static ast_node *compile_load_num(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm)
 {
         assert(vm);
         assert(root);
         assert(symtabs);   
-$$
+        trace_point(TRACE_LEGACY, root);
         require_number(root);
-$$
         struct __attribute__((packed)) {
                 const ubyte rex = 0b01001001;
                 ubyte opcode    = 0xb8;  
                 imm64 imm       = 0;   
         } __movabs;
-$$
         __movabs.imm = (imm64)ast_number(root);
         __movabs.opcode += (ubyte)register_push(vm);
         emit(vm, &__movabs, sizeof(__movabs));
-$$
         return success(root);
 }
 
-static ast_node *compile_stack_store(ast_node *root, stack *symtabs, ac_virtual_memory *vm, ac_symbol *sym)
+static ast_node *compile_stack_store(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm, ac_symbol *sym)
 {
         assert(vm);
         assert(sym);
@@ -841,6 +1531,12 @@ static ast_node *compile_stack_store(ast_node *root, stack *symtabs, ac_virtual_
                 emit(vm, &__mov64, sizeof(__mov64));
                 return success(root);
                 
+        } else if (sym->reg >= 0) {
+
+                /* mov arg, r */
+                emit_arg_move(vm, 0x89, register_pop(vm), (ubyte)sym->reg);
+                return success(root);
+
         } else {
 
                 struct __attribute__((packed)) {
@@ -859,7 +1555,7 @@ static ast_node *compile_stack_store(ast_node *root, stack *symtabs, ac_virtual_
         }
 }      
 
-static ast_node *compile_stack_load(ast_node *root, stack *symtabs, ac_virtual_memory *vm, ac_symbol *sym)
+static ast_node *compile_stack_load(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm, ac_symbol *sym)
 {
         assert(vm);
         assert(sym);
@@ -890,6 +1586,12 @@ static ast_node *compile_stack_load(ast_node *root, stack *symtabs, ac_virtual_m
                 emit(vm, &__mov64, sizeof(__mov64));
                 return success(root);
                 
+        } else if (sym->reg >= 0) {
+
+                /* mov r, arg */
+                emit_arg_move(vm, 0x8b, register_push(vm), (ubyte)sym->reg);
+                return success(root);
+
         } else {
         
                 struct __attribute__((packed)) {
@@ -908,13 +1610,14 @@ static ast_node *compile_stack_load(ast_node *root, stack *symtabs, ac_virtual_m
         }
 }      
 
-static ast_node *compile_data_store(ast_node *root, stack *symtabs, ac_virtual_memory *vm, ac_symbol *sym)
+static ast_node *compile_data_store(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm, ac_symbol *sym)
 {
         assert(vm);
         assert(sym);
         assert(root);
         
         ast_node *error = nullptr;
+        trace_point(TRACE_LEGACY, root);
         require_ident(root); 
 
         Elf64_Rela rela = {
@@ -936,14 +1639,11 @@ static ast_node *compile_data_store(ast_node *root, stack *symtabs, ac_virtual_m
                         ie64_sib sib       = { .base = 0b101, .index = 0b000, .scale = 0b11 };
                         imm32 imm          = 0;   
                 } __mov64;          
-$$
-                rela.r_offset = (Elf64_Addr)(rip(vm) + 0x04);
-$$                
                 __mov64.sib.index = register_pop(vm);
                 __mov64.modrm.reg = register_pop(vm);
-$$
+                rela.r_offset = (Elf64_Addr)(rip(vm) + 0x04);
                 /* mov [8*r + imm], r */
-                emit(vm, &__mov64, sizeof(__mov64));       
+                emit_pinned(vm, &__mov64, sizeof(__mov64));
                 
         } else {
         
@@ -954,26 +1654,24 @@ $$
                         const ie64_sib sib = { .base = 0b101, .index = 0b100, .scale = 0b00 };
                         imm32 imm          = 0;   
                 } __mov64;          
-$$
-                rela.r_offset = (Elf64_Addr)(rip(vm) + 0x04);
-
                 __mov64.modrm.reg = register_pop(vm);
-$$     
+                /* Taking a register can spill, relocate after that */
+                rela.r_offset = (Elf64_Addr)(rip(vm) + 0x04);
                 /* mov [imm], r */
-                emit(vm, &__mov64, sizeof(__mov64));
+                emit_pinned(vm, &__mov64, sizeof(__mov64));
         }
-$$
         section_memcpy(vm->secs + SEC_RELA_TEXT, &rela, sizeof(Elf64_Rela));
         return success(root);
 }
 
-static ast_node *compile_data_load(ast_node *root, stack *symtabs, ac_virtual_memory *vm, ac_symbol *sym)
+static ast_node *compile_data_load(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm, ac_symbol *sym)
 {
         assert(vm);
         assert(sym);
         assert(root);
         
         ast_node *error = nullptr;
+        trace_point(TRACE_LEGACY, root);
         require_ident(root); 
 
         Elf64_Rela rela = {
@@ -995,14 +1693,11 @@ static ast_node *compile_data_load(ast_node *root, stack *symtabs, ac_virtual_me
                         ie64_sib sib       = { .base = 0b101, .index = 0b000, .scale = 0b11 };
                         imm32 imm          = 0;   
                 } __mov64;          
-$$
-                rela.r_offset = (Elf64_Addr)(rip(vm) + 0x04);
-$$                
                 __mov64.sib.index = register_top(vm);
                 __mov64.modrm.reg = register_top(vm);
-$$
+                rela.r_offset = (Elf64_Addr)(rip(vm) + 0x04);
                 /* mov r, [8*r + imm] */
-                emit(vm, &__mov64, sizeof(__mov64));       
+                emit_pinned(vm, &__mov64, sizeof(__mov64));
                 
         } else {
         
@@ -1013,25 +1708,25 @@ $$
                         const ie64_sib sib = { .base = 0b101, .index = 0b100, .scale = 0b00 };
                         imm32 imm          = 0;   
                 } __mov64;          
-$$
-                rela.r_offset = (Elf64_Addr)(rip(vm) + 0x04);
-
                 __mov64.modrm.reg = register_push(vm);
-$$     
+                /* Taking a register can spill, relocate after that */
+                rela.r_offset = (Elf64_Addr)(rip(vm) + 0x04);
                 /* mov r, [imm] */
-                emit(vm, &__mov64, sizeof(__mov64));
+                emit_pinned(vm, &__mov64, sizeof(__mov64));
         }
-$$
         section_memcpy(vm->secs + SEC_RELA_TEXT, &rela, sizeof(Elf64_Rela));
         return success(root);
 }
 
 static ast_node *compile_call_begin(ast_node *root, ac_virtual_memory *vm, size_t *pushed)
 {
-        /* Stack must be aligned to 0x10 boundary.
-           i.e. (n_pushed + return address) % 2 */
+        /* Stack must be aligned to 0x10 boundary before the call.
+           Stack frame is aligned, so count the pushed words only. 
+           Note! Arguments can contain calls too. */
         size_t n_pushed = *pushed;
-        if ((n_pushed + 1) % 2) {
+        if ((vm->n_pushed + n_pushed) % 2) {
+                vm->n_pushed++;
+
 
                 n_pushed++;
                 struct __attribute__((packed)) {
@@ -1056,7 +1751,7 @@ static ast_node *compile_call_end(ast_node *root, ac_virtual_memory *vm, size_t
                 const ubyte opcode = 0x89;
                 ie64_modrm modrm = { .rm = 0b000, .reg = IE64_RAX, .mod = 0b11 };         
         } __mov64;      
-$$        
+        trace_point(TRACE_LEGACY, root);
         __mov64.modrm.rm = (register_push(vm));
 
         /* mov r, rax */
@@ -1070,46 +1765,37 @@ $$
         } __add;
 
         __add.imm = (imm32)(pushed * 0x8);
+        vm->n_pushed -= pushed;
 
         /* add rsp, aligned * 0x8 */
-        emit(vm, &__add, sizeof(__add)); 
+        if (pushed)
+                emit(vm, &__add, sizeof(__add)); 
 
         return success(root);
 }
 
-static ast_node *compile_call(ast_node *root, stack *symtabs, ac_virtual_memory *vm)
+static ast_node *compile_call(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm)
 {
         assert(vm);
         assert(root);
         assert(symtabs); 
         ast_node *error = nullptr;
-$$
+        trace_point(TRACE_LEGACY, root);
         require_ident(root->left);
-        ac_symbol *sym = find_symbol(symtabs, ast_ident(root->left));
+        ac_symbol *sym = symtab_find(symtabs, ast_ident(root->left));
         if (!sym || sym->type != AC_SYM_FUNC)
                 return syntax_error(root);
 
-        /* We have to save registers because 
-           called function can change their values. */
-        int n_saved = register_top(vm);
-        for (int i = 0; i < n_saved; i++) {
-                struct __attribute__((packed)) {
-                        const ubyte rex = 0x41; /* 1000001b */
-                        ubyte opcode    = 0x50;
-                } __push;
-
-                __push.opcode += (ubyte)(i + 1);
-                emit(vm, &__push, sizeof(__push));         
-        }
-
-        size_t n_pushed = (size_t)sym->info;
+        size_t n_regs   = arg_registers(sym);
+        size_t n_pushed = (size_t)sym->info - n_regs;
         error = compile_call_begin(root, vm, &n_pushed);
         if (error)
                 return error;
                 
-        /* Calculate and push function parameters */
+        /* Arguments are calculated from the last one. Those which
+           don't fit the registers are pushed, others are kept. */
         ast_node *param = root->right;
-        for (ptrdiff_t i = 0; i < sym->info; i++) {
+        for (ptrdiff_t i = sym->info; i > 0; i--) {
                 if (!param)
                         return syntax_error(root);
                         
@@ -1117,85 +1803,86 @@ $$
                 if (error)
                         return error;
 
-                struct __attribute__((packed)) {
-                        const ubyte rex = 0x41; /* 1000001b */
-                        ubyte opcode    = 0x50;
-                } __push;           
-$$
-                __push.opcode += (ubyte)register_pop(vm);
-                emit(vm, &__push, sizeof(__push));        
+                if ((size_t)i > n_regs) {
+                        struct __attribute__((packed)) {
+                                const ubyte rex = 0x41; /* 1000001b */
+                                ubyte opcode    = 0x50;
+                        } __push;           
+                        __push.opcode += (ubyte)register_pop(vm);
+                        emit(vm, &__push, sizeof(__push));        
+                        vm->n_pushed++;
+                }
 
                 param = param->left;
         }
 
+        /* Called function can change all the registers. 
+           Live operands are spilled to the stack frame. */
+        unsigned taken = register_args(vm, n_regs, ~0u);
+
         struct __attribute__((packed)) {
                 const ubyte opcode = 0xe8;
                 imm32 imm          = 0x00;
         } __call; 
-$$
-        __call.imm = (imm32)(sym->offset - rip(vm) - (imm32)sizeof(__call));     
-        emit(vm, &__call, sizeof(__call));
+
+        if (sym->offset < 0) {
+                /* Function is defined below, patch it later */
+                ac_fixup fixup = {
+                        .addr  = rip(vm) + 0x01,
+                        .ident = sym->ident,
+                };
+                if (!array_push(&vm->fixups, &fixup, sizeof(ac_fixup)))
+                        return syntax_error(root);
+        } else {
+                __call.imm = (imm32)(sym->offset - rip(vm) - (imm32)sizeof(__call));     
+        }
+
+        emit_pinned(vm, &__call, sizeof(__call));
+        vm->reg.busy &= ~taken;
         
         error = compile_call_end(root, vm, n_pushed);
         if (error)
                 return error;
-
-        /* Load the values of the saved registers */
-        for (int i = n_saved; i > 0; i--) {
-
-                struct __attribute__((packed)) {
-                        const ubyte rex = 0x41; /* 1000001b */
-                        ubyte opcode    = 0x58;
-                } __pop;
-
-                __pop.opcode += (ubyte)i;
-                emit(vm, &__pop, sizeof(__pop));        
-        }
                 
         return success(root);        
 }
 
-static ast_node *compile_stdcall(ast_node *root, stack *symtabs, ac_virtual_memory *vm, const int sym_index)
+static ast_node *compile_stdcall(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm, const int sym_index)
 {
         assert(vm);
         assert(root);
         assert(symtabs); 
         ast_node *error = nullptr;
-$$
+        trace_point(TRACE_LEGACY, root);
         elf64_symbol *sym = vm->syms + sym_index;
         if (!sym)
                 return syntax_error(root);
 
-        size_t n_pushed = sym->info;
+        size_t n_pushed = 0;
         error = compile_call_begin(root, vm, &n_pushed);
         if (error)
                 return error;
-$$
-        /* Push arguments */
-        for (size_t i = 0; i < sym->info; i++) {
 
-                struct __attribute__((packed)) {
-                        const ubyte rex = 0x41; /* 1000001b */
-                        ubyte opcode    = 0x50;
-                } __push;           
-$$
-                __push.opcode += (ubyte)register_pop(vm);
-                emit(vm, &__push, sizeof(__push));        
-        }
-$$
+        /* Operands are calculated from the first one, it's below the top */
+        assert(sym->info <= 2);
+        if (sym->info == 2)
+                register_swap(vm);
+
+        /* Standard library keeps r12-r15 */
+        unsigned taken = register_args(vm, sym->info, STDCALL_CLOBBERED);
+
         struct __attribute__((packed)) {
                 const ubyte opcode = 0xe8;
                 imm32 imm          = 0x00;
         } __call; 
-$$
         Elf64_Rela rela = {
                 .r_offset = (Elf64_Addr)(rip(vm) + 0x01), 
                 .r_info   = ELF64_R_INFO(sym_index, R_X86_64_PC32), 
                 .r_addend = -0x04,
         }; 
-$$     
         section_memcpy(vm->secs + SEC_RELA_TEXT, &rela, sizeof(Elf64_Rela));      
-        emit(vm, &__call, sizeof(__call));
+        emit_pinned(vm, &__call, sizeof(__call));
+        vm->reg.busy &= ~taken;
 
         error = compile_call_end(root, vm, n_pushed);
         if (error)
@@ -1204,22 +1891,119 @@ $$
         return success(root);
 }
 
-static ast_node *compile_return(ast_node *root, stack *symtabs, ac_virtual_memory *vm)
+/*
+ * Applies the accumulator of the self tail calls to the top operand.
+ */
+static void compile_accumulate(ac_virtual_memory *vm)
+{
+        assert(vm);
+
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x4c; /* 1001100b */
+                const ubyte prefix = 0x0f;
+                const ubyte opcode = 0xaf;
+                ie64_modrm modrm   = { .rm = IE64_RBP, .reg = 0b000, .mod = 0b10 };
+                imm32 imm          = 0;
+        } __imul;
+
+        ubyte reg = register_top(vm);
+        if (vm->tail.acc_op == AST_MUL) {
+                __imul.modrm.reg = reg & 0b111;
+                __imul.imm       = vm->tail.acc;
+
+                /* imul r, [rbp + acc] */
+                emit(vm, &__imul, sizeof(__imul));
+        } else {
+                /* add r, [rbp + acc] */
+                emit_frame_move(vm, 0x03, reg, vm->tail.acc);
+        }
+}
+
+/*
+ * 'return f(...)' in f: arguments are stored to the parameters, then
+ * the body is entered again. The stack frame is reused, so such
+ * recursion runs in the constant stack space.
+ */
+static ast_node *compile_tail_call(ast_tail_call *tail, ac_symtab *symtabs, ac_virtual_memory *vm)
+{
+        assert(vm);
+        assert(tail);
+        assert(symtabs);
+        ast_node *error = nullptr;
+        trace_point(TRACE_LEGACY, tail->call);
+
+        if (tail->operand) {
+                error = compile_expr(tail->operand, symtabs, vm);
+                if (error)
+                        return error;
+
+                compile_accumulate(vm);
+
+                /* mov [rbp + acc], r */
+                emit_frame_move(vm, 0x89, register_pop(vm), vm->tail.acc);
+        }
+
+        /* All the arguments are calculated before parameters are changed */
+        size_t n_params = 0;
+        for (ast_node *param = tail->call->right; param; param = param->left) {
+                error = compile_expr(param->right, symtabs, vm);
+                if (error)
+                        return error;
+
+                n_params++;
+        }
+
+        /* The top operand is the first argument, the chain starts from the last one */
+        for (size_t i = n_params; i > 0; i--) {
+                ast_node *param = vm->tail.params;
+                for (size_t j = 1; j < i; j++)
+                        param = param->left;
+
+                ac_symbol *sym = symtab_find(symtabs, ast_ident(param->right));
+                if (!sym)
+                        return syntax_error(tail->call);
+
+                error = compile_stack_store(param->right, symtabs, vm, sym);
+                if (error)
+                        return error;
+        }
+
+        struct __attribute__((packed)) {
+                const ubyte opcode = 0xe9;
+                imm32 imm          = 0x00;
+        } __jmp;
+        __jmp.imm = (imm32)(vm->tail.body - rip(vm) - (imm32)sizeof(__jmp));
+
+        /* jmp body */
+        emit_pinned(vm, &__jmp, sizeof(__jmp));
+        return success(tail->call);
+}
+
+static ast_node *compile_return(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm)
 {
         assert(vm);
         assert(root);
         assert(symtabs);        
-$$
+        trace_point(TRACE_LEGACY, root);
         ast_node *error = nullptr;
-$$
         require(root, AST_RETURN);
         if (!root->right)
                 return syntax_error(root);
-$$
+
+        ac_symbol *func_sym = vm->tail.func ? symtab_find(symtabs, vm->tail.func) : nullptr;
+        ast_tail_call tail = {};
+        if (func_sym && func_sym->type == AC_SYM_FUNC &&
+            match_tail_call(root, vm->tail.func, vm->tail.params, &tail) &&
+            (!tail.operand || tail.op == vm->tail.acc_op))
+                return compile_tail_call(&tail, symtabs, vm);
+
         error = compile_expr(root->right, symtabs, vm);
         if (error)
                 return error;
-$$
+
+        if (vm->tail.acc_op != AST_NULL)
+                compile_accumulate(vm);
+
         /* mov %top, %rax */         
         struct __attribute__((packed)) {
                 const ubyte rex    = 0b01001100;
@@ -1227,10 +2011,47 @@ $$
                 ie64_modrm modrm = { .rm = IE64_RAX, .reg = 0b000, .mod = 0b11, };
         
         } __mov64;
-$$
         __mov64.modrm.reg = register_pop(vm);
         emit(vm, &__mov64, sizeof(__mov64));
-$$
+        compile_epilogue(vm);
+        return success(root);
+}
+
+static ptrdiff_t compile_prologue(ac_virtual_memory *vm)
+{
+        assert(vm);
+
+        /* push rbp */
+        struct __attribute__((packed)) {
+                const ubyte opcode = 0x50 + IE64_RBP;
+        } __push;
+        trace_point(TRACE_LEGACY, nullptr);
+        emit(vm, &__push, sizeof(__push));
+        /* mov rbp, rsp */         
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x48;
+                const ubyte opcode = 0x89;
+                ie64_modrm modrm   = { .rm = IE64_RBP, .reg = IE64_RSP, .mod = 0b11 };         
+        } __mov64;
+        emit(vm, &__mov64, sizeof(__mov64));
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x48; /* 1001000b */
+                const ubyte opcode = 0x81;
+                ie64_modrm modrm   = { .rm = IE64_RSP, .reg = 0b101, .mod = 0b11 };
+                imm32 imm          = 0;
+        } __sub; 
+
+        /* Frame size is patched by compile_frame_size() */
+        ptrdiff_t __sub_addr = rip(vm);
+        emit_pinned(vm, &__sub, sizeof(__sub));
+
+        return __sub_addr;
+}
+
+static void compile_epilogue(ac_virtual_memory *vm)
+{
+        assert(vm);
+
         /* mov rsp, rbp */         
         struct __attribute__((packed)) {
                 const ubyte rex    = 0x48;
@@ -1244,19 +2065,39 @@ $$
         struct __attribute__((packed)) {
                 const ubyte opcode = 0x58 + IE64_RBP;
         } __pop;
-$$
+        trace_point(TRACE_LEGACY, nullptr);
         emit(vm, &__pop, sizeof(__pop));
-$$
         struct __attribute__((packed)) {
                 ubyte opcode = 0xc3;     
         } __ret;
       
         emit(vm, &__ret, sizeof(__ret));
-$$
-        return success(root);
 }
 
-static ast_node *compile_stmt(ast_node *root, stack *symtabs, ac_virtual_memory *vm)
+/*
+ * Patches the stack frame allocation of the compiled function
+ * and drops its frame: locals and spill slots.
+ */
+static void compile_frame_size(ac_virtual_memory *vm, ptrdiff_t sub_addr)
+{
+        assert(vm);
+
+        struct __attribute__((packed)) {
+                const ubyte rex    = 0x48; /* 1001000b */
+                const ubyte opcode = 0x81;
+                ie64_modrm modrm   = { .rm = IE64_RSP, .reg = 0b101, .mod = 0b11 };
+                imm32 imm          = 0;
+        } __sub; 
+
+        /* sub rsp, stack frame size */
+        __sub.imm = (imm32)elf64_align(vm->secs[SEC_NULL].size, 0x10);
+        patch(vm, sub_addr, &__sub, sizeof(__sub));
+
+        section_free(vm->secs + SEC_NULL);
+        free_array(&vm->reg.slots, sizeof(imm32));
+}
+
+static ast_node *compile_stmt(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm)
 {
         assert(vm);
         assert(root);
@@ -1273,7 +2114,7 @@ static ast_node *compile_stmt(ast_node *root, stack *symtabs, ac_virtual_memory
 
         if (!root->right || !keyword(root))
                 return syntax_error(root);
-$$
+        trace_point(TRACE_LEGACY, root);
         ast_node *stmt = root->right;
         switch (ast_keyword(stmt)) {
         case AST_ASSIGN:
@@ -1285,7 +2126,6 @@ $$
         case AST_WHILE:
                 return compile_while(root->right, symtabs, vm);
         case AST_CALL:
-$$
                 error = compile_call(root->right, symtabs, vm);
                 if (error)
                         return error;
@@ -1294,7 +2134,7 @@ $$
                 return success(root);
                 
         case AST_OUT:
-$$              error = compile_expr(stmt->right, symtabs, vm);
+                error = compile_expr(stmt->right, symtabs, vm);
                 if (error)
                         return syntax_error(root);
                 
@@ -1312,154 +2152,210 @@ $$              error = compile_expr(stmt->right, symtabs, vm);
         }
 }
 
-static ast_node *compile_define(ast_node *root, stack *symtabs, ac_virtual_memory *vm)
+/*
+ * Mask of rax-r15 registers changed by the code which may hold
+ * parameters: calls change all of them and idiv takes rdx.
+ */
+static unsigned clobbered_args(ast_node *root)
+{
+        if (!root)
+                return 0;
+
+        switch (keyword(root)) {
+        case AST_CALL:
+        case AST_IN:
+        case AST_OUT:
+                return ~0u;
+        case AST_POW:
+                if (!is_inline_pow(root))
+                        return ~0u;
+                break;
+        case AST_DIV:
+                if (!unary_operand(root))
+                        return 1u << IE64_RDX | clobbered_args(root->left) |
+                                                clobbered_args(root->right);
+                break;
+        default:
+                break;
+        }
+
+        return clobbered_args(root->left) | clobbered_args(root->right);
+}
+
+static bool is_indexed(ast_node *root, const char *ident)
+{
+        if (!root)
+                return false;
+
+        if (root->type == AST_NODE_IDENT && root->right && ast_ident(root) == ident)
+                return true;
+
+        return is_indexed(root->left, ident) || is_indexed(root->right, ident);
+}
+
+static ast_node *compile_define(ast_node *root, ac_symtab *symtabs, ac_virtual_memory *vm)
 {
         assert(vm);
         assert(root);
         assert(symtabs);
-$$
+        trace_point(TRACE_LEGACY, root);
         ast_node *error = nullptr;
         require(root, AST_DEFINE);
-$$
         ast_node *function = root->left;
         require(function, AST_FUNC);
-$$
         ast_node *name = function->left;
         require_ident(name);   
-$$
-        ac_symbol *func_sym = find_symbol(symtabs, ast_ident(name));
+        ac_symbol *func_sym = symtab_find(symtabs, ast_ident(name));
         if (!func_sym)
                 return syntax_error(root);
-$$
-        func_sym->offset = (ptrdiff_t)vm->secs[SEC_TEXT].size;
-$$
-        dump_symtab(symtabs);
+        func_sym->offset = rip(vm);
+        trace_dump(dump_symtab(symtabs));
+
+        if (symtab_push_scope(symtabs))
+                return syntax_error(root);
+        trace_dump(dump_symtab(symtabs));
 
-        array symtab = {};
-        push_stack(symtabs, &symtab);
-$$
-        dump_symtab(symtabs);
+        ptrdiff_t __sub_addr = compile_prologue(vm);
 
         ptrdiff_t n_params = func_sym->info;
-$$
+        ptrdiff_t n_regs   = (ptrdiff_t)arg_registers(func_sym);
+        unsigned clobbered = clobbered_args(root->right);
         ast_node *param = function->right;
         while (param) {
-$$
                 require_ident(param->right);
-                ac_symbol *param_sym = find_symbol(symtabs, ast_ident(param->right));
+                ac_symbol *param_sym = symtab_find(symtabs, ast_ident(param->right));
                 if (param_sym)
                         return syntax_error(root);
                 
+                /* The first parameter on the stack is at [rbp + 0x10] */
                 ac_symbol symbol = {
                         .type   = AC_SYM_VAR,
                         .vis    = AC_VIS_LOCAL,
                         .ident  = ast_ident(param->right),
                         .node   = name,
-                        .addend = (imm32)(8 * (n_params + 1)),
+                        .addend = (imm32)(8 * (n_params - n_regs + 1)),
                         .offset = 0,
                         .info   = 8,               
                 };
-$$  
-                array_push((array *)top_stack(symtabs), &symbol, sizeof(ac_symbol));
-$$
+
+                /* Register parameters stay there if the body keeps the
+                   register, otherwise they are stored to the frame.
+                   r8 and r9 hold operands, so they are never kept. */
+                if (n_params <= n_regs) {
+                        ubyte arg = ARG_REGISTERS[n_params - 1];
+                        if (arg < IE64_R8 && !(clobbered & (1u << arg)) &&
+                            !is_indexed(root->right, symbol.ident)) {
+                                symbol.reg = arg;
+                        } else {
+                                elf64_section *frame = vm->secs + SEC_NULL;
+                                frame->size += 8;
+                                symbol.addend = -(imm32)frame->size;
+
+                                struct __attribute__((packed)) {
+                                        ubyte rex          = 0x48; /* 1001000b */
+                                        const ubyte opcode = 0x89;
+                                        ie64_modrm modrm   = { .rm = IE64_RBP, .reg = 0b000, .mod = 0b10 };
+                                        imm32 imm          = 0;
+                                } __mov64;
+                                __mov64.rex      |= (ubyte)((arg >> 3) << 2);
+                                __mov64.modrm.reg = arg & 0x7;
+                                __mov64.imm       = symbol.addend;
+
+                                /* mov [rbp + imm], arg */
+                                emit(vm, &__mov64, sizeof(__mov64));
+                        }
+                }
+
+                if (!symtab_insert(symtabs, &symbol))
+                        return syntax_error(root);
+
                 n_params--;                            
 
                 param = param->left;
                 require(param, AST_PARAM);
         }
-$$
-        dump_symtab(symtabs);
+        trace_dump(dump_symtab(symtabs));
         if (n_params)
                 return syntax_error(root);
-$$
-        /* push rbp */
-        struct __attribute__((packed)) {
-                const ubyte opcode = 0x50 + IE64_RBP;
-        } __push;
-$$
-        emit(vm, &__push, sizeof(__push));
-$$
-        /* mov rbp, rsp */         
-        struct __attribute__((packed)) {
-                const ubyte rex    = 0x48;
-                const ubyte opcode = 0x89;
-                ie64_modrm modrm   = { .rm = IE64_RBP, .reg = IE64_RSP, .mod = 0b11 };         
-        } __mov64;
-$$
-        emit(vm, &__mov64, sizeof(__mov64));
-$$
-        struct __attribute__((packed)) {
-                const ubyte rex    = 0x48; /* 1001000b */
-                const ubyte opcode = 0x81;
-                ie64_modrm modrm   = { .rm = IE64_RSP, .reg = 0b101, .mod = 0b11 };
-                imm32 imm          = 0;
-        } __sub; 
 
-        ptrdiff_t __sub_addr = rip(vm);
-        emit(vm, &__sub, sizeof(__sub));
-$$
+        vm->tail.func   = ast_ident(name);
+        vm->tail.params = function->right;
+        vm->tail.acc_op = tail_accumulator(root);
+        if (vm->tail.acc_op != AST_NULL) {
+                elf64_section *frame = vm->secs + SEC_NULL;
+                frame->size += 8;
+                vm->tail.acc = -(imm32)frame->size;
+
+                struct __attribute__((packed)) {
+                        const ubyte rex    = 0x48; /* 1001000b */
+                        const ubyte opcode = 0xc7;
+                        ie64_modrm modrm   = { .rm = IE64_RBP, .reg = 0b000, .mod = 0b10 };
+                        imm32 disp         = 0;
+                        imm32 imm          = 0;
+                } __mov64;
+                __mov64.disp = vm->tail.acc;
+                __mov64.imm  = vm->tail.acc_op == AST_MUL;
+
+                /* mov qword [rbp + acc], 0 or 1 */
+                emit(vm, &__mov64, sizeof(__mov64));
+        }
+        vm->tail.body = rip(vm);
+
         error = compile_stmt(root->right, symtabs, vm);
-        if (error) {
-                free_array(&symtab, sizeof(ac_symbol));
+        if (error)
                 return error;
-        }
-$$
-        /* sub rbp, stack frame size */
-        __sub.imm = (imm32)elf64_align(vm->secs[SEC_NULL].size, 0x10);
-        patch(vm, __sub_addr, &__sub, sizeof(__sub));
 
-        pop_stack(symtabs);
-        free_array(&symtab, sizeof(ac_symbol));
-        section_free(vm->secs + SEC_NULL);
-$$      
+        vm->tail.func   = nullptr;
+        vm->tail.params = nullptr;
+        vm->tail.acc_op = AST_NULL;
+        compile_frame_size(vm, __sub_addr);
+
+        symtab_pop_scope(symtabs);
         return success(root);
 }
 
-static ast_node *declare_functions(ast_node *root, stack *symtabs)
+static ast_node *declare_functions(ast_node *root, ac_symtab *symtabs)
 {
         assert(root);
         assert(symtabs);
         
         ast_node *error = nullptr;
-$$
+        trace_point(TRACE_LEGACY, root);
         require(root, AST_STMT);
-$$
         if (root->left) {
                 error = declare_functions(root->left, symtabs);
                 if (error)
                         return error;                
         }
-$$
         ast_node *define = root->right;
         if (keyword(define) != AST_DEFINE)
                 return success(root);
-$$
         ast_node *function = define->left;
         require(function, AST_FUNC);
-$$
         ast_node *name = function->left;
         require_ident(name);
-$$        
-        ac_symbol *exist = find_symbol(symtabs, ast_ident(name));
+        ac_symbol *exist = symtab_find(symtabs, ast_ident(name));
         if (exist)
                 return syntax_error(name);
-$$
         ac_symbol symbol = {
-                .type  = AC_SYM_FUNC,
-                .vis   = AC_VIS_GLOBAL,
-                .ident = ast_ident(name),
-                .node  = define,
-                .info  = 0              
+                .type   = AC_SYM_FUNC,
+                .vis    = AC_VIS_GLOBAL,
+                .ident  = ast_ident(name),
+                .node   = define,
+                .addend = 0,
+                .offset = -1,   /* not compiled yet */
+                .info   = 0,
+                .leaf   = clobbered_args(define->right) != ~0u,
         };
-$$
         ast_node *param = function->right;
         while (param) {
                 symbol.info++;
                 param = param->left;
                 require(param, AST_PARAM);
         }
-$$
-        array_push((array *)bottom_stack(symtabs), &symbol, sizeof(ac_symbol));
+        if (!symtab_insert(symtabs, &symbol))
+                return syntax_error(name);
+
         return success(root);
 }
 
@@ -1473,24 +2369,6 @@ static int keyword(ast_node *node)
         return 0;
 }
 
-static ac_symbol *find_symbol(stack *symtabs, const char *ident)
-{
-        assert(ident);
-
-        for (size_t i = 0; i < symtabs->size; i++) {
-        
-                array *symtab = (array *)symtabs->items[i];
-                ac_symbol *symbols = (ac_symbol *)symtab->data;
-
-                for (size_t j = 0; j < symtab->size; j++) {
-                        if (ident == symbols[j].ident)
-                                return &symbols[j];                                        
-                }
-        } 
-
-        return nullptr;       
-}
-
 static ast_node *dump_code(ast_node *root)
 {
         assert(root);
@@ -1505,7 +2383,7 @@ static ast_node *syntax_error(ast_node *root)
         assert(root);
         fprintf(stderr, ascii(RED, "Syntax error:\n"));
         save_ast_tree(stderr, root);
-        $(dump_tree(root);)
+        trace_dump(dump_tree(root));
         fprintf(stderr, "\n");
         return root;
 }
@@ -1515,33 +2393,3 @@ static ast_node *success(ast_node *root)
         return nullptr;
 }
 
-
-static void dump_symtab(stack *symtabs) 
-{
-        assert(symtabs);
-$$        
-        fprintf(logs, html(BLUE, "---------------------------------\n"));
-        fprintf(logs, html(BLUE, "Assert compiler symbol table dump\n"));
-        fprintf(logs, html(BLUE, "---------------------------------\n"));
-
-        for (size_t i = 0; i < symtabs->size; i++) {
-
-                fprintf(logs, html(BLUE, "symtab[%lu]\n"), i);
-
-                array *symtab = (array *)symtabs->items[i];
-                ac_symbol *symbols = (ac_symbol *)symtab->data;
-
-                for (size_t j = 0; j < symtab->size; j++) {
-                        fprintf(logs, html(GREEN,"\tsymbol[%lu]:\n"), j);                                       
-                        fprintf(logs, "\t\ttype   = %d\n", symbols[j].type);                                       
-                        fprintf(logs, "\t\tvis    = %d\n", symbols[j].vis);                                       
-                        fprintf(logs, "\t\tident  = '%s'\n", symbols[j].ident);                                       
-                        fprintf(logs, "\t\tnode   = %p\n", symbols[j].node);                                       
-                        fprintf(logs, "\t\toffset = 0x%lx (%ld)\n", (size_t)symbols[j].offset, symbols[j].offset);                                       
-                        fprintf(logs, "\t\tinfo   = %ld\n", symbols[j].info);                                       
-                        fprintf(logs, "\t\taddend = 0x%lx (%d)\n\n", (size_t)symbols[j].addend, symbols[j].addend);                                       
-                }
-                
-                fprintf(logs, html(BLUE, "---------------------------------\n\n"));
-        } 
-}
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <iommap.h>
+#include <stats.h>
 #include <backend/legacy/elf64.h>
 #include <backend/legacy/backend.h>
 
@@ -521,6 +522,8 @@ void *section_alloc(elf64_section *sec, size_t size)
                         errno = saved_errno;
                         return nullptr;
                 }        
+
+                stats_alloc(allocated);
         }
 
         sec->allocated = allocated;
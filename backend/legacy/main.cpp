@@ -5,7 +5,8 @@
 #include <iommap.h>
 #include <assert.h>
 #include <string.h>
-#include <time.h>
+#include <stats.h>
+#include <trace.h>
 #include <errno.h>
 #include <stack.h>
 #include <ast/tree.h>
@@ -19,6 +20,16 @@ static int file_error(const char *file_name);
 
 int main(int argc, char *argv[])
 {
+        stats_format stats = STATS_NONE;
+        argc = stats_options(argc, argv, &stats);
+
+        /* Small leaf functions are inlined with -O */
+        bool optimize = argc > 1 && !strcmp(argv[1], "-O");
+        if (optimize) {
+                argc--;
+                argv++;
+        }
+
         if (argc != 3) {
                 fprintf(stderr, ascii(RED, "There must be 2 arguments\n"));
                 return EXIT_FAILURE;
@@ -27,61 +38,63 @@ int main(int argc, char *argv[])
         const char *src_file = argv[1];
         const char *out_file = argv[2];
 
-        clock_t start = clock();
+        size_t total = stats_begin("cum");
         mmap_data md = {0};
         int error = mmap_in(&md, src_file);
         if (error)
                 return EXIT_FAILURE;
 
-        array idents = {0};
-
-        ast_node *err = nullptr;
+        intern_table idents = {0};
 
-        elf64_section *secs = (elf64_section *)calloc(SEC_NUM, sizeof(elf64_section));
-        assert(secs);
+        ast_arena arena = {};
+        bind_ast_arena(&arena);
 
-        elf64_symbol *syms = (elf64_symbol *)calloc(SYM_NUM, sizeof(elf64_symbol));
-        assert(syms);
-
-        char *reader = md.buf;
-        ast_node *tree = read_ast_tree(&reader, &idents);
+        size_t phase = stats_begin("load_ast_tree");
+        ast_node *tree = load_ast_tree(md.buf, md.size, &idents);
+        stats_end(phase, arena.n_nodes, "nodes");
         mmap_free(&md);
-        if (!tree)
-                goto fail;
-
-        fill_sections_names(secs);
-        fill_symbols_info(secs, syms, out_file);
-
-        $(dump_tree(tree);)
-        err = compile_tree(tree, secs, syms);
-        if (err)
-                goto fail;
-
-        create_elf64(secs, syms, out_file);
-        
-fail:
-        for (size_t i = 0; i < SEC_NUM; i++)
-                if (secs[i].data)
-                        section_free(secs + i);
-
-        free(syms);
-        free(secs);
-        
-        char **data = (char **)idents.data;
-        for (size_t i = 0; i < idents.size; i++) {
-                free(data[i]);
+
+        /* Tree is saved as it was parsed, it's simplified here */
+        if (tree) {
+                size_t n_folded = 0;
+                phase = stats_begin("fold_tree");
+                tree = fold_tree(tree, &n_folded);
+                stats_end(phase, n_folded, "nodes folded");
+
+                if (optimize) {
+                        size_t n_inlined = 0;
+                        phase = stats_begin("inline_calls");
+                        tree = inline_calls(tree, &idents, INLINE_BUDGET, &n_inlined);
+                        stats_end(phase, n_inlined, "calls inlined");
+
+                        phase = stats_begin("fold_tree");
+                        tree = fold_tree(tree, &n_folded);
+                        stats_end(phase, n_folded, "nodes folded");
+                }
+
+                size_t n_dead = 0;
+                phase = stats_begin("eliminate_dead_code");
+                tree = eliminate_dead_code(tree, &n_dead);
+                stats_end(phase, n_dead, "nodes eliminated");
         }
 
-        free_array(&idents, sizeof(char *));
+        if (tree)
+                trace_dump(dump_tree(tree));
+        if (tree)
+                error = compile_elf64(tree, out_file);
 
-        clock_t end = clock();
+        free_intern(&idents);
+        free_ast_arena(&arena);
 
         if (!tree || error) {
                 fprintf(stderr, ascii(RED, "Compilation failed\n"));
                 return EXIT_FAILURE;
         }
 
-        fprintf(stderr, ascii(GREEN, "Compilation succeed: %lf sec\n"), (end - start) / CLOCKS_PER_SEC);
+        stats_end(total);
+        stats_report(stdout, stats);
+
+        fprintf(stderr, ascii(GREEN, "Compilation succeed\n"));
         return EXIT_SUCCESS;
 }
 
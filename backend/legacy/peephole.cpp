@@ -0,0 +1,775 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <logs.h>
+
+#include <backend/legacy/backend.h>
+#include <backend/legacy/peephole.h>
+
+/*
+ * Decoded form of the instructions compiler.cpp emits.
+ * Others (jumps, calls, syscall...) are never rewritten.
+ */
+struct ie64_insn {
+        ubyte rex       = 0;
+        bool  escape    = false;   /* 0x0f opcode prefix */
+        ubyte opcode    = 0;
+
+        bool  has_modrm = false;
+        ie64_modrm modrm = {};
+        bool  has_sib   = false;
+        ie64_sib sib    = {};
+
+        imm32 disp       = 0;
+        size_t disp_size = 0;
+        imm64 imm        = 0;
+        size_t imm_size  = 0;
+};
+
+static const ubyte REX   = 0x40;
+static const ubyte REX_W = 0x08;
+static const ubyte REX_R = 0x04;
+static const ubyte REX_X = 0x02;
+static const ubyte REX_B = 0x01;
+
+/* ALU opcodes with 'r/m, reg' operands and their /digit in 0x81 and 0x83 */
+static const struct {
+        ubyte opcode;
+        ubyte digit;
+} ALU_OPCODES[] = {
+        { 0x01, 0 },    /* add */
+        { 0x09, 1 },    /* or  */
+        { 0x21, 4 },    /* and */
+        { 0x29, 5 },    /* sub */
+        { 0x31, 6 },    /* xor */
+        { 0x39, 7 },    /* cmp */
+};
+
+static bool fits_imm8(imm64 value)
+{
+        return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static bool fits_imm32(imm64 value)
+{
+        return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+static imm64 read_signed(const ubyte *p, size_t size)
+{
+        switch (size) {
+        case 1:
+                return (imm8)p[0];
+        case 4: {
+                imm32 value = 0;
+                memcpy(&value, p, sizeof(value));
+                return value;
+        }
+        case 8: {
+                imm64 value = 0;
+                memcpy(&value, p, sizeof(value));
+                return value;
+        }
+        default:
+                return 0;
+        }
+}
+
+static bool decode(const ac_insn *insn, ie64_insn *d)
+{
+        assert(insn);
+        assert(d);
+
+        const ubyte *p   = insn->bytes;
+        const ubyte *end = insn->bytes + insn->size;
+        *d = {};
+
+        if (p < end && (*p & 0xf0) == REX)
+                d->rex = *p++;
+
+        if (p < end && *p == 0x0f) {
+                d->escape = true;
+                p++;
+        }
+
+        if (p >= end)
+                return false;
+
+        d->opcode = *p++;
+        if (d->escape) {
+                switch (d->opcode & 0xf0) {
+                case 0x40:      /* cmovcc */
+                case 0x90:      /* setcc */
+                        d->has_modrm = true;
+                        break;
+                default:
+                        /* imul, movzx */
+                        if (d->opcode != 0xaf && d->opcode != 0xb6)
+                                return false;
+                        d->has_modrm = true;
+                        break;
+                }
+        } else {
+                switch (d->opcode) {
+                case 0x01: case 0x03: case 0x09: case 0x21:
+                case 0x29: case 0x31: case 0x39: case 0x85:
+                case 0x89: case 0x8b:
+                        d->has_modrm = true;
+                        break;
+                case 0x6b: case 0x83: case 0xc1:
+                        d->has_modrm = true;
+                        d->imm_size  = 1;
+                        break;
+                case 0x69: case 0x81: case 0xc7:
+                        d->has_modrm = true;
+                        d->imm_size  = 4;
+                        break;
+                case 0x99:      /* cqo */
+                        break;
+                default:
+                        /* push r, pop r */
+                        if ((d->opcode & 0xf0) == 0x50)
+                                break;
+
+                        /* mov r, imm */
+                        if ((d->opcode & 0xf8) != 0xb8)
+                                return false;
+                        d->imm_size = d->rex & REX_W ? 8 : 4;
+                        break;
+                }
+        }
+
+        if (d->has_modrm) {
+                if (p >= end)
+                        return false;
+                d->modrm.byte = *p++;
+
+                if (d->modrm.mod != 0b11 && d->modrm.rm == 0b100) {
+                        if (p >= end)
+                                return false;
+                        d->has_sib  = true;
+                        d->sib.byte = *p++;
+                }
+
+                if (d->modrm.mod == 0b01)
+                        d->disp_size = 1;
+                else if (d->modrm.mod == 0b10)
+                        d->disp_size = 4;
+                else if (d->modrm.mod == 0b00 && (d->modrm.rm == 0b101 ||
+                                                 (d->has_sib && d->sib.base == 0b101)))
+                        d->disp_size = 4;
+        }
+
+        if ((size_t)(end - p) != d->disp_size + d->imm_size)
+                return false;
+
+        d->disp = (imm32)read_signed(p, d->disp_size);
+        d->imm  = read_signed(p + d->disp_size, d->imm_size);
+        return true;
+}
+
+static void encode(const ie64_insn *d, ac_insn *insn)
+{
+        assert(d);
+        assert(insn);
+
+        ubyte *p = insn->bytes;
+        if (d->rex)
+                *p++ = d->rex;
+        if (d->escape)
+                *p++ = 0x0f;
+        *p++ = d->opcode;
+
+        if (d->has_modrm)
+                *p++ = d->modrm.byte;
+        if (d->has_sib)
+                *p++ = d->sib.byte;
+
+        /* Little endian: low bytes of the values */
+        memcpy(p, &d->disp, d->disp_size);
+        p += d->disp_size;
+        memcpy(p, &d->imm, d->imm_size);
+        p += d->imm_size;
+
+        insn->size = (size_t)(p - insn->bytes);
+        assert(insn->size <= AC_INSN_MAX);
+}
+
+static int reg_operand(const ie64_insn *d)
+{
+        return d->modrm.reg | (d->rex & REX_R ? 0x08 : 0);
+}
+
+static int rm_operand(const ie64_insn *d)
+{
+        return d->modrm.rm | (d->rex & REX_B ? 0x08 : 0);
+}
+
+static bool is_memory(const ie64_insn *d)
+{
+        return d->has_modrm && d->modrm.mod != 0b11;
+}
+
+static void set_reg_operand(ie64_insn *d, int reg)
+{
+        d->modrm.reg = reg & 0x7;
+        d->rex = (ubyte)((d->rex & ~REX_R) | (reg & 0x08 ? REX_R : 0));
+}
+
+static void set_rm_register(ie64_insn *d, int reg)
+{
+        d->has_modrm = true;
+        d->modrm.mod = 0b11;
+        d->modrm.rm  = reg & 0x7;
+        d->rex = (ubyte)((d->rex & ~REX_B) | (reg & 0x08 ? REX_B : 0));
+}
+
+/*
+ * Copies the memory operand of 'from': modrm.rm, sib and displacement.
+ */
+static void set_rm_memory(ie64_insn *d, const ie64_insn *from)
+{
+        assert(is_memory(from));
+
+        d->has_modrm = true;
+        d->modrm.mod = from->modrm.mod;
+        d->modrm.rm  = from->modrm.rm;
+        d->has_sib   = from->has_sib;
+        d->sib       = from->sib;
+        d->disp      = from->disp;
+        d->disp_size = from->disp_size;
+        d->rex = (ubyte)((d->rex & ~(REX_X | REX_B)) | (from->rex & (REX_X | REX_B)));
+}
+
+static bool same_memory(const ie64_insn *a, const ie64_insn *b)
+{
+        return is_memory(a) && is_memory(b) &&
+               a->modrm.mod == b->modrm.mod && a->modrm.rm == b->modrm.rm &&
+               a->has_sib == b->has_sib && (!a->has_sib || a->sib.byte == b->sib.byte) &&
+               a->disp == b->disp && (a->rex & (REX_X | REX_B)) == (b->rex & (REX_X | REX_B));
+}
+
+/*
+ * The memory operand address depends on 'reg'.
+ */
+static bool memory_uses(const ie64_insn *d, int reg)
+{
+        if (!is_memory(d))
+                return false;
+
+        int base  = d->modrm.rm | (d->rex & REX_B ? 0x08 : 0);
+        if (d->has_sib) {
+                int index = d->sib.index | (d->rex & REX_X ? 0x08 : 0);
+                base      = d->sib.base  | (d->rex & REX_B ? 0x08 : 0);
+                if (index != IE64_RSP && index == reg)
+                        return true;
+                if (d->modrm.mod == 0b00 && d->sib.base == 0b101)
+                        return false;
+        } else if (d->modrm.mod == 0b00 && d->modrm.rm == 0b101) {
+                return false;
+        }
+
+        return base == reg;
+}
+
+/*
+ * Shortest encodings: disp8, imm8 and 32-bit immediates of mov.
+ */
+static void shorten(ie64_insn *d)
+{
+        if (d->has_modrm && d->modrm.mod == 0b10 && fits_imm8(d->disp)) {
+                d->modrm.mod = 0b01;
+                d->disp_size = 1;
+        }
+
+        if (!d->escape && (d->opcode == 0x81 || d->opcode == 0x69) && fits_imm8(d->imm)) {
+                d->opcode   = d->opcode == 0x81 ? 0x83 : 0x6b;
+                d->imm_size = 1;
+        }
+
+        /* movabs r, imm */
+        if (!d->escape && (d->opcode & 0xf8) == 0xb8 && d->imm_size == 8) {
+                if (d->imm >= 0 && d->imm <= (imm64)UINT32_MAX) {
+                        /* mov r32, imm32 is zero extended */
+                        d->rex &= (ubyte)~REX_W;
+                        if (d->rex == REX)
+                                d->rex = 0;
+                        d->imm_size = 4;
+                } else if (fits_imm32(d->imm)) {
+                        /* mov r, imm32 is sign extended */
+                        int reg = (d->opcode & 0x7) | (d->rex & REX_B ? 0x08 : 0);
+                        d->opcode    = 0xc7;
+                        d->modrm.reg = 0;
+                        set_rm_register(d, reg);
+                        d->imm_size  = 4;
+                }
+        }
+}
+
+static void make_mov_imm(ie64_insn *d, int reg, imm64 value)
+{
+        *d = {};
+        d->rex      = (ubyte)(REX | REX_W | (reg & 0x08 ? REX_B : 0));
+        d->opcode   = (ubyte)(0xb8 + (reg & 0x7));
+        d->imm      = value;
+        d->imm_size = 8;
+
+        shorten(d);
+}
+
+/*
+ * Matches 'mov reg, imm' in any encoding.
+ */
+static bool is_mov_imm(const ie64_insn *d, int *reg, imm64 *value)
+{
+        if (d->escape)
+                return false;
+
+        if ((d->opcode & 0xf8) == 0xb8) {
+                *reg   = (d->opcode & 0x7) | (d->rex & REX_B ? 0x08 : 0);
+                *value = d->imm_size == 8 ? d->imm : (imm64)(uint32_t)d->imm;
+                return true;
+        }
+
+        if (d->opcode == 0xc7 && d->modrm.mod == 0b11 && !d->modrm.reg) {
+                *reg   = rm_operand(d);
+                *value = d->rex & REX_W ? d->imm : (imm64)(uint32_t)d->imm;
+                return true;
+        }
+
+        return false;
+}
+
+/*
+ * Matches 64-bit 'mov reg, r/m' and 'mov r/m, reg'.
+ */
+static bool is_mov_load(const ie64_insn *d)
+{
+        return !d->escape && (d->rex & REX_W) && d->opcode == 0x8b;
+}
+
+static bool is_mov_store(const ie64_insn *d)
+{
+        return !d->escape && (d->rex & REX_W) && d->opcode == 0x89;
+}
+
+/*
+ * cmovcc and setcc read the flags. Moves neither read nor change them.
+ */
+static bool reads_flags(const ie64_insn *d)
+{
+        return d->escape && ((d->opcode & 0xf0) == 0x40 || (d->opcode & 0xf0) == 0x90);
+}
+
+static bool keeps_flags(const ie64_insn *d)
+{
+        if (d->escape)
+                return d->opcode == 0xb6;
+
+        return d->opcode == 0x89 || d->opcode == 0x8b || d->opcode == 0xc7 ||
+               d->opcode == 0x99 || (d->opcode & 0xf0) == 0x50 || (d->opcode & 0xf8) == 0xb8;
+}
+
+static bool clobbers_flags(const ac_insn *insn)
+{
+        ie64_insn d = {};
+        if (!decode(insn, &d)) {
+                /* Calls and returns leave the flags undefined */
+                ubyte opcode = insn->bytes[(insn->bytes[0] & 0xf0) == REX];
+                return opcode == 0xe8 || opcode == 0xc3;
+        }
+
+        if (reads_flags(&d) || keeps_flags(&d))
+                return false;
+
+        /* Shift by zero keeps the flags, rcl and rcr read the carry */
+        if (!d.escape && d.opcode == 0xc1)
+                return d.imm && d.modrm.reg != 0b010 && d.modrm.reg != 0b011;
+
+        /* adc and sbb read the carry */
+        if (!d.escape && (d.opcode == 0x81 || d.opcode == 0x83))
+                return d.modrm.reg != 0b010 && d.modrm.reg != 0b011;
+
+        return true;
+}
+
+static ac_insn *window_top(ac_peephole *peep, size_t depth)
+{
+        assert(depth < peep->size);
+        return peep->window + peep->size - depth - 1;
+}
+
+static void window_pop(ac_peephole *peep, size_t n)
+{
+        assert(n <= peep->size);
+        peep->size -= n;
+}
+
+static void window_push(ac_peephole *peep, elf64_section *text, const ac_insn *insn)
+{
+        if (peep->size == AC_PEEPHOLE_WINDOW) {
+                section_memcpy(text, peep->window[0].bytes, peep->window[0].size);
+                memmove(peep->window, peep->window + 1, sizeof(ac_insn) * (AC_PEEPHOLE_WINDOW - 1));
+                peep->size--;
+        }
+
+        peep->window[peep->size++] = *insn;
+}
+
+/*
+ * 'mov r, src' followed by 'mov dst, r' is 'mov dst, src'
+ * if r is not used later. Immediates are moved as well.
+ */
+static bool merge_moves(const ie64_insn *first, const ie64_insn *second, unsigned dead, ie64_insn *merged, bool *nop)
+{
+        int src = -1;
+        if (is_mov_store(second))
+                src = reg_operand(second);
+        else if (is_mov_load(second) && !is_memory(second))
+                src = rm_operand(second);
+        else
+                return false;
+
+        if (src < IE64_R8 || !(dead & (1u << (src - IE64_R8))) || memory_uses(second, src))
+                return false;
+
+        /* Destination is r/m of the store or the register of the load */
+        bool dst_memory = is_mov_store(second) && is_memory(second);
+        int  dst = is_mov_store(second) ? rm_operand(second) : reg_operand(second);
+
+        int reg = -1;
+        imm64 value = 0;
+        if (is_mov_imm(first, &reg, &value)) {
+                if (reg != src)
+                        return false;
+
+                if (!dst_memory) {
+                        make_mov_imm(merged, dst, value);
+                        return true;
+                }
+
+                if (!fits_imm32(value))
+                        return false;
+
+                /* mov qword [mem], imm32 */
+                *merged = {};
+                merged->rex      = REX | REX_W;
+                merged->opcode   = 0xc7;
+                merged->imm      = value;
+                merged->imm_size = 4;
+                set_rm_memory(merged, second);
+                shorten(merged);
+                return true;
+        }
+
+        *merged = {};
+        merged->rex = REX | REX_W;
+        if (is_mov_load(first) && reg_operand(first) == src) {
+                /* mov r, [mem] or mov r, reg */
+                if (dst_memory && is_memory(first))
+                        return false;
+
+                if (is_memory(first)) {
+                        merged->opcode = 0x8b;
+                        set_reg_operand(merged, dst);
+                        set_rm_memory(merged, first);
+                        shorten(merged);
+                        return true;
+                }
+
+                src = rm_operand(first);
+        } else if (is_mov_store(first) && !is_memory(first) && rm_operand(first) == src) {
+                src = reg_operand(first);
+        } else {
+                return false;
+        }
+
+        /* Register is moved to itself */
+        if (!dst_memory && dst == src) {
+                *nop = true;
+                return true;
+        }
+
+        merged->opcode = 0x89;
+        set_reg_operand(merged, src);
+        if (dst_memory)
+                set_rm_memory(merged, second);
+        else
+                set_rm_register(merged, dst);
+
+        shorten(merged);
+        return true;
+}
+
+/*
+ * 'mov r, imm' followed by 'op dst, r' is 'op dst, imm' if r is not used later.
+ */
+static bool merge_imm(const ie64_insn *first, const ie64_insn *second, unsigned dead, ie64_insn *merged)
+{
+        int reg = -1;
+        imm64 value = 0;
+        if (!is_mov_imm(first, &reg, &value) || !fits_imm32(value))
+                return false;
+
+        if (reg < IE64_R8 || !(dead & (1u << (reg - IE64_R8))) || second->modrm.mod != 0b11)
+                return false;
+
+        *merged = {};
+        merged->rex      = REX | REX_W;
+        merged->imm      = value;
+        merged->imm_size = 4;
+
+        /* imul dst, r */
+        if (second->escape && second->opcode == 0xaf) {
+                int dst = reg_operand(second);
+                if (rm_operand(second) != reg || dst == reg)
+                        return false;
+
+                /* imul dst, dst, imm32 */
+                merged->opcode = 0x69;
+                set_reg_operand(merged, dst);
+                set_rm_register(merged, dst);
+                shorten(merged);
+                return true;
+        }
+
+        if (second->escape || reg_operand(second) != reg || rm_operand(second) == reg)
+                return false;
+
+        for (const auto &alu : ALU_OPCODES) {
+                if (alu.opcode != second->opcode)
+                        continue;
+
+                /* op dst, imm32 */
+                merged->opcode = 0x81;
+                merged->modrm.reg = alu.digit & 0x7;
+                set_rm_register(merged, rm_operand(second));
+                shorten(merged);
+                return true;
+        }
+
+        return false;
+}
+
+/*
+ * Comparison result is made by 'cmov r, rax' of the preloaded 0 and 1,
+ * setcc does it without the immediates.
+ */
+static bool merge_setcc(const ie64_insn *one, const ie64_insn *zero, const ie64_insn *cmov,
+                        ie64_insn *setcc, ie64_insn *movzx)
+{
+        if (!cmov->escape || (cmov->opcode & 0xf0) != 0x40 || cmov->modrm.mod != 0b11 ||
+            rm_operand(cmov) != IE64_RAX)
+                return false;
+
+        int reg = reg_operand(cmov);
+        int one_reg = -1, zero_reg = -1;
+        imm64 one_value = 0, zero_value = 0;
+        if (!is_mov_imm(one,  &one_reg,  &one_value)  || one_reg  != IE64_RAX || one_value  != 1 ||
+            !is_mov_imm(zero, &zero_reg, &zero_value) || zero_reg != reg      || zero_value != 0 ||
+            reg == IE64_RAX)
+                return false;
+
+        /* setcc al */
+        *setcc = {};
+        setcc->escape = true;
+        setcc->opcode = (ubyte)(0x90 | (cmov->opcode & 0x0f));
+        set_rm_register(setcc, IE64_RAX);
+
+        /* movzx r32, al */
+        *movzx = {};
+        movzx->escape = true;
+        movzx->opcode = 0xb6;
+        set_reg_operand(movzx, reg);
+        set_rm_register(movzx, IE64_RAX);
+        if (movzx->rex)
+                movzx->rex |= REX;
+
+        return true;
+}
+
+/*
+ * Tries to merge 'next' with the last instructions of the window.
+ * Returns true if 'next' is changed and has to be matched again.
+ * 'next->size' is zero if there is nothing left to emit.
+ */
+static bool combine(ac_peephole *peep, elf64_section *text, ac_insn *next)
+{
+        ie64_insn second = {};
+        if (!peep->size || !decode(next, &second))
+                return false;
+
+        /* mov r, r */
+        if ((is_mov_load(&second) || is_mov_store(&second)) && !is_memory(&second) &&
+            reg_operand(&second) == rm_operand(&second)) {
+                next->size = 0;
+                return false;
+        }
+
+        ie64_insn first = {};
+        if (!decode(window_top(peep, 0), &first))
+                return false;
+
+        ie64_insn merged = {};
+        bool nop = false;
+        if (merge_moves(&first, &second, next->dead, &merged, &nop) ||
+            merge_imm  (&first, &second, next->dead, &merged)) {
+                window_pop(peep, 1);
+                if (nop) {
+                        next->size = 0;
+                        return false;
+                }
+
+                encode(&merged, next);
+                return true;
+        }
+
+        /* mov [mem], r followed by mov r', [mem] loads r */
+        if (is_mov_store(&first) && is_mov_load(&second) && same_memory(&first, &second)) {
+                merged = {};
+                merged.rex    = REX | REX_W;
+                merged.opcode = 0x89;
+                set_reg_operand(&merged, reg_operand(&first));
+                set_rm_register(&merged, reg_operand(&second));
+                encode(&merged, next);
+                return true;
+        }
+
+        ie64_insn one = {};
+        if (peep->size < 2 || !decode(window_top(peep, 1), &one))
+                return false;
+
+        ie64_insn movzx = {};
+        if (merge_setcc(&one, &first, &second, &merged, &movzx)) {
+                ac_insn setcc = {};
+                encode(&merged, &setcc);
+                window_pop(peep, 2);
+                window_push(peep, text, &setcc);
+
+                encode(&movzx, next);
+                return true;
+        }
+
+        return false;
+}
+
+/*
+ * 'mov r, 0' is 'xor r32, r32' if nothing reads flags before
+ * 'next' clobbers them.
+ */
+static void zero_registers(ac_peephole *peep, const ac_insn *next)
+{
+        if (!clobbers_flags(next))
+                return;
+
+        for (size_t depth = 0; depth < peep->size; depth++) {
+                ac_insn *insn = window_top(peep, depth);
+                ie64_insn d = {};
+                if (!decode(insn, &d) || !keeps_flags(&d))
+                        return;
+
+                int reg = -1;
+                imm64 value = 0;
+                if (!is_mov_imm(&d, &reg, &value) || value)
+                        continue;
+
+                /* xor r32, r32 */
+                ie64_insn xor32 = {};
+                xor32.opcode = 0x31;
+                set_reg_operand(&xor32, reg);
+                set_rm_register(&xor32, reg);
+                if (xor32.rex)
+                        xor32.rex |= REX;
+
+                unsigned dead = insn->dead;
+                encode(&xor32, insn);
+                insn->dead = dead;
+        }
+}
+
+void peephole_emit(ac_peephole *peep, elf64_section *text, const void *insn,
+                   size_t size, unsigned dead, bool pinned)
+{
+        assert(peep);
+        assert(text);
+        assert(insn);
+        assert(size <= AC_INSN_MAX);
+
+        if (!peep->enabled) {
+                section_memcpy(text, insn, size);
+                return;
+        }
+
+        ac_insn next = {};
+        memcpy(next.bytes, insn, size);
+        next.size = size;
+        next.dead = dead;
+
+        if (pinned) {
+                zero_registers(peep, &next);
+                peephole_flush(peep, text);
+                section_memcpy(text, insn, size);
+                return;
+        }
+
+        ie64_insn d = {};
+        if (decode(&next, &d)) {
+                shorten(&d);
+                encode(&d, &next);
+        }
+
+        while (combine(peep, text, &next))
+                ;
+
+        if (!next.size)
+                return;
+
+        zero_registers(peep, &next);
+        window_push(peep, text, &next);
+}
+
+ubyte peephole_branch(ac_peephole *peep, ubyte opcode)
+{
+        assert(peep);
+        assert(opcode == 0x84 || opcode == 0x85);
+
+        if (!peep->enabled || peep->size < 3)
+                return opcode;
+
+        ie64_insn setcc = {}, movzx = {}, test = {};
+        if (!decode(window_top(peep, 2), &setcc) ||
+            !decode(window_top(peep, 1), &movzx) ||
+            !decode(window_top(peep, 0), &test))
+                return opcode;
+
+        if (!setcc.escape || (setcc.opcode & 0xf0) != 0x90 || rm_operand(&setcc) != IE64_RAX)
+                return opcode;
+
+        if (!movzx.escape || movzx.opcode != 0xb6 || movzx.modrm.mod != 0b11 ||
+            rm_operand(&movzx) != IE64_RAX)
+                return opcode;
+
+        /* test r, r of the last use of r */
+        int reg = reg_operand(&movzx);
+        if (test.escape || test.opcode != 0x85 || test.modrm.mod != 0b11 ||
+            reg_operand(&test) != reg || rm_operand(&test) != reg || reg < IE64_R8 ||
+            !(window_top(peep, 0)->dead & (1u << (reg - IE64_R8))))
+                return opcode;
+
+        window_pop(peep, 3);
+
+        /* je jumps if the condition is false */
+        ubyte cc = setcc.opcode & 0x0f;
+        return (ubyte)(0x80 | (opcode == 0x84 ? cc ^ 1 : cc));
+}
+
+void peephole_flush(ac_peephole *peep, elf64_section *text)
+{
+        assert(peep);
+        assert(text);
+
+        for (size_t i = 0; i < peep->size; i++)
+                section_memcpy(text, peep->window[i].bytes, peep->window[i].size);
+
+        peep->size = 0;
+}
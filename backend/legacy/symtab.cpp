@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <logs.h>
+#include <stats.h>
+
+#include <backend/legacy/backend.h>
+#include <backend/legacy/symtab.h>
+
+static const size_t INIT_CAPACITY = 64;
+
+struct ac_symtab_entry {
+        ac_symbol sym     = {};
+        ptrdiff_t shadowed = -1;  /* entry with the same name in the outer scope */
+};
+
+static inline ac_symtab_entry *entries(ac_symtab *tab)
+{
+        return (ac_symtab_entry *)tab->entries.data;
+}
+
+/*
+ * Names are interned, so the pointer itself is the key.
+ */
+static inline size_t ident_hash(const char *ident)
+{
+        uint64_t key = (uintptr_t)ident;
+        return (size_t)((key * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+static ac_symtab_slot *find_slot(ac_symtab_slot *slots, size_t capacity, const char *ident)
+{
+        size_t mask = capacity - 1;
+        size_t i = ident_hash(ident) & mask;
+        while (slots[i].ident && slots[i].ident != ident)
+                i = (i + 1) & mask;
+
+        return slots + i;
+}
+
+static ac_symtab_slot *realloc_symtab(ac_symtab *tab, size_t capacity)
+{
+        assert(tab);
+        assert(!(capacity & (capacity - 1)));
+
+        ac_symtab_slot *slots = (ac_symtab_slot *)calloc(capacity, sizeof(ac_symtab_slot));
+        if (!slots) {
+                perror("Can't realloc symbol table");
+                return nullptr;
+        }
+
+        stats_alloc(capacity * sizeof(ac_symtab_slot));
+
+        for (size_t i = 0; i < capacity; i++)
+                slots[i].top = -1;
+
+        for (size_t i = 0; i < tab->capacity; i++) {
+                if (tab->slots[i].ident)
+                        *find_slot(slots, capacity, tab->slots[i].ident) = tab->slots[i];
+        }
+
+        free(tab->slots);
+
+        tab->slots    = slots;
+        tab->capacity = capacity;
+
+        return slots;
+}
+
+int symtab_push_scope(ac_symtab *tab)
+{
+        assert(tab);
+
+        size_t begin = tab->entries.size;
+        return array_push(&tab->scopes, &begin, sizeof(size_t)) ? 0 : -1;
+}
+
+void symtab_pop_scope(ac_symtab *tab)
+{
+        assert(tab && tab->scopes.size);
+
+        size_t begin = *(size_t *)array_top(&tab->scopes, sizeof(size_t));
+        array_pop(&tab->scopes, sizeof(size_t));
+
+        /* Undo the scope declarations, the latest goes first */
+        ac_symtab_entry *entry = entries(tab);
+        for (size_t i = tab->entries.size; i > begin; i--) {
+                ac_symtab_slot *slot = find_slot(tab->slots, tab->capacity, entry[i - 1].sym.ident);
+                slot->top = entry[i - 1].shadowed;
+        }
+
+        tab->entries.size = begin;
+}
+
+size_t symtab_depth(const ac_symtab *tab)
+{
+        assert(tab);
+        return tab->scopes.size;
+}
+
+ac_symbol *symtab_insert(ac_symtab *tab, const ac_symbol *sym)
+{
+        assert(tab && tab->scopes.size);
+        assert(sym && sym->ident);
+
+        /* Keep load factor under 1/2. Names are never removed from slots. */
+        if (2 * (tab->n_idents + 1) > tab->capacity) {
+                if (!realloc_symtab(tab, tab->capacity ? 2 * tab->capacity : INIT_CAPACITY))
+                        return nullptr;
+        }
+
+        ac_symtab_slot *slot = find_slot(tab->slots, tab->capacity, sym->ident);
+
+        ac_symtab_entry entry = {};
+        entry.sym      = *sym;
+        entry.shadowed = slot->top;
+
+        if (!array_push(&tab->entries, &entry, sizeof(ac_symtab_entry)))
+                return nullptr;
+
+        if (!slot->ident) {
+                slot->ident = sym->ident;
+                tab->n_idents++;
+        }
+
+        slot->top = (ptrdiff_t)tab->entries.size - 1;
+        return &entries(tab)[slot->top].sym;
+}
+
+ac_symbol *symtab_find(ac_symtab *tab, const char *ident)
+{
+        assert(tab);
+        assert(ident);
+
+        if (!tab->capacity)
+                return nullptr;
+
+        ac_symtab_slot *slot = find_slot(tab->slots, tab->capacity, ident);
+        if (slot->top < 0)
+                return nullptr;
+
+        return &entries(tab)[slot->top].sym;
+}
+
+ac_symbol *symtab_symbol(ac_symtab *tab, size_t n)
+{
+        assert(tab && n < tab->entries.size);
+        return &entries(tab)[n].sym;
+}
+
+size_t symtab_scope_begin(const ac_symtab *tab, size_t depth)
+{
+        assert(tab && depth < tab->scopes.size);
+        return ((size_t *)tab->scopes.data)[depth];
+}
+
+size_t symtab_size(const ac_symtab *tab)
+{
+        assert(tab);
+        return tab->entries.size;
+}
+
+void free_symtab(ac_symtab *tab)
+{
+        assert(tab);
+
+        free_array(&tab->entries, sizeof(ac_symtab_entry));
+        free_array(&tab->scopes,  sizeof(size_t));
+        free(tab->slots);
+
+        tab->slots    = nullptr;
+        tab->capacity = 0;
+        tab->n_idents = 0;
+}
+
+void dump_symtab(ac_symtab *tab)
+{
+        assert(tab);
+
+        fprintf(logs, html(BLUE, "---------------------------------\n"));
+        fprintf(logs, html(BLUE, "Assert compiler symbol table dump\n"));
+        fprintf(logs, html(BLUE, "---------------------------------\n"));
+
+        for (size_t i = 0; i < tab->scopes.size; i++) {
+
+                fprintf(logs, html(BLUE, "symtab[%lu]\n"), i);
+
+                size_t end = i + 1 < tab->scopes.size ? symtab_scope_begin(tab, i + 1) : tab->entries.size;
+                for (size_t j = symtab_scope_begin(tab, i); j < end; j++) {
+                        const ac_symbol *sym = symtab_symbol(tab, j);
+                        fprintf(logs, html(GREEN,"\tsymbol[%lu]:\n"), j);
+                        fprintf(logs, "\t\ttype   = %d\n", sym->type);
+                        fprintf(logs, "\t\tvis    = %d\n", sym->vis);
+                        fprintf(logs, "\t\tident  = '%s'\n", sym->ident);
+                        fprintf(logs, "\t\tnode   = %p\n", sym->node);
+                        fprintf(logs, "\t\toffset = 0x%lx (%ld)\n", (size_t)sym->offset, sym->offset);
+                        fprintf(logs, "\t\tinfo   = %ld\n", sym->info);
+                        fprintf(logs, "\t\taddend = 0x%lx (%d)\n\n", (size_t)sym->addend, sym->addend);
+                }
+
+                fprintf(logs, html(BLUE, "---------------------------------\n\n"));
+        }
+}
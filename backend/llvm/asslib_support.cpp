@@ -1,3 +1,5 @@
+#include <cstdint>
+#include <cstdio>
 #include "asslib_support.h"
 
 #define ASS_STDLIB(AST_ID, ID, NAME, ARGS) NAME,
@@ -11,3 +13,73 @@ get_asslib_ident( AsslibID id)
 {
     return kAsslibIdents[id];
 }
+
+//
+// In-process ASSLIB for JIT. Must behave the same way as asslib-llvm.c
+//
+static uint64_t
+asslib_print( uint64_t value)
+{
+    std::printf( "%ld\n", static_cast<int64_t>( value));
+    return 0;
+}
+
+static uint64_t
+asslib_scan()
+{
+    int64_t value = 0;
+    if ( std::scanf( "%ld", &value) != 1 )
+    {
+        return 0;
+    }
+
+    return static_cast<uint64_t>( value);
+}
+
+static uint64_t
+asslib_pow( uint64_t base, uint64_t exp)
+{
+    // Negative exponent gives 1 / base^n truncated toward zero
+    if ( static_cast<int64_t>( exp) < 0 )
+    {
+        if ( base == 1 )
+        {
+            return 1;
+        }
+
+        if ( static_cast<int64_t>( base) == -1 )
+        {
+            return exp & 1 ? base : 1;
+        }
+
+        return 0;
+    }
+
+    uint64_t result = 1;
+    for ( ; exp; exp >>= 1 )
+    {
+        if ( exp & 1 )
+        {
+            result *= base;
+        }
+
+        base *= base;
+    }
+
+    return result;
+}
+
+uintptr_t
+get_asslib_address( AsslibID id)
+{
+    switch ( id ) {
+    case ASSLIB_PRINT:
+        return reinterpret_cast<uintptr_t>( &asslib_print);
+    case ASSLIB_SCAN:
+        return reinterpret_cast<uintptr_t>( &asslib_scan);
+    case ASSLIB_POW:
+        return reinterpret_cast<uintptr_t>( &asslib_pow);
+    default:
+        return 0;
+    }
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstdint>
 
 // Compile standard ASSLIB library functions
 #define ASS_STDLIB(AST_ID, ID, NAME, ARGS) ASSLIB_##ID,
@@ -9,3 +10,6 @@ enum AsslibID
 #undef ASS_STDLIB
 
 const char* get_asslib_ident( AsslibID id);
+
+// Address of the function implementation inside the compiler process
+uintptr_t get_asslib_address( AsslibID id);
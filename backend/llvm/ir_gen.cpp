@@ -1,16 +1,26 @@
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Support/Host.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Target/TargetOptions.h"
 #include <memory>
 #include <iostream>
 #include "logs.h"
+#include "stats.h"
+#include "trace.h"
 #include "ast/tree.h"
 #include "ast/keyword.h"
 #include "backend/llvm/ir_gen.h"
@@ -18,6 +28,9 @@
 
 static const char* kGlobalsInitIdent = "__ass_globals_init";
 
+// Exponents below are raised to the power inline, others call ASSLIB
+static const uint64_t kPowInlineMax = 64;
+
 static int
 keyword( const ast_node *node)
 {
@@ -68,53 +81,223 @@ ident( const ast_node *node)
 }
 
 void
-IRGenerator::compile( const ast_node* root,
-                      llvm::raw_fd_ostream& os)
+IRGenerator::compile( const ast_node* root)
 {
+    size_t phase = stats_begin( "IRGenerator::compile");
+
+    // Passes and code generator need to know the target
+    init_target();
+
     // Generate globals initializer
-    llvm::FunctionType *type = llvm::FunctionType::get( llvm::Type::getVoidTy( context_), false);
+    llvm::FunctionType *type = llvm::FunctionType::get( llvm::Type::getVoidTy( *context_), false);
     llvm::FunctionCallee init_globals = module_->getOrInsertFunction( kGlobalsInitIdent, type);
     llvm::Function *globals_init = module_->getFunction( kGlobalsInitIdent);
 
     assert( globals_init );
 
-    llvm::BasicBlock *bb = llvm::BasicBlock::Create( context_, ".entry", globals_init);
+    llvm::BasicBlock *bb = llvm::BasicBlock::Create( *context_, ".entry", globals_init);
     builder_->SetInsertPoint( bb);
 
     declare_stdlib();
     declare_functions( root);
 
     // Insert global scope
-    scopes_.emplace_back();
+    scopes_.push_scope();
     compile_stmt( root);
 
-    // Compile globals initialization code
-    if ( scopes_.front().size() > 0 )
+    //
+    // Globals are initialized at the very beginning of main. The call is
+    // placed right into the entry block, so that its allocas stay there.
+    //
+    if ( scopes_.scope_size() > 0 )
     {
         std::string entry = "main";
         llvm::Function *main = module_->getFunction( entry);
-        assert( main);
+        if ( !main || main->empty() )
+        {
+            throw std::runtime_error{ "main function is not defined"};
+        }
 
         llvm::BasicBlock* entry_bb = &main->getEntryBlock();
-        llvm::BasicBlock* prepare_bb = llvm::BasicBlock::Create( context_, ".prepare", main, entry_bb);
-
-        builder_->SetInsertPoint( prepare_bb);
+        builder_->SetInsertPoint( entry_bb, entry_bb->getFirstInsertionPt());
         builder_->CreateCall( init_globals);
-        builder_->CreateBr( entry_bb);
-
     }
 
     builder_->SetInsertPoint( &globals_init->back());
     builder_->CreateRetVoid();
 
-    scopes_.pop_back();
+    scopes_.pop_scope();
+
+    assert( scopes_.depth() == 0 );
+
+    std::string error;
+    llvm::raw_string_ostream error_os{ error};
+    if ( llvm::verifyModule( *module_, &error_os) )
+    {
+        throw std::runtime_error{ "invalid module: " + error_os.str()};
+    }
+
+    stats_end( phase, module_->getInstructionCount(), "instructions");
+}
+
+void
+IRGenerator::init_target()
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    std::string triple = llvm::sys::getDefaultTargetTriple();
+    std::string error;
+
+    const llvm::Target* target = llvm::TargetRegistry::lookupTarget( triple, error);
+    if ( !target )
+    {
+        throw std::runtime_error{ "can't find target: " + error};
+    }
+
+    // Objects are linked by gcc, which produces PIE by default
+    target_.reset( target->createTargetMachine( triple, llvm::sys::getHostCPUName(), "",
+                                                llvm::TargetOptions{}, llvm::Reloc::PIC_));
+    if ( !target_ )
+    {
+        throw std::runtime_error{ "can't create target machine"};
+    }
+
+    module_->setTargetTriple( triple);
+    module_->setDataLayout( target_->createDataLayout());
+}
+
+void
+IRGenerator::optimize( unsigned level)
+{
+    if ( level == 0 )
+    {
+        return;
+    }
+
+    static const llvm::OptimizationLevel levels[] = {
+        llvm::OptimizationLevel::O1,
+        llvm::OptimizationLevel::O2,
+        llvm::OptimizationLevel::O3,
+    };
+
+    if ( level > sizeof levels / sizeof levels[0] )
+    {
+        throw std::out_of_range{ "invalid optimization level"};
+    }
+
+    llvm::LoopAnalysisManager     lam{};
+    llvm::FunctionAnalysisManager fam{};
+    llvm::CGSCCAnalysisManager    cgam{};
+    llvm::ModuleAnalysisManager   mam{};
+
+    llvm::PassBuilder builder{ target_.get()};
+    builder.registerModuleAnalyses( mam);
+    builder.registerCGSCCAnalyses( cgam);
+    builder.registerFunctionAnalyses( fam);
+    builder.registerLoopAnalyses( lam);
+    builder.crossRegisterProxies( lam, fam, cgam, mam);
+
+    //
+    // Default pipeline starts with SROA and mem2reg, that is why
+    // all locals must be allocated in the entry block.
+    //
+    size_t phase = stats_begin( "IRGenerator::optimize");
 
-    assert( scopes_.size() == 0 );
+    llvm::ModulePassManager mpm = builder.buildPerModuleDefaultPipeline( levels[level - 1]);
+    mpm.run( *module_, mam);
 
-    module_->print(os, nullptr);
+    stats_end( phase, module_->getInstructionCount(), "instructions");
+}
+
+void
+IRGenerator::print( llvm::raw_ostream& os) const
+{
+    module_->print( os, nullptr);
     os.flush();
 }
 
+void
+IRGenerator::emit_object( llvm::raw_pwrite_stream& os)
+{
+    assert( target_ );
+
+    // Code generator is still driven by the legacy pass manager
+    llvm::legacy::PassManager manager{};
+    if ( target_->addPassesToEmitFile( manager, os, nullptr, llvm::CGFT_ObjectFile) )
+    {
+        throw std::runtime_error{ "target can't emit object file"};
+    }
+
+    manager.run( *module_);
+    os.flush();
+}
+
+int64_t
+IRGenerator::run()
+{
+    auto check = []( llvm::Error error)
+    {
+        if ( error )
+        {
+            throw std::runtime_error{ "JIT failed: " + llvm::toString( std::move( error))};
+        }
+    };
+
+    llvm::Expected<std::unique_ptr<llvm::orc::LLJIT>> jit = llvm::orc::LLJITBuilder{}.create();
+    check( jit.takeError());
+
+    llvm::orc::JITDylib& dylib = (*jit)->getMainJITDylib();
+    llvm::orc::MangleAndInterner mangle{ (*jit)->getExecutionSession(), (*jit)->getDataLayout()};
+
+    // ASSLIB is resolved to the compiler's own implementation
+#define ASS_STDLIB( AST_ID, ID, NAME, ARGS ) ASSLIB_##ID,
+    static const AsslibID kAsslib[] = {
+#include "../../STDLIB"
+    };
+#undef ASS_STDLIB
+
+    llvm::orc::SymbolMap symbols{};
+    for ( AsslibID id : kAsslib )
+    {
+        symbols[mangle( get_asslib_ident( id))] = llvm::JITEvaluatedSymbol{
+            get_asslib_address( id),
+            llvm::JITSymbolFlags::Exported
+        };
+    }
+
+    check( dylib.define( llvm::orc::absoluteSymbols( std::move( symbols))));
+
+    // Optimized code may call libc functions (memset, memcpy...)
+    auto process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+                       (*jit)->getDataLayout().getGlobalPrefix());
+    check( process.takeError());
+    dylib.addGenerator( std::move( *process));
+
+    // Builder refers to the context, which now belongs to JIT
+    builder_.reset();
+    check( (*jit)->addIRModule( llvm::orc::ThreadSafeModule{ std::move( module_), std::move( context_)}));
+
+    llvm::Expected<llvm::JITEvaluatedSymbol> main = (*jit)->lookup( "main");
+    check( main.takeError());
+
+    auto entry = reinterpret_cast<int64_t (*)()>( main->getAddress());
+    int64_t result = entry();
+
+    std::fflush( stdout);
+    return result;
+}
+
+llvm::AllocaInst*
+IRGenerator::create_entry_alloca( llvm::Type* type)
+{
+    llvm::Function* function = builder_->GetInsertBlock()->getParent();
+    llvm::BasicBlock& entry = function->getEntryBlock();
+
+    llvm::IRBuilder<> builder{ &entry, entry.begin()};
+    return builder.CreateAlloca( type);
+}
+
 void
 IRGenerator::declare_functions( const ast_node* root)
 {
@@ -157,11 +340,11 @@ IRGenerator::declare_functions( const ast_node* root)
           param != nullptr;
           param = param->left )
     {
-        arg_types.push_back( llvm::Type::getInt64Ty( context_));
+        arg_types.push_back( llvm::Type::getInt64Ty( *context_));
     }
 
     // According to the AST standard each function must return integer.
-    llvm::FunctionType *type = llvm::FunctionType::get( llvm::Type::getInt64Ty( context_),
+    llvm::FunctionType *type = llvm::FunctionType::get( llvm::Type::getInt64Ty( *context_),
                                                         std::move( arg_types), false);
     module_->getOrInsertFunction( name, type);
 }
@@ -170,6 +353,7 @@ llvm::Value*
 IRGenerator::compile_stmt( const ast_node* root)
 {
     assert( root );
+    trace_point( TRACE_LLVM, root);
 
     if ( root->left )
     {
@@ -181,7 +365,7 @@ IRGenerator::compile_stmt( const ast_node* root)
     }
 
     ast_node *stmt = root->right;
-    dump_tree( stmt);
+    trace_dump( dump_tree( stmt));
     switch ( ast_keyword( stmt) ) {
     case AST_ASSIGN:
         return compile_assign( stmt);
@@ -210,6 +394,7 @@ llvm::Value*
 IRGenerator::compile_call( const ast_node* root)
 {
     assert( root);
+    trace_point( TRACE_LLVM, root);
 
     llvm::Function *function = module_->getFunction( ident( root->left));
     if ( !function )
@@ -253,6 +438,7 @@ llvm::Value*
 IRGenerator::compile_define( const ast_node* root)
 {
     assert( root);
+    trace_point( TRACE_LLVM, root);
 
     ast_node *func_node = root->left;
     if ( keyword( func_node) != AST_FUNC )
@@ -265,28 +451,57 @@ IRGenerator::compile_define( const ast_node* root)
     assert( function && "It is an assert! All functions must be declared!");
 
     // Create a new basic block to start insertion into.
-    llvm::BasicBlock *bb = llvm::BasicBlock::Create( context_, ".entry", function);
+    llvm::BasicBlock *bb = llvm::BasicBlock::Create( *context_, ".entry", function);
     builder_->SetInsertPoint( bb);
 
-    Scope& scope = scopes_.emplace_back();
+    scopes_.push_scope();
+
+    tail_ = TailCalls{};
+    tail_.func = ident( func_name);
+    tail_.args = func_node->right;
+    tail_.acc_op = tail_accumulator( root);
 
+    // Parameters are declared in the same order, see declare_functions()
+    llvm::Argument* arg = function->arg_begin();
     for ( ast_node* param = func_node->right;
           param != nullptr;
-          param = param->left )
+          param = param->left, ++arg )
     {
-        llvm::ArrayType *type = llvm::ArrayType::get( llvm::Type::getInt64Ty( context_), 1);
-        for ( llvm::Argument& arg : function->args() )
-        {
-            // Make function arguments mutable
-            llvm::AllocaInst* local = builder_->CreateAlloca( type);
-            builder_->CreateStore( &arg, local);
-            scope.emplace( ident( param->right), Allocation{ local, type});
-        }
+        // Make function arguments mutable
+        llvm::ArrayType *type = llvm::ArrayType::get( llvm::Type::getInt64Ty( *context_), 1);
+        llvm::AllocaInst* local = builder_->CreateAlloca( type);
+
+        scopes_.insert( ident( param->right), Allocation{ local, type});
+        tail_.params.push_back( get_element_ptr( ident( param->right)));
+        builder_->CreateStore( arg, tail_.params.back());
+    }
+
+    if ( tail_.acc_op != AST_NULL )
+    {
+        tail_.acc = builder_->CreateAlloca( llvm::Type::getInt64Ty( *context_));
+        builder_->CreateStore( llvm::ConstantInt::get( llvm::Type::getInt64Ty( *context_),
+                                                       tail_.acc_op == AST_MUL),
+                               tail_.acc);
     }
 
+    // Self tail calls loop here instead of 'musttail': the recursion is
+    // then promoted to phis by mem2reg and runs in constant stack space
+    // at any optimization level
+    tail_.body = llvm::BasicBlock::Create( *context_, ".body", function);
+    builder_->CreateBr( tail_.body);
+    builder_->SetInsertPoint( tail_.body);
+
     // Compile body
     compile_stmt( root->right);
-    scopes_.pop_back();
+    scopes_.pop_scope();
+
+    // Function without return statement at the end returns zero
+    if ( !builder_->GetInsertBlock()->getTerminator() )
+    {
+        builder_->CreateRet( accumulate( llvm::ConstantInt::get( llvm::Type::getInt64Ty( *context_), 0)));
+    }
+
+    tail_ = TailCalls{};
     return nullptr;
 }
 
@@ -294,13 +509,14 @@ llvm::Value*
 IRGenerator::compile_assign( const ast_node* root)
 {
     assert( root);
+    trace_point( TRACE_LLVM, root);
 
     if ( keyword( root) != AST_ASSIGN)
     {
         throw std::runtime_error{ "AST_ASSIGN node type is required"};
     }
 
-    const std::string name = ident( root->left);
+    const char* name = ident( root->left);
 
     ast_node *shift_node = root->left->right;
     size_t shift = shift_node ? unumber( shift_node)
@@ -311,7 +527,7 @@ IRGenerator::compile_assign( const ast_node* root)
     // See https://github.com/futherus/language/blob/master/tree_standard.md
     //
     size_t alloca_size = shift + 1;
-    llvm::ArrayType *type = llvm::ArrayType::get( llvm::Type::getInt64Ty( context_), alloca_size);
+    llvm::ArrayType *type = llvm::ArrayType::get( llvm::Type::getInt64Ty( *context_), alloca_size);
 
     if ( !scopes_.find( name).value )
     {
@@ -334,14 +550,13 @@ IRGenerator::compile_assign( const ast_node* root)
         } else
         {
             // %var = alloca [(shift + 1) x i64], align 8
-            just_allocated_value = builder_->CreateAlloca( type);
+            just_allocated_value = create_entry_alloca( type);
         }
 
         assert( just_allocated_value);
 
         // Add just allocated variable to the current scope
-        Scope& scope = scopes_.back();
-        scope[name] = Allocation{ just_allocated_value, type};
+        scopes_.insert( name, Allocation{ just_allocated_value, type});
 
     } else
     {
@@ -365,19 +580,20 @@ llvm::Value*
 IRGenerator::compile_expr( const ast_node* root)
 {
     assert( root );
+    trace_point( TRACE_LLVM, root);
 
     if ( root->type == AST_NODE_NUMBER )
     {
-        return llvm::ConstantInt::get( context_, llvm::APInt( 64, unumber( root), true));
+        return llvm::ConstantInt::get( *context_, llvm::APInt( 64, unumber( root), true));
     }
 
     if ( root->type == AST_NODE_IDENT)
     {
         llvm::Value* index = root->right ? compile_expr( root->right)
-                                         : llvm::ConstantInt::get( llvm::Type::getInt64Ty( context_), 0);
+                                         : llvm::ConstantInt::get( llvm::Type::getInt64Ty( *context_), 0);
 
         llvm::Value* variable = get_element_ptr( ident( root), index);
-        return builder_->CreateLoad( llvm::Type::getInt64Ty( context_), variable);
+        return builder_->CreateLoad( llvm::Type::getInt64Ty( *context_), variable);
     }
 
     if ( ast_keyword( root) == AST_CALL )
@@ -396,9 +612,12 @@ IRGenerator::compile_expr( const ast_node* root)
     assert( root->right);
     llvm::Value* rhs = compile_expr( root->right);
 
+    llvm::Type* int64 = llvm::Type::getInt64Ty( *context_);
+
+    // Logical operations produce i1, but all values are i64 by the AST standard
     switch ( ast_keyword( root) ) {
     case AST_NOT:
-        return builder_->CreateOr( rhs);
+        return builder_->CreateZExt( builder_->CreateICmpEQ( rhs, llvm::ConstantInt::get( int64, 0)), int64);
     default:
         break;
     }
@@ -415,25 +634,63 @@ IRGenerator::compile_expr( const ast_node* root)
         return builder_->CreateMul( lhs, rhs);
     case AST_DIV:
         return builder_->CreateSDiv( lhs, rhs);
+    case AST_POW:
+        return compile_pow( lhs, rhs);
     case AST_AND:
         return builder_->CreateAnd( lhs, rhs);
     case AST_OR:
         return builder_->CreateOr( lhs, rhs);
     case AST_EQUAL:
-        return builder_->CreateICmpEQ( lhs, rhs);
+        return builder_->CreateZExt( builder_->CreateICmpEQ( lhs, rhs), int64);
     case AST_NEQUAL:
-        return builder_->CreateICmpNE( lhs, rhs);
+        return builder_->CreateZExt( builder_->CreateICmpNE( lhs, rhs), int64);
     case AST_GREAT:
-        return builder_->CreateICmpSGT( lhs, rhs);
+        return builder_->CreateZExt( builder_->CreateICmpSGT( lhs, rhs), int64);
     case AST_LOW:
-        return builder_->CreateICmpSLT( lhs, rhs);
+        return builder_->CreateZExt( builder_->CreateICmpSLT( lhs, rhs), int64);
     case AST_GEQUAL:
-        return builder_->CreateICmpSGE( lhs, rhs);
+        return builder_->CreateZExt( builder_->CreateICmpSGE( lhs, rhs), int64);
     case AST_LEQUAL:
-        return builder_->CreateICmpSLE( lhs, rhs);
+        return builder_->CreateZExt( builder_->CreateICmpSLE( lhs, rhs), int64);
     default:
-        return nullptr;
+        throw std::runtime_error{ "unsupported expression operator"};
+    }
+}
+
+//
+// Small constant exponent is unrolled into exponentiation by squaring,
+// e.g. x^5 is (x^2)^2 * x. Otherwise it's ASSLIB call.
+//
+llvm::Value*
+IRGenerator::compile_pow( llvm::Value* base, llvm::Value* exp)
+{
+    llvm::ConstantInt* constant = llvm::dyn_cast<llvm::ConstantInt>( exp);
+    if ( !constant || constant->isNegative() || constant->getZExtValue() >= kPowInlineMax )
+    {
+        llvm::Function *function = module_->getFunction( get_asslib_ident( AsslibID::ASSLIB_POW));
+        assert( function );
+
+        return builder_->CreateCall( function, { base, exp});
+    }
+
+    uint64_t n = constant->getZExtValue();
+    if ( n == 0 )
+    {
+        return llvm::ConstantInt::get( base->getType(), 1);
     }
+
+    // Left-to-right binary method: square for every bit below the highest one
+    llvm::Value* result = base;
+    for ( int bit = 62 - __builtin_clzll( n); bit >= 0; --bit )
+    {
+        result = builder_->CreateMul( result, result);
+        if ( n & (1ull << bit) )
+        {
+            result = builder_->CreateMul( result, base);
+        }
+    }
+
+    return result;
 }
 
 llvm::Value*
@@ -455,6 +712,7 @@ llvm::Value*
 IRGenerator::compile_if( const ast_node* root)
 {
     assert( root && ast_keyword( root) == AST_IF );
+    trace_point( TRACE_LLVM, root);
 
     llvm::Value* cond = compile_cond( root->left);
 
@@ -464,9 +722,9 @@ IRGenerator::compile_if( const ast_node* root)
 
     llvm::Function* function = builder_->GetInsertBlock()->getParent();
 
-    llvm::BasicBlock *then_bb = llvm::BasicBlock::Create( context_, ".if", function);
-    llvm::BasicBlock *else_bb = llvm::BasicBlock::Create( context_, ".if", function);
-    llvm::BasicBlock *exit_bb = llvm::BasicBlock::Create( context_, ".if", function);
+    llvm::BasicBlock *then_bb = llvm::BasicBlock::Create( *context_, ".if", function);
+    llvm::BasicBlock *else_bb = llvm::BasicBlock::Create( *context_, ".if", function);
+    llvm::BasicBlock *exit_bb = llvm::BasicBlock::Create( *context_, ".if", function);
 
     builder_->CreateCondBr( cond, then_bb, else_bb);
 
@@ -477,12 +735,12 @@ IRGenerator::compile_if( const ast_node* root)
         bool should_branch = true;
         if ( node )
         {
-            scopes_.emplace_back();
+            scopes_.push_scope();
 
             llvm::Value* last = compile_stmt( node);
             should_branch = !IsInstTerminator( last);
 
-            scopes_.pop_back();
+            scopes_.pop_scope();
         }
 
         if ( should_branch )
@@ -502,12 +760,13 @@ llvm::Value*
 IRGenerator::compile_while( const ast_node* root)
 {
     assert( root );
+    trace_point( TRACE_LLVM, root);
 
     llvm::Function* function = builder_->GetInsertBlock()->getParent();
 
-    llvm::BasicBlock *cond_bb = llvm::BasicBlock::Create( context_, ".while", function);
-    llvm::BasicBlock *body_bb = llvm::BasicBlock::Create( context_, ".while", function);
-    llvm::BasicBlock *exit_bb = llvm::BasicBlock::Create( context_, ".while", function);
+    llvm::BasicBlock *cond_bb = llvm::BasicBlock::Create( *context_, ".while", function);
+    llvm::BasicBlock *body_bb = llvm::BasicBlock::Create( *context_, ".while", function);
+    llvm::BasicBlock *exit_bb = llvm::BasicBlock::Create( *context_, ".while", function);
 
     assert( root->left && root->right );
 
@@ -533,10 +792,56 @@ llvm::Value*
 IRGenerator::compile_return( const ast_node* root)
 {
     assert( root->right );
-    llvm::Value* return_value = compile_expr( root->right);
+
+    ast_tail_call tail{};
+    if ( tail_.func && match_tail_call( root, tail_.func, tail_.args, &tail) &&
+         ( !tail.operand || tail.op == tail_.acc_op ) )
+    {
+        return compile_tail_call( tail);
+    }
+
+    llvm::Value* return_value = accumulate( compile_expr( root->right));
     return builder_->CreateRet( return_value);
 }
 
+llvm::Value*
+IRGenerator::compile_tail_call( const ast_tail_call& tail)
+{
+    trace_point( TRACE_LLVM, tail.call);
+
+    if ( tail.operand )
+    {
+        builder_->CreateStore( accumulate( compile_expr( tail.operand)), tail_.acc);
+    }
+
+    // All the arguments are evaluated before parameters are changed
+    std::vector<llvm::Value*> args{};
+    for ( ast_node* param = tail.call->right; param != nullptr; param = param->left )
+    {
+        args.push_back( compile_expr( param->right));
+    }
+
+    for ( std::size_t i = 0; i < args.size(); ++i )
+    {
+        builder_->CreateStore( args[i], tail_.params[i]);
+    }
+
+    return builder_->CreateBr( tail_.body);
+}
+
+llvm::Value*
+IRGenerator::accumulate( llvm::Value* value)
+{
+    if ( !tail_.acc )
+    {
+        return value;
+    }
+
+    llvm::Value* acc = builder_->CreateLoad( llvm::Type::getInt64Ty( *context_), tail_.acc);
+    return tail_.acc_op == AST_MUL ? builder_->CreateMul( acc, value)
+                                   : builder_->CreateAdd( acc, value);
+}
+
 void
 IRGenerator::declare_stdlib()
 {
@@ -545,13 +850,70 @@ IRGenerator::declare_stdlib()
     std::vector<llvm::Type*> params{};                                                                       \
     for ( int i = 0; i < (ARGS); ++i )                                                                       \
     {                                                                                                        \
-        params.push_back( llvm::Type::getInt64Ty( context_));                                                \
+        params.push_back( llvm::Type::getInt64Ty( *context_));                                               \
     }                                                                                                        \
                                                                                                              \
-    llvm::FunctionType *__type = llvm::FunctionType::get( llvm::Type::getInt64Ty( context_), params, false);  \
+    llvm::FunctionType *__type = llvm::FunctionType::get( llvm::Type::getInt64Ty( *context_), params, false); \
     module_->getOrInsertFunction( (NAME), __type);                                                           \
 }
 
 #include "../../STDLIB"
 #undef ASS_STDLIB
 }
+
+void
+IRGenerator::SymbolTable::pop_scope()
+{
+    assert( !scopes_.empty() );
+
+    std::size_t begin = scopes_.back();
+    scopes_.pop_back();
+
+    // Undo the scope declarations, the latest goes first
+    for ( std::size_t i = entries_.size(); i > begin; --i )
+    {
+        const Entry& entry = entries_[i - 1];
+        slots_[find_slot( slots_, entry.ident)].top = entry.shadowed;
+    }
+
+    entries_.resize( begin);
+}
+
+void
+IRGenerator::SymbolTable::insert( const char* ident, Allocation alloc)
+{
+    assert( ident );
+    assert( !scopes_.empty() );
+
+    // Keep load factor under 1/2. Names are never removed from slots.
+    if ( 2 * (n_idents_ + 1) > slots_.size() )
+    {
+        grow();
+    }
+
+    Slot& slot = slots_[find_slot( slots_, ident)];
+    entries_.push_back( Entry{ ident, alloc, slot.top});
+
+    if ( !slot.ident )
+    {
+        slot.ident = ident;
+        ++n_idents_;
+    }
+
+    slot.top = (std::ptrdiff_t)entries_.size() - 1;
+}
+
+void
+IRGenerator::SymbolTable::grow()
+{
+    std::vector<Slot> slots( slots_.empty() ? 64 : 2 * slots_.size());
+    for ( const Slot& slot : slots_ )
+    {
+        if ( slot.ident )
+        {
+            slots[find_slot( slots, slot.ident)] = slot;
+        }
+    }
+
+    slots_.swap( slots);
+}
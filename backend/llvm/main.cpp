@@ -3,41 +3,122 @@
 #include <fstream>
 #include "logs.h"
 #include "iommap.h"
+#include "stats.h"
+#include "trace.h"
 #include "ast/tree.h"
 #include "raii/memory_map.h"
 #include "raii/ast_tree.h"
 #include "backend/llvm/ir_gen.h"
 
+static const unsigned kMaxOptLevel = 3;
+
+// -O0..-O3, other options are left to the caller
+static bool
+parse_opt_level( const char *option,
+                 unsigned *opt_level)
+{
+    if ( option[1] != 'O' || !option[2] || option[3] )
+    {
+        return false;
+    }
+
+    unsigned level = static_cast<unsigned>( option[2] - '0');
+    if ( level > kMaxOptLevel )
+    {
+        return false;
+    }
+
+    *opt_level = level;
+    return true;
+}
+
 int
 main( int argc,
       char *argv[])
 {
-    if (argc != 3) {
-            fprintf(stderr, ascii(RED, "There must be 2 arguments: %s [input.tree] [output.ll]\n"), argv[0]);
+    stats_format stats = STATS_NONE;
+    argc = stats_options( argc, argv, &stats);
+
+    unsigned opt_level = 0;
+    bool emit_object = false;
+    bool run = false;
+
+    int argi = 1;
+    for ( ; argi < argc && argv[argi][0] == '-'; argi++ )
+    {
+        const char *option = argv[argi];
+        if ( !std::strcmp( option, "-c") )
+        {
+            emit_object = true;
+        } else if ( !std::strcmp( option, "--run") )
+        {
+            run = true;
+        } else if ( !parse_opt_level( option, &opt_level) )
+        {
+            break;
+        }
+    }
+
+    if (argc - argi != (run ? 1 : 2) || (run && emit_object)) {
+            fprintf(stderr, ascii(RED, "Usage: %s [--stats[=text|json]] [-O0..-O3] [-c] [input.tree] [output.ll or output.o with -c]\n"
+                                       "       %s [--stats[=text|json]] [-O0..-O3] --run [input.tree]\n"), argv[0], argv[0]);
             return EXIT_FAILURE;
     }
 
-    const char *src_file = argv[1];
-    const char *out_file = argv[2];
+    const char *src_file = argv[argi];
+    const char *out_file = run ? src_file : argv[argi + 1];
 
     try {
 
+        size_t total = stats_begin( "cum-llvm");
+
         MemoryMap map{ src_file};
-        Tree ast_tree{ map.data.buf};
+        Tree ast_tree{ map.data.buf, map.data.size};
         map.unmap();
 
-        dump_tree( ast_tree.root());
+        trace_dump( dump_tree( ast_tree.root()));
+
+        IRGenerator irgen{ out_file};
+        irgen.compile( ast_tree.root());
+        irgen.optimize( opt_level);
+
+        // Program exit code is the value returned by main
+        if ( run )
+        {
+            size_t phase = stats_begin( "IRGenerator::run");
+            int code = static_cast<int>( irgen.run());
+            stats_end( phase);
+
+            stats_end( total);
+            stats_report( stdout, stats);
+            return code;
+        }
 
         std::error_code code;
         llvm::raw_fd_ostream out{ out_file, code};
+        if ( code )
+        {
+            throw std::runtime_error{ "can't open output file: " + code.message()};
+        }
 
-        IRGenerator irgen{ out_file};
-        irgen.compile( ast_tree.root(), out);
+        size_t phase = stats_begin( emit_object ? "IRGenerator::emit_object" : "IRGenerator::print");
+        if ( emit_object )
+        {
+            irgen.emit_object( out);
+        } else
+        {
+            irgen.print( out);
+        }
+
+        out.flush();
+        stats_end( phase);
+
+        stats_end( total);
+        stats_report( stdout, stats);
 
     } catch ( const std::exception& exception )
     {
         std::fprintf(stderr, ascii(RED, "Compilation failed: %s\n"), exception.what());
+        return EXIT_FAILURE;
     }
 }
-
-
@@ -1,43 +1,61 @@
 #pragma once
 #include "ast/tree.h"
-#include "array.h"
+#include "intern.h"
+#include "stats.h"
 #include <stdexcept>
 
 class Tree
 {
 public:
-    Tree( char *buf)
+    Tree( char *buf, size_t size)
         : idents_{}
+        , arena_{}
     {
-        root_ = read_ast_tree( &buf, &idents_);
+        size_t phase = stats_begin( "load_ast_tree");
+
+        ast_arena* prev = bind_ast_arena( &arena_);
+        root_ = load_ast_tree( buf, size, &idents_);
+        bind_ast_arena( prev);
+
+        stats_end( phase, arena_.n_nodes, "nodes");
+
+        // Tree is saved as it was parsed, it's simplified here
+        if ( root_ != nullptr )
+        {
+            prev = bind_ast_arena( &arena_);
+
+            size_t n_folded = 0;
+            phase = stats_begin( "fold_tree");
+            root_ = fold_tree( root_, &n_folded);
+            stats_end( phase, n_folded, "nodes folded");
+
+            size_t n_dead = 0;
+            phase = stats_begin( "eliminate_dead_code");
+            root_ = eliminate_dead_code( root_, &n_dead);
+            stats_end( phase, n_dead, "nodes eliminated");
+
+            bind_ast_arena( prev);
+        }
+
         if ( root_ == nullptr )
         {
-            array_dtor();
+            free_intern( &idents_);
+            free_ast_arena( &arena_);
             throw std::runtime_error{ "Tree ctor failed"};
         }
     }
 
     ~Tree()
     {
-        array_dtor();
+        free_intern( &idents_);
+        free_ast_arena( &arena_);
     }
 
     ast_node* root() const { return root_; }
 
 private:
-    void array_dtor() noexcept
-    {
-        char **data = static_cast<char**>( idents_.data);
-        for (size_t i = 0; i < idents_.size; i++) {
-            free( data[i]);
-        }
-
-        free_array( &idents_, sizeof( char*));
-        idents_.data = nullptr;
-    }
-
-private:
-    array idents_;
+    intern_table idents_;
+    ast_arena arena_;
     ast_node* root_;
 };
 
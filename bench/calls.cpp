@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <logs.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <ast/keyword.h>
+#include <backend/legacy/backend.h>
+#include <backend/legacy/elf64.h>
+#include <bench/bench.h>
+
+static const char OBJECT_FILE[] = "bench-calls.o";
+static const char BINARY_FILE[] = "bench-calls.out";
+
+struct calls_program {
+        const char *name;
+        const char *src;
+        size_t n_iters;   /* input of the program */
+};
+
+static const calls_program PROGRAMS[] = {
+        {
+                "fib",
+                "dump fib(n)\n"
+                "{\n"
+                "        if (n < 2)\n"
+                "                return n;\n"
+                "        return fib(n - 1) + fib(n - 2);\n"
+                "}\n"
+                "\n"
+                "dump main()\n"
+                "{\n"
+                "        assert(out(fib(in())));\n"
+                "        return 0;\n"
+                "}\n",
+                35,
+        },
+        {
+                "leaf",
+                "dump mix(a, b, c, d)\n"
+                "{\n"
+                "        return a * 3 + b - c + d;\n"
+                "}\n"
+                "\n"
+                "dump main()\n"
+                "{\n"
+                "        assert(n = in());\n"
+                "        assert(i = 0);\n"
+                "        assert(sum = 0);\n"
+                "        while (i < n) {\n"
+                "                assert(sum = mix(i, sum, 7, 1));\n"
+                "                assert(i = i + 1);\n"
+                "        }\n"
+                "        assert(out(sum));\n"
+                "        return 0;\n"
+                "}\n",
+                100000000,
+        },
+        {
+                "8 args",
+                "dump poly(a, b, c, d, e, f, g, h)\n"
+                "{\n"
+                "        return a + b * 2 + c * 3 + d * 4 + e * 5 + f * 6 + g * 7 + h * 8;\n"
+                "}\n"
+                "\n"
+                "dump main()\n"
+                "{\n"
+                "        assert(n = in());\n"
+                "        assert(i = 0);\n"
+                "        assert(sum = 0);\n"
+                "        while (i < n) {\n"
+                "                assert(sum = sum + poly(i, 1, 2, 3, 4, 5, 6, sum));\n"
+                "                assert(i = i + 1);\n"
+                "        }\n"
+                "        assert(out(sum));\n"
+                "        return 0;\n"
+                "}\n",
+                50000000,
+        },
+};
+
+static int measure(const calls_program *prog, size_t n_rounds)
+{
+        intern_table names = {0};
+        ast_arena arena = {};
+        bind_ast_arena(&arena);
+
+        printf("%-12s %12zu", prog->name, prog->n_iters);
+
+        char input[32] = {0};
+        snprintf(input, sizeof(input), "%zu\n", prog->n_iters);
+
+        double time = -1;
+        ast_node *tree = bench_tree(prog->src, &names);
+        if (tree && !compile_elf64(tree, OBJECT_FILE) && !bench_link(OBJECT_FILE, BINARY_FILE))
+                time = bench_run(BINARY_FILE, input, n_rounds);
+        if (time < 0)
+                printf("  failed\n");
+        else
+                printf(" %8.4lf\n", time);
+
+        free_ast_arena(&arena);
+        free_intern(&names);
+        bind_ast_arena(nullptr);
+
+        fflush(stdout);
+        return time < 0 ? -1 : 0;
+}
+
+/*
+ * Legacy backend calling convention: call-heavy programs are compiled
+ * and run. Must be run from the repository root after 'make'.
+ * Usage: bench-calls [rounds]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_rounds = argc > 1 ? strtoul(argv[1], nullptr, 0) : 3;
+
+        if (!n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        printf("calls: %d arguments in registers, best of %zu, sec\n", AC_N_ARG_REGS, n_rounds);
+        printf("%-12s %12s %8s\n", "program", "input", "time");
+
+        int status = EXIT_SUCCESS;
+        for (const calls_program &prog : PROGRAMS) {
+                if (measure(&prog, n_rounds))
+                        status = EXIT_FAILURE;
+        }
+
+        unlink(OBJECT_FILE);
+        unlink(BINARY_FILE);
+        return status;
+}
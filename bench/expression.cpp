@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <logs.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+#include <bench/bench.h>
+
+static const char *const OPERANDS[] = {"alpha", "beta", "gamma", "7", "42", "1000"};
+static const char *const OPERATORS[] = {" + ", " - ", " * ", " / ", " && ", " || "};
+static const char *const COMPARES[]  = {" < ", " > ", " == ", " != ", " <= ", " >= "};
+
+static const size_t N_STMTS = 8;
+
+static void put_expression(array *const src, size_t *seed, size_t depth);
+
+static void put_operand(array *const src, size_t *seed, size_t depth)
+{
+        size_t n_operands = sizeof(OPERANDS) / sizeof(*OPERANDS);
+
+        switch (depth ? bench_roll(seed, 8) : 0) {
+        case 1:
+                bench_print(src, "(");
+                put_expression(src, seed, depth - 1);
+                bench_print(src, ")");
+                break;
+        case 2:
+                bench_print(src, "(");
+                put_expression(src, seed, depth - 1);
+                bench_print(src, "%s", COMPARES[bench_roll(seed, sizeof(COMPARES) / sizeof(*COMPARES))]);
+                put_expression(src, seed, depth - 1);
+                bench_print(src, ")");
+                break;
+        case 3:
+                bench_print(src, "%s", bench_roll(seed, 2) ? "-" : "!");
+                put_operand(src, seed, depth - 1);
+                break;
+        case 4:
+                put_operand(src, seed, 0);
+                bench_print(src, " ^ 2");
+                break;
+        case 5:
+                bench_print(src, "table[");
+                put_expression(src, seed, depth - 1);
+                bench_print(src, "]");
+                break;
+        default:
+                bench_print(src, "%s", OPERANDS[bench_roll(seed, n_operands)]);
+                break;
+        }
+}
+
+static void put_expression(array *const src, size_t *seed, size_t depth)
+{
+        put_operand(src, seed, depth);
+
+        size_t n_ops = bench_roll(seed, 6);
+        for (size_t i = 0; i < n_ops; i++) {
+                bench_print(src, "%s", OPERATORS[bench_roll(seed, sizeof(OPERATORS) / sizeof(*OPERATORS))]);
+                put_operand(src, seed, depth);
+        }
+}
+
+/*
+ * Functions of expression statements: long chains of every operator,
+ * brackets, unary operators and array indices nested 'depth' times.
+ */
+static char *generate_expressions(size_t n_funcs, size_t depth, size_t *size)
+{
+        array src = {0};
+        size_t seed = BENCH_SEED;
+
+        for (size_t i = 0; i < n_funcs; i++) {
+                bench_print(&src, "dump expr_%zu(alpha, beta, gamma)\n{\n", i);
+
+                for (size_t j = 0; j < N_STMTS; j++) {
+                        bench_print(&src, "        assert(value_%zu = ", j);
+                        put_expression(&src, &seed, depth);
+                        bench_print(&src, ");\n");
+                }
+
+                bench_print(&src, "        assert(return value_0);\n}\n\n");
+        }
+
+        return bench_source(&src, size);
+}
+
+/*
+ * Expressions parser benchmark: building the trees of expression heavy
+ * code from tokens. Tokenizing is done once before the rounds.
+ * Usage: bench-expression [number of functions] [depth] [rounds]
+ *
+ * Build with -D PARSER_CASCADE to measure the old rules cascade.
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_funcs  = argc > 1 ? strtoul(argv[1], nullptr, 0) : 20000;
+        size_t depth    = argc > 2 ? strtoul(argv[2], nullptr, 0) : 3;
+        size_t n_rounds = argc > 3 ? strtoul(argv[3], nullptr, 0) : 10;
+
+        if (!n_funcs || !n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [functions] [depth] [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        size_t size = 0;
+        char *src = generate_expressions(n_funcs, depth, &size);
+
+        intern_table names = {0};
+        token *toks = tokenize(src, &names);
+        size_t n_tokens = count_tokens(toks) + 1;
+
+        double best = 0;
+        size_t n_nodes = 0;
+        for (size_t round = 0; round < n_rounds; round++) {
+                ast_arena arena = {};
+                bind_ast_arena(&arena);
+
+                token *iter = toks;
+
+                double start = bench_clock();
+                ast_node *tree = grammar_rule(&iter);
+                double time = bench_clock() - start;
+
+                if (!tree) {
+                        fprintf(stderr, ascii(RED, "Generated program is invalid\n"));
+                        return EXIT_FAILURE;
+                }
+
+                n_nodes = arena.n_nodes;
+                if (!round || time < best)
+                        best = time;
+
+                free_ast_arena(&arena);
+                bind_ast_arena(nullptr);
+        }
+
+        printf("expression: %zu bytes, %zu tokens, %zu nodes, best of %zu: %.4lf sec, %.1lf ns/token\n",
+               size, n_tokens, n_nodes, n_rounds, best, best * 1e9 / (double)n_tokens);
+
+        free(toks);
+        free_intern(&names);
+        free(src);
+        return EXIT_SUCCESS;
+}
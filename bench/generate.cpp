@@ -0,0 +1,204 @@
+#include <time.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+#include <bench/bench.h>
+
+static const char GLOBALS[] = 
+        "assert(inv SCALE = 100);\n"
+        "assert(limit = 10);\n\n";
+
+static const char FUNCTION[] = 
+        "dump step_%zu(alpha_%zu, beta_%zu, gamma_%zu)\n"
+        "{\n"
+        "        assert(acc_%zu = alpha_%zu * %zu + beta_%zu / 2 - (gamma_%zu - 1) * 4);\n"
+        "        assert(iter_%zu = 0);\n"
+        "        while (iter_%zu < limit) {\n"
+        "                assert(iter_%zu = iter_%zu + 1);\n"
+        "                if (acc_%zu >= beta_%zu && iter_%zu != gamma_%zu)\n"
+        "                        assert(acc_%zu = acc_%zu - iter_%zu);\n"
+        "                else\n"
+        "                        assert(acc_%zu = acc_%zu + !iter_%zu);\n"
+        "        }\n"
+        "\n"
+        "        if (acc_%zu <= 0 || acc_%zu == SCALE)\n"
+        "                assert(return -acc_%zu);\n"
+        "\n"
+        "        assert(return acc_%zu / %zu + %s);\n"
+        "}\n\n";
+
+static const char MAIN[] = 
+        "dump main()\n"
+        "{\n"
+        "        assert(out(step_%zu(1, 2, 3)));\n"
+        "        assert(return 0);\n"
+        "}\n";
+
+void bench_print(array *const src, const char *fmt, ...)
+{
+        assert(src);
+        assert(fmt);
+
+        va_list args;
+        va_start(args, fmt);
+
+        char buf[2048] = {0};
+        int len = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+
+        assert(len > 0 && (size_t)len < sizeof(buf));
+        for (int i = 0; i < len; i++)
+                array_push(src, buf + i, sizeof(char));
+}
+
+char *generate_program(size_t n_funcs, size_t *size)
+{
+        assert(n_funcs);
+
+        array src = {0};
+        bench_print(&src, "%s", GLOBALS);
+
+        size_t seed = BENCH_SEED;
+        char call[128] = {0};
+
+        for (size_t i = 0; i < n_funcs; i++) {
+                size_t k = bench_roll(&seed, 7) + 2;
+
+                if (i)
+                        snprintf(call, sizeof(call), "step_%zu(acc_%zu, beta_%zu, %zu)", 
+                                                     i - 1, i, i, k);
+                else
+                        snprintf(call, sizeof(call), "%zu", k);
+
+                bench_print(&src, FUNCTION, 
+                      i, i, i, i,
+                      i, i, k, i, i,
+                      i, 
+                      i, 
+                      i, i,
+                      i, i, i, i,
+                      i, i, i,
+                      i, i, i,
+                      i, i,
+                      i,
+                      i, k, call);
+        }
+
+        bench_print(&src, MAIN, n_funcs - 1);
+        return bench_source(&src, size);
+}
+
+size_t bench_roll(size_t *seed, size_t n)
+{
+        assert(seed);
+        assert(n);
+
+        *seed = *seed * 6364136223846793005ul + 1442695040888963407ul;
+        return (*seed >> 33) % n;
+}
+
+char *bench_source(array *const src, size_t *size)
+{
+        assert(src);
+
+        char end = '\0';
+        array_push(src, &end, sizeof(char));
+
+        if (size)
+                *size = src->size - 1;
+
+        return (char *)array_extract(src, sizeof(char));
+}
+
+double bench_clock()
+{
+        struct timespec ts = {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+ast_node *bench_tree(const char *src, intern_table *names, bool optimize, size_t *n_inlined)
+{
+        assert(src);
+        assert(names);
+
+        token *toks = tokenize(src, names);
+        if (!toks)
+                return nullptr;
+
+        token *iter = toks;
+        ast_node *tree = grammar_rule(&iter);
+        free(toks);
+
+        if (!tree)
+                return nullptr;
+
+        tree = fold_tree(tree);
+        if (optimize) {
+                tree = inline_calls(tree, names, INLINE_BUDGET, n_inlined);
+                tree = fold_tree(tree);
+        }
+
+        return eliminate_dead_code(tree);
+}
+
+int bench_link(const char *object, const char *binary, bool llvm)
+{
+        assert(object);
+        assert(binary);
+
+        char cmd[256] = {0};
+        if (llvm)
+                snprintf(cmd, sizeof(cmd), "gcc %s asslib-llvm.c -o %s", object, binary);
+        else
+                snprintf(cmd, sizeof(cmd), "ld -o %s %s asslib.o /lib64/libc.so.6 "
+                                           "-I/lib64/ld-linux-x86-64.so.2", binary, object);
+
+        return system(cmd);
+}
+
+double bench_run(const char *binary, const char *input, size_t n_rounds)
+{
+        assert(binary);
+        assert(input);
+
+        char input_file[128] = {0};
+        snprintf(input_file, sizeof(input_file), "%s.in", binary);
+
+        FILE *in = fopen(input_file, "w");
+        if (!in)
+                return -1;
+
+        fputs(input, in);
+        fclose(in);
+
+        char cmd[256] = {0};
+        snprintf(cmd, sizeof(cmd), "./%s < %s > /dev/null", binary, input_file);
+
+        double best = -1;
+        for (size_t round = 0; round < n_rounds; round++) {
+                double start = bench_clock();
+                int status = system(cmd);
+                double time = bench_clock() - start;
+
+                if (status) {
+                        best = -1;
+                        break;
+                }
+
+                if (!round || time < best)
+                        best = time;
+        }
+
+        unlink(input_file);
+        return best;
+}
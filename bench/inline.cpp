@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <logs.h>
+#include <array.h>
+#include <iommap.h>
+
+#include <ast/tree.h>
+#include <ast/keyword.h>
+#include <backend/legacy/backend.h>
+#include <backend/legacy/elf64.h>
+#include <bench/bench.h>
+
+static const char OBJECT_FILE[] = "bench-inline.o";
+static const char BINARY_FILE[] = "bench-inline.out";
+
+static const char PROGRAM[] =
+        "dump mix(a, b)\n"
+        "{\n"
+        "        return a * 3 + b;\n"
+        "}\n"
+        "\n"
+        "dump clamp(v, lo, hi)\n"
+        "{\n"
+        "        if (v < lo)\n"
+        "                return lo;\n"
+        "        if (v > hi)\n"
+        "                return hi;\n"
+        "        return v;\n"
+        "}\n"
+        "\n"
+        "dump main()\n"
+        "{\n"
+        "        assert(n = in());\n"
+        "        assert(i = 0);\n"
+        "        assert(sum = 0);\n"
+        "        while (i < n) {\n"
+        "                assert(x = mix(i, 7));\n"
+        "                assert(y = clamp(x - sum, 0, 1000));\n"
+        "                assert(sum = sum + y);\n"
+        "                assert(i = i + 1);\n"
+        "        }\n"
+        "        assert(out(sum));\n"
+        "        return 0;\n"
+        "}\n";
+
+static const char *const EXAMPLES[] = {
+        "examples/collatz",
+        "examples/fucktorial",
+        "examples/primes",
+        "examples/quadratic",
+        "examples/quadratic-integer",
+        "examples/sqrt",
+        "examples/test",
+};
+
+static size_t count_calls(ast_node *node)
+{
+        if (!node)
+                return 0;
+
+        size_t n_calls = node->type == AST_NODE_KEYWORD && ast_keyword(node) == AST_CALL;
+        return n_calls + count_calls(node->left) + count_calls(node->right);
+}
+
+/*
+ * Returns the size of .text or zero on error.
+ */
+static size_t text_size(ast_node *tree)
+{
+        elf64_section secs[SEC_NUM] = {};
+        elf64_symbol  syms[SYM_NUM] = {};
+        fill_sections_names(secs);
+        fill_symbols_info(secs, syms, OBJECT_FILE);
+
+        size_t text = compile_tree(tree, secs, syms) ? 0 : secs[SEC_TEXT].size;
+        for (size_t i = 0; i < SEC_NUM; i++)
+                if (secs[i].data)
+                        section_free(secs + i);
+
+        return text;
+}
+
+/*
+ * Compiles 'src' without and with inlining, prints the calls left and .text size.
+ * If 'n_iters' is not zero, the binaries are run too.
+ */
+static int measure(const char *name, const char *src, size_t n_iters, size_t n_rounds)
+{
+        int status = 0;
+        printf("%-28s", name);
+
+        char input[32] = {0};
+        snprintf(input, sizeof(input), "%zu\n", n_iters);
+
+        for (int optimize = 0; optimize < 2 && !status; optimize++) {
+                intern_table names = {0};
+                ast_arena arena = {};
+                bind_ast_arena(&arena);
+
+                size_t n_inlined = 0;
+                ast_node *tree = bench_tree(src, &names, optimize, &n_inlined);
+                size_t text = tree ? text_size(tree) : 0;
+                if (!text) {
+                        status = -1;
+                } else {
+                        printf("  %5zu %5zu %7zu", n_inlined, count_calls(tree), text);
+                        if (n_iters) {
+                                double time = -1;
+                                if (!compile_elf64(tree, OBJECT_FILE) && !bench_link(OBJECT_FILE, BINARY_FILE))
+                                        time = bench_run(BINARY_FILE, input, n_rounds);
+                                if (time < 0)
+                                        status = -1;
+                                else
+                                        printf(" %8.4lf", time);
+                        }
+                }
+
+                free_ast_arena(&arena);
+                free_intern(&names);
+                bind_ast_arena(nullptr);
+        }
+
+        printf("%s\n", status ? "  failed" : "");
+        fflush(stdout);
+        return status;
+}
+
+/*
+ * Legacy backend call overhead: examples/ and a call-heavy loop compiled
+ * without and with the inliner. Must be run from the repository root
+ * after 'make'.
+ * Usage: bench-inline [iterations] [rounds]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_iters  = argc > 1 ? strtoul(argv[1], nullptr, 0) : 50000000;
+        size_t n_rounds = argc > 2 ? strtoul(argv[2], nullptr, 0) : 3;
+
+        if (!n_iters || !n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [iterations] [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        printf("inline: budget %zu nodes, %zu iterations, best of %zu, sec\n",
+               INLINE_BUDGET, n_iters, n_rounds);
+        printf("%-28s  %-28s  %-28s\n", "", "without inlining", "-O");
+        printf("%-28s", "program");
+        for (int i = 0; i < 2; i++)
+                printf("  %5s %5s %7s %8s", "inl", "calls", ".text", "time");
+        printf("\n");
+
+        int status = EXIT_SUCCESS;
+        for (const char *example : EXAMPLES) {
+                mmap_data md = {0};
+                if (mmap_in(&md, example)) {
+                        status = EXIT_FAILURE;
+                        continue;
+                }
+
+                if (measure(example, md.buf, 0, 0))
+                        status = EXIT_FAILURE;
+
+                mmap_free(&md);
+        }
+
+        if (measure("loop", PROGRAM, n_iters, n_rounds))
+                status = EXIT_FAILURE;
+
+        unlink(OBJECT_FILE);
+        unlink(BINARY_FILE);
+        return status;
+}
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <logs.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+#include <backend/llvm/ir_gen.h>
+#include <bench/bench.h>
+
+static void print(array *const src, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+
+static void print(array *const src, const char *fmt, ...)
+{
+        assert(src);
+        assert(fmt);
+
+        va_list args;
+        va_start(args, fmt);
+
+        char buf[256] = {0};
+        int len = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+
+        assert(len > 0 && (size_t)len < sizeof(buf));
+        for (int i = 0; i < len; i++)
+                array_push(src, buf + i, sizeof(char));
+}
+
+/*
+ * Every function declares 'n_locals' variables, each one reads
+ * the previous ones. Every 16th variable is shadowed inside
+ * the nested scope, so lookups go through the scope chain.
+ */
+static char *generate_locals(size_t n_funcs, size_t n_locals)
+{
+        array src = {0};
+
+        for (size_t i = 0; i < n_funcs; i++) {
+                print(&src, "dump locals_%zu(arg)\n{\n", i);
+                print(&src, "        assert(var_0 = arg);\n");
+
+                for (size_t j = 1; j < n_locals; j++) {
+                        print(&src, "        assert(var_%zu = var_%zu + var_%zu * %zu);\n",
+                                    j, j - 1, j / 2, j);
+
+                        if (j % 16)
+                                continue;
+
+                        print(&src, "        if (var_%zu > arg) {\n", j);
+                        for (size_t k = j - 15; k <= j; k++)
+                                print(&src, "                assert(var_%zu = var_%zu - %zu);\n",
+                                            k, k - 1, k);
+                        print(&src, "        }\n");
+                }
+
+                print(&src, "        assert(return var_%zu);\n}\n\n", n_locals - 1);
+        }
+
+        print(&src, "dump main()\n{\n        assert(return locals_%zu(1));\n}\n", n_funcs - 1);
+
+        char end = '\0';
+        array_push(&src, &end, sizeof(char));
+        return (char *)array_extract(&src, sizeof(char));
+}
+
+/*
+ * IR generation benchmark: measures IRGenerator::compile() on functions
+ * with a lot of locals, so the symbol table lookups dominate.
+ * Usage: bench-irgen [number of functions] [locals per function] [rounds]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_funcs  = argc > 1 ? strtoul(argv[1], nullptr, 0) : 100;
+        size_t n_locals = argc > 2 ? strtoul(argv[2], nullptr, 0) : 500;
+        size_t n_rounds = argc > 3 ? strtoul(argv[3], nullptr, 0) : 5;
+
+        if (!n_funcs || !n_locals || !n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [functions] [locals] [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        char *src = generate_locals(n_funcs, n_locals);
+
+        intern_table names = {0};
+        ast_arena arena = {};
+        bind_ast_arena(&arena);
+
+        token *toks = tokenize(src, &names);
+        token *iter = toks;
+        ast_node *tree = toks ? grammar_rule(&iter) : nullptr;
+        if (!tree) {
+                fprintf(stderr, ascii(RED, "Generated program is invalid\n"));
+                return EXIT_FAILURE;
+        }
+
+        double best = 0;
+        for (size_t round = 0; round < n_rounds; round++) {
+                try {
+                        IRGenerator irgen{ "bench-irgen"};
+
+                        double start = bench_clock();
+                        irgen.compile(tree);
+                        double time = bench_clock() - start;
+
+                        if (!round || time < best)
+                                best = time;
+                } catch (const std::exception &exception) {
+                        fprintf(stderr, ascii(RED, "Compilation failed: %s\n"), exception.what());
+                        return EXIT_FAILURE;
+                }
+        }
+
+        printf("irgen: %zu functions, %zu locals, %zu nodes, best of %zu: "
+               "compile %.4lf sec, %.1lf Mnodes/s\n",
+               n_funcs, n_locals, arena.n_nodes, n_rounds, best,
+               (double)arena.n_nodes / best / 1e6);
+
+        free(toks);
+        free_intern(&names);
+        free_ast_arena(&arena);
+        free(src);
+        return EXIT_SUCCESS;
+}
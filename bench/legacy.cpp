@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <logs.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+#include <backend/legacy/backend.h>
+#include <backend/legacy/elf64.h>
+#include <bench/bench.h>
+
+/*
+ * Legacy backend benchmark: measures compile_tree() on a large generated
+ * program. Sections are released after every round, ELF is not written.
+ * Usage: bench-legacy [number of functions] [rounds]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_funcs  = argc > 1 ? strtoul(argv[1], nullptr, 0) : 20000;
+        size_t n_rounds = argc > 2 ? strtoul(argv[2], nullptr, 0) : 10;
+
+        if (!n_funcs || !n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [functions] [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        size_t size = 0;
+        char *src = generate_program(n_funcs, &size);
+
+        intern_table names = {0};
+        ast_arena arena = {};
+        bind_ast_arena(&arena);
+
+        token *toks = tokenize(src, &names);
+        token *iter = toks;
+        ast_node *tree = toks ? grammar_rule(&iter) : nullptr;
+        if (!tree) {
+                fprintf(stderr, ascii(RED, "Generated program is invalid\n"));
+                return EXIT_FAILURE;
+        }
+
+        double best = 0;
+        size_t text = 0;
+        for (size_t round = 0; round < n_rounds; round++) {
+                elf64_section secs[SEC_NUM] = {};
+                elf64_symbol  syms[SYM_NUM] = {};
+                fill_sections_names(secs);
+                fill_symbols_info(secs, syms, "bench-legacy.o");
+
+                double start = bench_clock();
+                ast_node *error = compile_tree(tree, secs, syms);
+                double time = bench_clock() - start;
+
+                if (error) {
+                        fprintf(stderr, ascii(RED, "Compilation failed\n"));
+                        return EXIT_FAILURE;
+                }
+
+                text = secs[SEC_TEXT].size;
+                for (size_t i = 0; i < SEC_NUM; i++)
+                        if (secs[i].data)
+                                section_free(secs + i);
+
+                if (!round || time < best)
+                        best = time;
+        }
+
+        printf("legacy: %zu bytes, %zu nodes, %zu bytes of .text, best of %zu: "
+               "compile_tree %.4lf sec, %.1lf Mnodes/s\n",
+               size, arena.n_nodes, text, n_rounds, best,
+               (double)arena.n_nodes / best / 1e6);
+
+        free(toks);
+        free_intern(&names);
+        free_ast_arena(&arena);
+        free(src);
+        return EXIT_SUCCESS;
+}
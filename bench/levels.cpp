@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <logs.h>
+#include <array.h>
+#include <iommap.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+#include <backend/llvm/ir_gen.h>
+#include <bench/bench.h>
+
+static const char OBJECT_FILE[] = "bench-levels.o";
+static const char BINARY_FILE[] = "bench-levels.out";
+static const char INPUT_FILE[]  = "bench-levels.in";
+
+static const unsigned N_LEVELS = 4;
+
+struct bench_program {
+        const char *file;
+        const char *input;
+};
+
+/*
+ * Programs with their input. The last ones are
+ * heavy enough to see the difference between levels.
+ */
+static const bench_program PROGRAMS[] = {
+        {"examples/fucktorial",        "20"},
+        {"examples/sqrt",              "1000000007"},
+        {"examples/quadratic-integer", "1 -3 2"},
+        {"examples/primes",            "1000000"},
+        {"examples/collatz",           "1000000"},
+};
+
+static ast_node *parse(const char *file, intern_table *names)
+{
+        mmap_data md = {0};
+        if (mmap_in(&md, file))
+                return nullptr;
+
+        token *toks = tokenize(md.buf, names);
+        mmap_free(&md);
+        if (!toks)
+                return nullptr;
+
+        token *iter = toks;
+        ast_node *tree = grammar_rule(&iter);
+        free(toks);
+
+        return tree;
+}
+
+/*
+ * Compiles the tree with the given level and links it with asslib.
+ * Returns nonzero on error.
+ */
+static int build(const ast_node *tree, unsigned level)
+{
+        try {
+                IRGenerator irgen{ OBJECT_FILE};
+                irgen.compile(tree);
+                irgen.optimize(level);
+
+                std::error_code code;
+                llvm::raw_fd_ostream out{ OBJECT_FILE, code};
+                if (code)
+                        return -1;
+
+                irgen.emit_object(out);
+        } catch (const std::exception &exception) {
+                fprintf(stderr, ascii(RED, "Compilation failed: %s\n"), exception.what());
+                return -1;
+        }
+
+        char cmd[256] = {0};
+        snprintf(cmd, sizeof(cmd), "gcc %s asslib-llvm.c -o %s", OBJECT_FILE, BINARY_FILE);
+        return system(cmd);
+}
+
+/*
+ * Runs the binary 'n_rounds' times. Returns the best time.
+ */
+static double run(const char *input, size_t n_rounds)
+{
+        FILE *in = fopen(INPUT_FILE, "w");
+        if (!in)
+                return -1;
+
+        fprintf(in, "%s\n", input);
+        fclose(in);
+
+        char cmd[256] = {0};
+        snprintf(cmd, sizeof(cmd), "./%s < %s > /dev/null", BINARY_FILE, INPUT_FILE);
+
+        double best = 0;
+        for (size_t round = 0; round < n_rounds; round++) {
+                double start = bench_clock();
+                int status = system(cmd);
+                double time = bench_clock() - start;
+
+                if (status)
+                        return -1;
+
+                if (!round || time < best)
+                        best = time;
+        }
+
+        return best;
+}
+
+/*
+ * Runtime of the examples compiled by LLVM backend with -O0..-O3.
+ * Must be run from the repository root.
+ * Usage: bench-levels [rounds]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_rounds = argc > 1 ? strtoul(argv[1], nullptr, 0) : 5;
+
+        if (!n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        printf("levels: best of %zu, sec\n", n_rounds);
+        printf("%-28s", "program");
+        for (unsigned level = 0; level < N_LEVELS; level++)
+                printf("  -O%u      ", level);
+        printf("\n");
+
+        int status = EXIT_SUCCESS;
+        for (const bench_program &program : PROGRAMS) {
+                intern_table names = {0};
+                ast_arena arena = {};
+                bind_ast_arena(&arena);
+
+                ast_node *tree = parse(program.file, &names);
+                if (!tree) {
+                        fprintf(stderr, ascii(RED, "Can't parse %s\n"), program.file);
+                        status = EXIT_FAILURE;
+                        goto next;
+                }
+
+                printf("%-28s", program.file);
+                for (unsigned level = 0; level < N_LEVELS; level++) {
+                        double time = -1;
+                        if (!build(tree, level))
+                                time = run(program.input, n_rounds);
+
+                        if (time < 0) {
+                                printf("  %-9s", "failed");
+                                status = EXIT_FAILURE;
+                        } else {
+                                printf("  %-9.4lf", time);
+                        }
+
+                        fflush(stdout);
+                }
+                printf("\n");
+
+        next:
+                free_ast_arena(&arena);
+                free_intern(&names);
+                bind_ast_arena(nullptr);
+        }
+
+        unlink(OBJECT_FILE);
+        unlink(BINARY_FILE);
+        unlink(INPUT_FILE);
+        return status;
+}
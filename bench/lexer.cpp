@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <logs.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/keyword.h>
+#include <frontend/scan.h>
+#include <bench/bench.h>
+
+static bool same_tokens(const token *toks1, const token *toks2)
+{
+        for (;; toks1++, toks2++) {
+                if (toks1->type != toks2->type)
+                        return false;
+
+                if (toks1->type == TOKEN_IDENT) {
+                        if (strcmp(toks1->data.ident, toks2->data.ident))
+                                return false;
+                } else if (toks1->data.number != toks2->data.number) {
+                        return false;
+                }
+
+                if (toks1->type == TOKEN_KEYWORD && toks1->data.keyword == KW_STOP)
+                        return true;
+        }
+}
+
+/*
+ * Lexer throughput benchmark.
+ * Usage: bench-lexer [number of functions] [rounds]
+ *
+ * Every scanning instruction set supported by the CPU is measured,
+ * tokens must be the same as the scalar ones.
+ * Build with -D LEXER_NAIVE to measure the old strncmp() chain.
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_funcs  = argc > 1 ? strtoul(argv[1], nullptr, 0) : 20000;
+        size_t n_rounds = argc > 2 ? strtoul(argv[2], nullptr, 0) : 10;
+
+        if (!n_funcs || !n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [functions] [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        size_t size = 0;
+        char *src = generate_program(n_funcs, &size);
+
+        intern_table scalar_names = {0};
+        scan_isa prev = set_scan_isa(SCAN_SCALAR);
+        token *scalar = tokenize(src, &scalar_names);
+
+        int status = EXIT_SUCCESS;
+        for (int isa = SCAN_SCALAR; isa <= detect_scan_isa(); isa++) {
+                set_scan_isa((scan_isa)isa);
+
+                double best = 0;
+                size_t n_tokens = 0;
+                bool same = true;
+                for (size_t round = 0; round < n_rounds; round++) {
+                        intern_table names = {0};
+
+                        double start = bench_clock();
+                        token *toks = tokenize(src, &names);
+                        double time = bench_clock() - start;
+
+                        if (!round || time < best)
+                                best = time;
+
+                        n_tokens = count_tokens(toks);
+                        same = same && same_tokens(scalar, toks);
+
+                        free(toks);
+                        free_intern(&names);
+                }
+
+                printf("lexer %-6s: %zu bytes, %zu tokens, best of %zu: %.4lf sec, %.1lf MB/s%s\n",
+                       scan_isa_string((scan_isa)isa), size, n_tokens + 1, n_rounds,
+                       best, (double)size / best / 1e6, same ? "" : "  tokens differ");
+
+                if (!same)
+                        status = EXIT_FAILURE;
+        }
+
+        set_scan_isa(prev);
+        free(scalar);
+        free_intern(&scalar_names);
+        free(src);
+        return status;
+}
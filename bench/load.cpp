@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <logs.h>
+#include <array.h>
+#include <iommap.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+#include <bench/bench.h>
+
+static const char TEXT_FILE[]   = "bench-load.tree";
+static const char BINARY_FILE[] = "bench-load.btree";
+
+/*
+ * Maps the file and reads the tree 'n_rounds' times.
+ * Returns the best time.
+ */
+static double load(const char *file, size_t n_rounds, size_t *n_nodes)
+{
+        double best = 0;
+        for (size_t round = 0; round < n_rounds; round++) {
+                intern_table idents = {0};
+                ast_arena arena = {};
+                bind_ast_arena(&arena);
+
+                double start = bench_clock();
+
+                mmap_data md = {0};
+                if (mmap_in(&md, file))
+                        return -1;
+
+                ast_node *tree = load_ast_tree(md.buf, md.size, &idents);
+                mmap_free(&md);
+
+                double time = bench_clock() - start;
+                if (!tree)
+                        return -1;
+
+                if (!round || time < best)
+                        best = time;
+
+                *n_nodes = arena.n_nodes;
+
+                free_ast_arena(&arena);
+                free_intern(&idents);
+                bind_ast_arena(nullptr);
+        }
+
+        return best;
+}
+
+/*
+ * Tree loading benchmark: text format against binary one.
+ * Usage: bench-load [number of functions] [rounds]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_funcs  = argc > 1 ? strtoul(argv[1], nullptr, 0) : 20000;
+        size_t n_rounds = argc > 2 ? strtoul(argv[2], nullptr, 0) : 10;
+
+        if (!n_funcs || !n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [functions] [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        char *src = generate_program(n_funcs);
+
+        intern_table names = {0};
+        ast_arena arena = {};
+        bind_ast_arena(&arena);
+
+        token *toks = tokenize(src, &names);
+        token *iter = toks;
+        ast_node *tree = grammar_rule(&iter);
+        if (!tree) {
+                fprintf(stderr, ascii(RED, "Generated program is invalid\n"));
+                return EXIT_FAILURE;
+        }
+
+        FILE *out = fopen(TEXT_FILE, "w");
+        if (!out) {
+                perror("Can't open file");
+                return EXIT_FAILURE;
+        }
+
+        save_ast_tree(out, tree);
+        fclose(out);
+
+        if (save_ast_binary(BINARY_FILE, tree))
+                return EXIT_FAILURE;
+
+        free_ast_arena(&arena);
+        bind_ast_arena(nullptr);
+        free(toks);
+        free_intern(&names);
+        free(src);
+
+        size_t text_nodes   = 0;
+        size_t binary_nodes = 0;
+        double text   = load(TEXT_FILE,   n_rounds, &text_nodes);
+        double binary = load(BINARY_FILE, n_rounds, &binary_nodes);
+
+        int status = EXIT_SUCCESS;
+        if (text < 0 || binary < 0 || text_nodes != binary_nodes) {
+                fprintf(stderr, ascii(RED, "Trees are not loaded\n"));
+                status = EXIT_FAILURE;
+        } else {
+                printf("load: %zu nodes, best of %zu: text %.4lf sec (%lld bytes), "
+                       "binary %.4lf sec (%lld bytes), %.1lfx\n",
+                       text_nodes, n_rounds, 
+                       text,   (long long)get_size(TEXT_FILE), 
+                       binary, (long long)get_size(BINARY_FILE),
+                       text / binary);
+        }
+
+        unlink(TEXT_FILE);
+        unlink(BINARY_FILE);
+        return status;
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <logs.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+#include <bench/bench.h>
+
+static const size_t THREADS[] = {1, 2, 4, 8};
+
+/*
+ * Parses the tokens with 'n_threads' workers, one thread means
+ * plain grammar_rule(). Returns the parse time or a negative value
+ * on error.
+ */
+static double parse(token *toks, size_t n_threads, ast_arena *arena, ast_node **tree)
+{
+        bind_ast_arena(arena);
+
+        double start = bench_clock();
+
+        token *iter = toks;
+        *tree = n_threads > 1 ? parallel_grammar_rule(&iter, n_threads) :
+                                grammar_rule(&iter);
+
+        double time = bench_clock() - start;
+
+        bind_ast_arena(nullptr);
+        return *tree ? time : -1;
+}
+
+/*
+ * Parse time of the top-level definitions split between the threads.
+ * Trees must be the same as the sequential one.
+ * Usage: bench-parallel [number of functions] [rounds]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_funcs  = argc > 1 ? strtoul(argv[1], nullptr, 0) : 100000;
+        size_t n_rounds = argc > 2 ? strtoul(argv[2], nullptr, 0) : 5;
+
+        if (!n_funcs || !n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [functions] [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        size_t size = 0;
+        char *src = generate_program(n_funcs, &size);
+
+        intern_table names = {0};
+        token *toks = tokenize(src, &names);
+        if (!toks) {
+                free(src);
+                return EXIT_FAILURE;
+        }
+
+        ast_arena base_arena = {};
+        ast_node *base_tree = nullptr;
+        if (parse(toks, 1, &base_arena, &base_tree) < 0) {
+                free(toks);
+                free_intern(&names);
+                free(src);
+                return EXIT_FAILURE;
+        }
+
+        printf("parallel: %zu bytes, %zu tokens, best of %zu\n",
+               size, count_tokens(toks) + 1, n_rounds);
+        printf("%-8s %10s %10s %8s\n", "threads", "nodes", "time, sec", "speedup");
+
+        int status = EXIT_SUCCESS;
+        double base = 0;
+        for (size_t t = 0; t < sizeof(THREADS) / sizeof(*THREADS); t++) {
+                double best = 0;
+                size_t n_nodes = 0;
+                bool same = true;
+                for (size_t round = 0; round < n_rounds; round++) {
+                        ast_arena arena = {};
+                        ast_node *tree = nullptr;
+
+                        double time = parse(toks, THREADS[t], &arena, &tree);
+                        if (time < 0) {
+                                free_ast_arena(&arena);
+                                best = -1;
+                                break;
+                        }
+
+                        if (!round || time < best)
+                                best = time;
+
+                        n_nodes = arena.n_nodes;
+                        same = same && !compare_trees(base_tree, tree);
+
+                        free_ast_arena(&arena);
+                }
+
+                if (best < 0) {
+                        printf("%-8zu  failed\n", THREADS[t]);
+                        status = EXIT_FAILURE;
+                        continue;
+                }
+
+                if (t == 0)
+                        base = best;
+
+                printf("%-8zu %10zu %10.4lf %7.2lfx%s\n", THREADS[t], n_nodes, best,
+                       base / best, same ? "" : "  trees differ");
+                fflush(stdout);
+
+                if (!same)
+                        status = EXIT_FAILURE;
+        }
+
+        free_ast_arena(&base_arena);
+        free(toks);
+        free_intern(&names);
+        free(src);
+        return status;
+}
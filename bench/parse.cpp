@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <logs.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+#include <bench/bench.h>
+
+/*
+ * Parser benchmark: measures building the tree from tokens
+ * and releasing it. Tokenizing is done once before the rounds.
+ * Usage: bench-parse [number of functions] [rounds]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_funcs  = argc > 1 ? strtoul(argv[1], nullptr, 0) : 20000;
+        size_t n_rounds = argc > 2 ? strtoul(argv[2], nullptr, 0) : 10;
+
+        if (!n_funcs || !n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [functions] [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        size_t size = 0;
+        char *src = generate_program(n_funcs, &size);
+
+        intern_table names = {0};
+        token *toks = tokenize(src, &names);
+
+        double best_parse = 0;
+        double best_free  = 0;
+        size_t n_nodes = 0;
+        for (size_t round = 0; round < n_rounds; round++) {
+                ast_arena arena = {};
+                bind_ast_arena(&arena);
+
+                token *iter = toks;
+
+                double start = bench_clock();
+                ast_node *tree = grammar_rule(&iter);
+                double parse = bench_clock() - start;
+
+                if (!tree) {
+                        fprintf(stderr, ascii(RED, "Generated program is invalid\n"));
+                        return EXIT_FAILURE;
+                }
+
+                n_nodes = arena.n_nodes;
+
+                start = bench_clock();
+                free_ast_arena(&arena);
+                double release = bench_clock() - start;
+
+                bind_ast_arena(nullptr);
+
+                if (!round || parse < best_parse)
+                        best_parse = parse;
+                if (!round || release < best_free)
+                        best_free = release;
+        }
+
+        printf("parse: %zu bytes, %zu nodes, best of %zu: "
+               "parse %.4lf sec, free %.6lf sec, %.1lf Mnodes/s\n",
+               size, n_nodes, n_rounds, best_parse, best_free, 
+               (double)n_nodes / (best_parse + best_free) / 1e6);
+
+        free(toks);
+        free_intern(&names);
+        free(src);
+        return EXIT_SUCCESS;
+}
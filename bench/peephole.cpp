@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <logs.h>
+#include <array.h>
+#include <iommap.h>
+
+#include <ast/tree.h>
+#include <ast/keyword.h>
+#include <backend/legacy/backend.h>
+#include <backend/legacy/elf64.h>
+#include <bench/bench.h>
+
+static const char OBJECT_FILE[] = "bench-peephole.o";
+static const char BINARY_FILE[] = "bench-peephole.out";
+
+struct peephole_program {
+        const char *name;
+        const char *src;
+        size_t input;
+};
+
+static const peephole_program PROGRAMS[] = {
+        {
+                "loop",
+                "dump main()\n"
+                "{\n"
+                "        assert(n = in());\n"
+                "        assert(i = 0);\n"
+                "        assert(sum = 0);\n"
+                "        while (i < n) {\n"
+                "                if (i * 3 > sum)\n"
+                "                        assert(sum = sum + i * 3 - 1);\n"
+                "                else\n"
+                "                        assert(sum = sum - 7);\n"
+                "                assert(i = i + 1);\n"
+                "        }\n"
+                "        assert(out(sum));\n"
+                "        return 0;\n"
+                "}\n",
+                200000000,
+        },
+        {
+                "collatz",
+                "dump main()\n"
+                "{\n"
+                "        assert(n = in());\n"
+                "        assert(i = 1);\n"
+                "        assert(steps = 0);\n"
+                "        while (i < n) {\n"
+                "                assert(x = i);\n"
+                "                while (x != 1) {\n"
+                "                        if (x / 2 * 2 == x)\n"
+                "                                assert(x = x / 2);\n"
+                "                        else\n"
+                "                                assert(x = 3 * x + 1);\n"
+                "                        assert(steps = steps + 1);\n"
+                "                }\n"
+                "                assert(i = i + 1);\n"
+                "        }\n"
+                "        assert(out(steps));\n"
+                "        return 0;\n"
+                "}\n",
+                1000000,
+        },
+        {
+                "fib",
+                "dump fib(n)\n"
+                "{\n"
+                "        if (n < 2)\n"
+                "                return n;\n"
+                "        return fib(n - 1) + fib(n - 2);\n"
+                "}\n"
+                "\n"
+                "dump main()\n"
+                "{\n"
+                "        assert(out(fib(in())));\n"
+                "        return 0;\n"
+                "}\n",
+                35,
+        },
+};
+
+static const char *const EXAMPLES[] = {
+        "examples/collatz",
+        "examples/fucktorial",
+        "examples/primes",
+        "examples/quadratic",
+        "examples/quadratic-integer",
+        "examples/sqrt",
+        "examples/test",
+};
+
+/*
+ * Returns the size of .text or zero on error.
+ */
+static size_t text_size(ast_node *tree, bool peephole)
+{
+        elf64_section secs[SEC_NUM] = {};
+        elf64_symbol  syms[SYM_NUM] = {};
+        fill_sections_names(secs);
+        fill_symbols_info(secs, syms, OBJECT_FILE);
+
+        size_t text = compile_tree(tree, secs, syms, peephole) ? 0 : secs[SEC_TEXT].size;
+        for (size_t i = 0; i < SEC_NUM; i++)
+                if (secs[i].data)
+                        section_free(secs + i);
+
+        return text;
+}
+
+/*
+ * Compiles 'src' without and with the peephole optimizer, prints .text size.
+ * If 'input' is not zero, the binaries are run too.
+ */
+static int measure(const char *name, const char *src, size_t input, size_t n_rounds)
+{
+        int status = 0;
+        intern_table names = {0};
+        ast_arena arena = {};
+        bind_ast_arena(&arena);
+
+        printf("%-28s", name);
+
+        char line[32] = {0};
+        snprintf(line, sizeof(line), "%zu\n", input);
+
+        ast_node *tree = bench_tree(src, &names);
+        for (int peephole = 0; peephole < 2 && !status; peephole++) {
+                size_t text = tree ? text_size(tree, peephole) : 0;
+                if (!text) {
+                        status = -1;
+                        break;
+                }
+
+                printf("  %7zu", text);
+                if (!input) {
+                        printf(" %8s", "");
+                        continue;
+                }
+
+                double time = -1;
+                if (!compile_elf64(tree, OBJECT_FILE, peephole) && !bench_link(OBJECT_FILE, BINARY_FILE))
+                        time = bench_run(BINARY_FILE, line, n_rounds);
+
+                if (time < 0)
+                        status = -1;
+                else
+                        printf(" %8.4lf", time);
+        }
+
+        printf("%s\n", status ? "  failed" : "");
+        fflush(stdout);
+
+        free_ast_arena(&arena);
+        free_intern(&names);
+        bind_ast_arena(nullptr);
+        return status;
+}
+
+/*
+ * Legacy backend peephole optimizer: .text size of examples/ and
+ * run time of the loops compiled without and with it. Must be run
+ * from the repository root after 'make'.
+ * Usage: bench-peephole [rounds]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_rounds = argc > 1 ? strtoul(argv[1], nullptr, 0) : 3;
+
+        if (!n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        printf("peephole: window %zu instructions, best of %zu, .text bytes and sec\n",
+               AC_PEEPHOLE_WINDOW, n_rounds);
+        printf("%-28s  %-16s  %-16s\n", "", "without", "peephole");
+        printf("%-28s  %7s %8s  %7s %8s\n", "program", ".text", "time", ".text", "time");
+
+        int status = EXIT_SUCCESS;
+        for (const char *example : EXAMPLES) {
+                mmap_data md = {0};
+                if (mmap_in(&md, example)) {
+                        status = EXIT_FAILURE;
+                        continue;
+                }
+
+                if (measure(example, md.buf, 0, 0))
+                        status = EXIT_FAILURE;
+
+                mmap_free(&md);
+        }
+
+        for (const peephole_program &prog : PROGRAMS) {
+                if (measure(prog.name, prog.src, prog.input, n_rounds))
+                        status = EXIT_FAILURE;
+        }
+
+        unlink(OBJECT_FILE);
+        unlink(BINARY_FILE);
+        return status;
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <logs.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+#include <bench/bench.h>
+
+enum frontend_mode {
+        MODE_ARRAY    = 0, /* tokenize(), then grammar_rule() */
+        MODE_STREAM   = 1, /* tokens lexed on demand          */
+        MODE_PIPELINE = 2, /* tokens lexed by the other thread */
+};
+
+static const char *const MODE_NAMES[] = {"array", "stream", "pipeline"};
+
+/*
+ * Returns the frontend time or a negative value on error.
+ */
+static double parse(const char *src, frontend_mode mode, size_t *n_nodes)
+{
+        intern_table names = {0};
+        ast_arena arena = {};
+        bind_ast_arena(&arena);
+
+        double start = bench_clock();
+
+        token_stream stream = {};
+        token *toks = nullptr;
+        switch (mode) {
+        case MODE_ARRAY:
+                toks = tokenize(src, &names);
+                break;
+        case MODE_STREAM:
+                toks = open_token_stream(&stream, src, &names);
+                break;
+        case MODE_PIPELINE:
+                toks = open_token_pipe(&stream, src, &names);
+                break;
+        default:
+                break;
+        }
+
+        token *iter = toks;
+        ast_node *tree = toks ? grammar_rule(&iter) : nullptr;
+
+        if (mode == MODE_ARRAY)
+                free(toks);
+        else
+                close_token_stream(&stream);
+
+        double time = bench_clock() - start;
+        *n_nodes = arena.n_nodes;
+
+        free_ast_arena(&arena);
+        free_intern(&names);
+        bind_ast_arena(nullptr);
+
+        return tree ? time : -1;
+}
+
+/*
+ * Frontend wall time: lexing and parsing one after the other against
+ * the lexer running on its own thread.
+ * Usage: bench-pipeline [number of functions] [rounds]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_funcs  = argc > 1 ? strtoul(argv[1], nullptr, 0) : 100000;
+        size_t n_rounds = argc > 2 ? strtoul(argv[2], nullptr, 0) : 5;
+
+        if (!n_funcs || !n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [functions] [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        size_t size = 0;
+        char *src = generate_program(n_funcs, &size);
+
+        printf("pipeline: %zu bytes, %zu blocks of %zu tokens, best of %zu\n",
+               size, TOKEN_BLOCKS, TOKEN_WINDOW, n_rounds);
+        printf("%-10s %10s %10s %8s\n", "mode", "nodes", "time, sec", "speedup");
+
+        int status = EXIT_SUCCESS;
+        double base = 0;
+        for (int mode = MODE_ARRAY; mode <= MODE_PIPELINE; mode++) {
+                double best = 0;
+                size_t n_nodes = 0;
+                for (size_t round = 0; round < n_rounds; round++) {
+                        double time = parse(src, (frontend_mode)mode, &n_nodes);
+                        if (time < 0) {
+                                best = -1;
+                                break;
+                        }
+
+                        if (!round || time < best)
+                                best = time;
+                }
+
+                if (best < 0) {
+                        printf("%-10s  failed\n", MODE_NAMES[mode]);
+                        status = EXIT_FAILURE;
+                        continue;
+                }
+
+                if (mode == MODE_ARRAY)
+                        base = best;
+
+                printf("%-10s %10zu %10.4lf %7.2lfx\n", MODE_NAMES[mode], n_nodes, best, base / best);
+                fflush(stdout);
+        }
+
+        free(src);
+        return status;
+}
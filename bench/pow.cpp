@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <logs.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <backend/legacy/backend.h>
+#include <backend/llvm/ir_gen.h>
+#include <bench/bench.h>
+
+static const char OBJECT_FILE[] = "bench-pow.o";
+static const char BINARY_FILE[] = "bench-pow.out";
+
+static const char PROGRAM[] =
+        "dump main()\n"
+        "{\n"
+        "        assert(n = in());\n"
+        "        assert(a = in());\n"
+        "        assert(b = in());\n"
+        "        assert(c = in());\n"
+        "        assert(i = 0);\n"
+        "        assert(sum = 0);\n"
+        "        while (i < n) {\n"
+        "                assert(sum = sum + %s);\n"
+        "                assert(i = i + 1);\n"
+        "        }\n"
+        "        assert(out(sum));\n"
+        "        return 0;\n"
+        "}\n";
+
+/*
+ * The same polynomial: written by hand, with constant
+ * exponents raised inline and with exponents known at runtime
+ * only, so they are computed by __ass_pow.
+ */
+struct bench_expr {
+        const char *name;
+        const char *expr;
+};
+
+static const bench_expr EXPRS[] = {
+        {"multiply", "i * i * i * i * i * i * i - i * i * i + (i + 1) * (i + 1)"},
+        {"constant", "i ^ 7 - i ^ 3 + (i + 1) ^ 2"},
+        {"runtime",  "i ^ a - i ^ b + (i + 1) ^ c"},
+};
+
+enum bench_backend {
+        BENCH_LEGACY  = 0,
+        BENCH_LLVM_O0 = 1,
+        BENCH_LLVM_O2 = 2,
+        N_BACKENDS,
+};
+
+static const char *const BACKEND_NAMES[] = {"legacy", "llvm -O0", "llvm -O2"};
+
+static int build_llvm(ast_node *tree, unsigned level)
+{
+        try {
+                IRGenerator irgen{ OBJECT_FILE};
+                irgen.compile(tree);
+                irgen.optimize(level);
+
+                std::error_code code;
+                llvm::raw_fd_ostream out{ OBJECT_FILE, code};
+                if (code)
+                        return -1;
+
+                irgen.emit_object(out);
+        } catch (const std::exception &exception) {
+                fprintf(stderr, ascii(RED, "Compilation failed: %s\n"), exception.what());
+                return -1;
+        }
+
+        return bench_link(OBJECT_FILE, BINARY_FILE, true);
+}
+
+static int build_legacy(ast_node *tree)
+{
+        if (compile_elf64(tree, OBJECT_FILE))
+                return -1;
+
+        return bench_link(OBJECT_FILE, BINARY_FILE);
+}
+
+static int build(ast_node *tree, bench_backend backend)
+{
+        switch (backend) {
+        case BENCH_LEGACY:
+                return build_legacy(tree);
+        case BENCH_LLVM_O0:
+                return build_llvm(tree, 0);
+        case BENCH_LLVM_O2:
+                return build_llvm(tree, 2);
+        case N_BACKENDS:
+        default:
+                return -1;
+        }
+}
+
+/*
+ * Power-heavy loop compiled by both backends.
+ * Must be run from the repository root after 'make'.
+ * Usage: bench-pow [iterations] [rounds]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_iters  = argc > 1 ? strtoul(argv[1], nullptr, 0) : 50000000;
+        size_t n_rounds = argc > 2 ? strtoul(argv[2], nullptr, 0) : 3;
+
+        if (!n_iters || !n_rounds) {
+                fprintf(stderr, ascii(RED, "Usage: %s [iterations] [rounds]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        printf("pow: %zu iterations, best of %zu, sec\n", n_iters, n_rounds);
+        printf("%-12s", "expression");
+        for (const char *name : BACKEND_NAMES)
+                printf("  %-10s", name);
+        printf("\n");
+
+        char input[64] = {0};
+        snprintf(input, sizeof(input), "%zu 7 3 2\n", n_iters);
+
+        int status = EXIT_SUCCESS;
+        for (const bench_expr &expr : EXPRS) {
+                char src[1024] = {0};
+                snprintf(src, sizeof(src), PROGRAM, expr.expr);
+
+                intern_table names = {0};
+                ast_arena arena = {};
+                bind_ast_arena(&arena);
+
+                ast_node *tree = bench_tree(src, &names);
+                if (!tree) {
+                        fprintf(stderr, ascii(RED, "Can't parse %s\n"), expr.name);
+                        status = EXIT_FAILURE;
+                        goto next;
+                }
+
+                printf("%-12s", expr.name);
+                for (int backend = 0; backend < N_BACKENDS; backend++) {
+                        double time = -1;
+                        if (!build(tree, (bench_backend)backend))
+                                time = bench_run(BINARY_FILE, input, n_rounds);
+
+                        if (time < 0) {
+                                printf("  %-10s", "failed");
+                                status = EXIT_FAILURE;
+                        } else {
+                                printf("  %-10.4lf", time);
+                        }
+
+                        fflush(stdout);
+                }
+                printf("\n");
+
+        next:
+                free_ast_arena(&arena);
+                free_intern(&names);
+                bind_ast_arena(nullptr);
+        }
+
+        unlink(OBJECT_FILE);
+        unlink(BINARY_FILE);
+        return status;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <logs.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+#include <bench/bench.h>
+
+enum stream_mode {
+        MODE_SOURCE = 0, /* nothing is done, the source only */
+        MODE_ARRAY  = 1, /* tokenize(), then grammar_rule()  */
+        MODE_STREAM = 2, /* grammar_rule() on token_stream   */
+};
+
+static const char *const MODE_NAMES[] = {"source", "array", "stream"};
+
+/*
+ * Parses the source in the child process, so its peak RSS is not
+ * mixed with the other modes.
+ */
+static int parse(const char *src, stream_mode mode)
+{
+        if (mode == MODE_SOURCE)
+                return 0;
+
+        intern_table names = {0};
+        ast_arena arena = {};
+        bind_ast_arena(&arena);
+
+        token_stream stream = {};
+        token *toks = mode == MODE_ARRAY ? tokenize(src, &names) :
+                                           open_token_stream(&stream, src, &names);
+
+        token *iter = toks;
+        ast_node *tree = toks ? grammar_rule(&iter) : nullptr;
+
+        if (mode == MODE_ARRAY)
+                free(toks);
+        else
+                close_token_stream(&stream);
+
+        free_ast_arena(&arena);
+        free_intern(&names);
+        return tree ? 0 : -1;
+}
+
+/*
+ * Returns peak RSS of the child in KiB or zero on error.
+ */
+static size_t measure(const char *src, stream_mode mode, double *time)
+{
+        double start = bench_clock();
+
+        pid_t pid = fork();
+        if (pid < 0)
+                return 0;
+
+        if (!pid)
+                _exit(parse(src, mode) ? EXIT_FAILURE : EXIT_SUCCESS);
+
+        int status = 0;
+        struct rusage usage = {};
+        if (wait4(pid, &status, 0, &usage) != pid)
+                return 0;
+
+        *time = bench_clock() - start;
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+                return 0;
+
+        return (size_t)usage.ru_maxrss;
+}
+
+/*
+ * Frontend peak memory: the whole tokens array against the token stream.
+ * Every mode is run in its own process.
+ * Usage: bench-stream [number of functions]
+ */
+int main(int argc, char *argv[])
+{
+        size_t n_funcs = argc > 1 ? strtoul(argv[1], nullptr, 0) : 100000;
+
+        if (!n_funcs) {
+                fprintf(stderr, ascii(RED, "Usage: %s [functions]\n"), argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        size_t size = 0;
+        char *src = generate_program(n_funcs, &size);
+
+        printf("stream: %zu bytes, window %zu tokens\n", size, TOKEN_WINDOW);
+        printf("%-8s %12s %10s\n", "mode", "peak, KiB", "time, sec");
+
+        int status = EXIT_SUCCESS;
+        for (int mode = MODE_SOURCE; mode <= MODE_STREAM; mode++) {
+                double time = 0;
+                size_t max_rss = measure(src, (stream_mode)mode, &time);
+                if (!max_rss) {
+                        printf("%-8s  failed\n", MODE_NAMES[mode]);
+                        status = EXIT_FAILURE;
+                        continue;
+                }
+
+                printf("%-8s %12zu %10.4lf\n", MODE_NAMES[mode], max_rss, time);
+                fflush(stdout);
+        }
+
+        free(src);
+        return status;
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <logs.h>
+#include <trace.h>
+#include <array.h>
+#include <errno.h>
+#include <iommap.h>
+#include <stats.h>
+
+#include <ast/tree.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+#include <backend/legacy/backend.h>
+#include <backend/llvm/ir_gen.h>
+#include <trans/transpile.h>
+
+/*
+ * Compiler driver: source is lexed, parsed and compiled in one process.
+ * The tree and the identifiers table are passed to the backend in memory.
+ */
+
+enum emit_kind {
+        EMIT_TREE = 0, /* binary tree, as 'tr' does             */
+        EMIT_LL   = 1, /* LLVM IR, as 'cum-llvm' does           */
+        EMIT_OBJ  = 2, /* native object by LLVM, 'cum-llvm -c'  */
+        EMIT_ELF  = 3, /* ELF object by legacy backend, 'cum'   */
+        EMIT_SRC  = 4, /* assert source back, as 'rev' does     */
+};
+
+static const char *const EMIT_NAMES[] = {"tree", "ll", "obj", "elf", "src"};
+static const size_t N_EMITS = sizeof(EMIT_NAMES) / sizeof(*EMIT_NAMES);
+
+static int input_error(const char *name);
+static int file_error(const char *file_name);
+
+static int emit_llvm(ast_node *tree, const char *out_file, unsigned level, bool object);
+static int emit_src (ast_node *tree, const char *out_file);
+
+int main(int argc, char *argv[])
+{
+        stats_format stats = STATS_NONE;
+        argc = stats_options(argc, argv, &stats);
+        if (argc < 0)
+                return input_error(argv[0]);
+
+        emit_kind emit = EMIT_ELF;
+        unsigned level = 0;
+
+        int argi = 1;
+        for ( ; argi < argc && argv[argi][0] == '-'; argi++) {
+                const char *option = argv[argi];
+                if (!strncmp(option, "--emit=", sizeof("--emit=") - 1)) {
+                        const char *kind = option + sizeof("--emit=") - 1;
+
+                        size_t i = 0;
+                        while (i < N_EMITS && strcmp(kind, EMIT_NAMES[i]))
+                                i++;
+
+                        if (i == N_EMITS)
+                                return input_error(argv[0]);
+
+                        emit = (emit_kind)i;
+                } else if (option[1] == 'O' && option[2] >= '0' && option[2] <= '3' && !option[3]) {
+                        level = (unsigned)(option[2] - '0');
+                } else {
+                        return input_error(argv[0]);
+                }
+        }
+
+        if (argc - argi != 2)
+                return input_error(argv[0]);
+
+        const char *src_file = argv[argi];
+        const char *out_file = argv[argi + 1];
+
+        size_t total = stats_begin("assc");
+        mmap_data md = {0};
+        int error = mmap_in(&md, src_file);
+        if (error)
+                return file_error(src_file);
+
+        intern_table names = {0};
+
+        ast_arena arena = {};
+        bind_ast_arena(&arena);
+
+        /* Tokens are lexed on demand by the parser */
+        size_t phase = stats_begin("grammar_rule");
+        token_stream stream = {};
+        token *iter = open_token_stream(&stream, md.buf, &names);
+        ast_node *tree = iter ? grammar_rule(&iter) : nullptr;
+        stats_end(phase, arena.n_nodes, "nodes");
+
+        close_token_stream(&stream);
+        mmap_free(&md);
+
+        /* Source is transpiled back as it was written */
+        if (tree && emit != EMIT_SRC) {
+                size_t n_folded = 0;
+                phase = stats_begin("fold_tree");
+                tree = fold_tree(tree, &n_folded);
+                stats_end(phase, n_folded, "nodes folded");
+
+                /* LLVM inlines by itself */
+                if (emit == EMIT_ELF && level) {
+                        size_t n_inlined = 0;
+                        phase = stats_begin("inline_calls");
+                        tree = inline_calls(tree, &names, INLINE_BUDGET, &n_inlined);
+                        stats_end(phase, n_inlined, "calls inlined");
+
+                        phase = stats_begin("fold_tree");
+                        tree = fold_tree(tree, &n_folded);
+                        stats_end(phase, n_folded, "nodes folded");
+                }
+
+                size_t n_dead = 0;
+                phase = stats_begin("eliminate_dead_code");
+                tree = eliminate_dead_code(tree, &n_dead);
+                stats_end(phase, n_dead, "nodes eliminated");
+        }
+
+        if (tree) {
+                trace_dump(dump_tree(tree));
+                switch (emit) {
+                case EMIT_TREE:
+                        phase = stats_begin("save_ast_binary");
+                        error = save_ast_binary(out_file, tree);
+                        stats_end(phase, arena.n_nodes, "nodes");
+                        break;
+                case EMIT_LL:
+                case EMIT_OBJ:
+                        error = emit_llvm(tree, out_file, level, emit == EMIT_OBJ);
+                        break;
+                case EMIT_ELF:
+                        error = compile_elf64(tree, out_file);
+                        break;
+                case EMIT_SRC:
+                        phase = stats_begin("trans_stmt");
+                        error = emit_src(tree, out_file);
+                        stats_end(phase, arena.n_nodes, "nodes");
+                        break;
+                default:
+                        error = -1;
+                        break;
+                }
+        }
+
+        free_intern(&names);
+        free_ast_arena(&arena);
+        bind_ast_arena(nullptr);
+
+        if (!tree || error) {
+                fprintf(stderr, ascii(RED, "Compilation failed\n"));
+                return EXIT_FAILURE;
+        }
+
+        stats_end(total);
+        stats_report(stdout, stats);
+
+        fprintf(stderr, ascii(GREEN, "Compilation succeed\n"));
+        return EXIT_SUCCESS;
+}
+
+static int emit_llvm(ast_node *tree, const char *out_file, unsigned level, bool object)
+{
+        try {
+                IRGenerator irgen{ out_file};
+                irgen.compile(tree);
+                irgen.optimize(level);
+
+                std::error_code code;
+                llvm::raw_fd_ostream out{ out_file, code};
+                if (code)
+                        return file_error(out_file);
+
+                size_t phase = stats_begin(object ? "IRGenerator::emit_object" : "IRGenerator::print");
+                if (object)
+                        irgen.emit_object(out);
+                else
+                        irgen.print(out);
+
+                out.flush();
+                stats_end(phase);
+
+        } catch (const std::exception &exception) {
+                fprintf(stderr, ascii(RED, "LLVM backend failed: %s\n"), exception.what());
+                return -1;
+        }
+
+        return 0;
+}
+
+static int emit_src(ast_node *tree, const char *out_file)
+{
+        FILE *out = fopen(out_file, "w");
+        if (!out)
+                return file_error(out_file);
+
+        ast_node *err = trans_stmt(out, tree);
+        fclose(out);
+
+        return err ? -1 : 0;
+}
+
+static int input_error(const char *name)
+{
+        fprintf(stderr, ascii(RED, "Usage: %s [--stats[=text|json]] [-O0..-O3] [--emit=tree|ll|obj|elf|src] [source] [output]\n"), name);
+        return EXIT_FAILURE;
+}
+
+static int file_error(const char *file_name)
+{
+        fprintf(stderr, ascii(RED, "Can't open file %s: %s\n"),
+                        file_name, strerror(errno));
+
+        return EXIT_FAILURE;
+}
@@ -1,84 +1,312 @@
 #include <stdio.h>
 #include <assert.h>
-#include <ctype.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <logs.h>
 #include <list.h>
 #include <array.h>
+#include <intern.h>
 #include <ast/tree.h>
 
 #include <frontend/token.h>
 #include <frontend/keyword.h>
+#include <frontend/scan.h>
 
 static token *lexer_error(const char *str) { return nullptr; }
 static token  *core_error() { return nullptr; }
 
+static token *create_token  (array *const tokens, int type);
 static token *create_keyword(array *const tokens, int keyword);
 static token *create_number (array *const tokens, const char **str);
 static token *create_ident(array *const tokens, const char *str, 
-                           array *const idents, const size_t len);
+                           intern_table *const idents, const size_t len);
 
 static token *read_keyword(array *const tokens, const char *str, 
-                           array *const idents, size_t length);
+                           intern_table *const idents, size_t length);
+
+/*
+ * Unlinkable keywords recognizer.
+ *
+ * The UNLINKABLE part of KEYWORDS is compiled into a tiny DFA at compile time.
+ * Every input byte is mapped to a byte class (space, digit, operator start...)
+ * and to the DFA alphabet symbol with two table lookups. So tokenize() does
+ * not compare each input byte against every operator string anymore.
+ *
+ * If several keywords match at the same position the one that goes first
+ * in KEYWORDS wins. It is exactly the old strncmp() chain behaviour.
+ *
+ * Define LEXER_NAIVE to get the old strncmp() chain back.
+ */
+enum lex_class {
+        LEX_OTHER   = 0x00,
+        LEX_SPACE   = 0x01,
+        LEX_DIGIT   = 0x02,
+        LEX_OP      = 0x04, /* Can start an unlinkable keyword */
+        LEX_COMMENT = 0x08,
+};
 
-token *tokenize(const char *str, array *const idents)
+#define LINKABLE(xxx)
+#define UNLINKABLE(xxx) xxx
+#define KEYWORD(name, keyword, ident) + (sizeof(ident) - 1)
+
+/* Each unlinkable keyword character adds at most one state and one symbol */
+static const size_t LEX_OP_CHARS = 0
+#include "../KEYWORDS"
+;
+
+#undef LINKABLE
+#undef UNLINKABLE
+#undef KEYWORD
+
+static const size_t LEX_STATES  = LEX_OP_CHARS + 1;
+static const size_t LEX_SYMBOLS = LEX_OP_CHARS + 1;
+
+struct lex_dfa {
+        unsigned char klass [256];
+        unsigned char symbol[256]; /* 0 -- byte is not used by any keyword */
+
+        unsigned char next[LEX_STATES][LEX_SYMBOLS]; /* 0 -- no transition */
+
+        /* Accepting states have non-zero length */
+        unsigned char length [LEX_STATES];
+        unsigned char order  [LEX_STATES]; /* Position in KEYWORDS */
+        int           keyword[LEX_STATES];
+
+        size_t n_states;
+        size_t n_symbols;
+        size_t n_keywords;
+};
+
+static constexpr void lex_dfa_insert(lex_dfa &dfa, const char *ident, 
+                                     size_t length, int keyword)
+{
+        size_t state = 0;
+        for (size_t i = 0; i < length; i++) {
+                unsigned char byte = (unsigned char)ident[i];
+                if (!i)
+                        dfa.klass[byte] |= LEX_OP;
+
+                if (!dfa.symbol[byte])
+                        dfa.symbol[byte] = (unsigned char)dfa.n_symbols++;
+
+                unsigned char sym = dfa.symbol[byte];
+                if (!dfa.next[state][sym])
+                        dfa.next[state][sym] = (unsigned char)dfa.n_states++;
+
+                state = dfa.next[state][sym];
+        }
+
+        if (!dfa.length[state]) {
+                dfa.length [state] = (unsigned char)length;
+                dfa.order  [state] = (unsigned char)dfa.n_keywords;
+                dfa.keyword[state] = keyword;
+        }
+
+        dfa.n_keywords++;
+}
+
+static constexpr lex_dfa build_lex_dfa()
+{
+        lex_dfa dfa = {};
+        dfa.n_states  = 1;
+        dfa.n_symbols = 1;
+
+        const char spaces[] = " \t\n\v\f\r";
+        for (size_t i = 0; i < sizeof(spaces) - 1; i++)
+                dfa.klass[(unsigned char)spaces[i]] |= LEX_SPACE;
+
+        for (unsigned char digit = '0'; digit <= '9'; digit++)
+                dfa.klass[digit] |= LEX_DIGIT;
+
+        dfa.klass[(unsigned char)'#'] |= LEX_COMMENT;
+
+#define LINKABLE(xxx)
+#define UNLINKABLE(xxx) xxx
+#define KEYWORD(name, keyword, ident) \
+        lex_dfa_insert(dfa, ident, sizeof(ident) - 1, keyword);
+
+#include "../KEYWORDS"
+
+#undef LINKABLE
+#undef UNLINKABLE
+#undef KEYWORD
+
+        return dfa;
+}
+
+static constexpr lex_dfa LEX_DFA = build_lex_dfa();
+
+static_assert(LEX_DFA.n_states  <= LEX_STATES,  "Lexer DFA states overflow");
+static_assert(LEX_DFA.n_symbols <= LEX_SYMBOLS, "Lexer DFA symbols overflow");
+
+/*
+ * Identifier bytes which can start an unlinkable keyword ('n' of "null").
+ * scan_word() stops at them, so tokenize() checks the keyword there.
+ */
+struct lex_breaks {
+        char bytes[SCAN_MAX_BREAKS + 1];
+        size_t n_bytes;
+};
+
+static constexpr lex_breaks build_lex_breaks()
+{
+        lex_breaks breaks = {};
+        for (size_t byte = 1; byte < 256; byte++) {
+                bool word = (byte >= '0' && byte <= '9') || (byte >= 'a' && byte <= 'z') ||
+                            (byte >= 'A' && byte <= 'Z') ||  byte == '_';
+
+                if (!word || !(LEX_DFA.klass[byte] & ~LEX_DIGIT))
+                        continue;
+
+                if (breaks.n_bytes < SCAN_MAX_BREAKS)
+                        breaks.bytes[breaks.n_bytes] = (char)byte;
+
+                breaks.n_bytes++;
+        }
+
+        return breaks;
+}
+
+static constexpr lex_breaks LEX_BREAKS = build_lex_breaks();
+
+static_assert(LEX_BREAKS.n_bytes <= SCAN_MAX_BREAKS, "Too many identifier breaks");
+
+/*
+ * Returns the length of the unlinkable keyword at str or 0.
+ */
+#ifndef LEXER_NAIVE
+static inline size_t match_keyword(const char *str, int *keyword)
 {
         assert(str);
-        assert(idents);
+        assert(keyword);
 
-        array tokens = {0};
+        size_t length = 0;
+        size_t order  = LEX_DFA.n_keywords;
+
+        size_t state = 0;
+        for (size_t i = 0; ; i++) {
+                state = LEX_DFA.next[state][LEX_DFA.symbol[(unsigned char)str[i]]];
+                if (!state)
+                        break;
+
+                if (LEX_DFA.length[state] && LEX_DFA.order[state] < order) {
+                        order    = LEX_DFA.order  [state];
+                        length   = LEX_DFA.length [state];
+                        *keyword = LEX_DFA.keyword[state];
+                }
+        }
+
+        return length;
+}
+#else /* LEXER_NAIVE */
+static inline size_t match_keyword(const char *str, int *keyword)
+{
+        assert(str);
+        assert(keyword);
+
+#define LINKABLE(xxx)
+#define UNLINKABLE(xxx) xxx
+#define KEYWORD(name, kw, ident)                                               \
+                if (!strncmp(ident, str, sizeof(ident) - 1)) {                 \
+                        *keyword = kw;                                         \
+                        return sizeof(ident) - 1;                              \
+                }
 
-        const char *start = str;
+#include "../KEYWORDS"
+
+#undef LINKABLE
+#undef UNLINKABLE 
+#undef KEYWORD 
 
-        bool comment = false;
-        while (*str != '\0') {
-                if (*str == '#')
+        return 0;
+}
+#endif /* LEXER_NAIVE */
+
+/*
+ * Lexes until there are 'n_max' tokens in 'tokens' or the source is over.
+ * Returns true if it is over. KW_STOP is not created.
+ */
+static bool lex_tokens(lexer *const lex, array *const tokens, size_t n_max)
+{
+        assert(lex);
+        assert(tokens);
+
+        const char *str   = lex->str;
+        const char *start = lex->start;
+        bool comment      = lex->comment;
+
+        intern_table *const idents = lex->idents;
+
+        while (*str != '\0' && tokens->size < n_max) {
+                unsigned char klass = LEX_DFA.klass[(unsigned char)*str];
+                if (klass & LEX_COMMENT)
                         comment = !comment;
 
+                /* Stops at the closing '#': it goes to the identifier run */
                 if (comment) {
-                        str++;
+                        str = scan_comment(str + 1);
                         continue;
                 }
 
-                if (isspace(*str)) {
+                if (klass & LEX_SPACE) {
                         if (start != str) {
-                                read_keyword(&tokens, start, 
+                                read_keyword(tokens, start, 
                                               idents, (size_t)(str - start));
                         }
-                        start = ++str;
+                        start = str = scan_spaces(str + 1);
                         continue;
                 }
 
-#define LINKABLE(xxx)
-#define UNLINKABLE(xxx) xxx
-#define KEYWORD(name, keyword, ident)                                          \
-                else if (!strncmp(ident, str, sizeof(ident) - 1)) {            \
-                        if (start != str)                                      \
-                                read_keyword(&tokens, start,                   \
-                                              idents, (size_t)(str - start));  \
-                        create_keyword(&tokens, keyword);                      \
-                        str += sizeof(ident) - 1;                              \
-                        start = str;                                           \
-                        continue;                                              \
-                }
+                int keyword = 0;
+                size_t length = 0;
+#ifndef LEXER_NAIVE
+                if (klass & LEX_OP)
+#endif /* LEXER_NAIVE */
+                        length = match_keyword(str, &keyword);
 
-                if (0) {} 
-#include "../KEYWORDS"
-#undef LINKABLE
-#undef UNLINKABLE 
-#undef KEYWORD 
+                if (length) {
+                        if (start != str)
+                                read_keyword(tokens, start,
+                                              idents, (size_t)(str - start));
+                        create_keyword(tokens, keyword);
+                        str += length;
+                        start = str;
+                        continue;
+                }
 
-                if (isdigit(*str) && start == str) {
-                        create_number(&tokens, &str);
+                if ((klass & LEX_DIGIT) && start == str) {
+                        create_number(tokens, &str);
                         start = str;
                         continue;
                 }
 
-                str++;
+                /* Digits and other identifier bytes, the run goes on */
+                str = scan_word(str + 1, LEX_BREAKS.bytes);
         }
 
+        lex->str     = str;
+        lex->start   = start;
+        lex->comment = comment;
+
+        return *str == '\0';
+}
+
+token *tokenize(const char *str, intern_table *const idents)
+{
+        assert(str);
+        assert(idents);
+
+        array tokens = {0};
+
+        lexer lex = {};
+        lex.str    = str;
+        lex.start  = str;
+        lex.idents = idents;
+
+        lex_tokens(&lex, &tokens, SIZE_MAX);
         create_keyword(&tokens, KW_STOP);
 
         token *toks = (token *)array_extract(&tokens, sizeof(token));
@@ -88,8 +316,197 @@ token *tokenize(const char *str, array *const idents)
         return toks;
 }
 
+/*
+ * Lexes up to 'n_max' tokens to 'window' and ends it with TOKEN_MORE
+ * or KW_STOP. Returns true if the source is over.
+ */
+static bool lex_window(token_stream *stream, array *const window, size_t n_max)
+{
+        assert(stream);
+        assert(window);
+
+        size_t n_kept = window->size;
+        bool over = lex_tokens(&stream->lex, window, n_max);
+        stream->n_tokens += window->size - n_kept;
+
+        token *end = over ? create_keyword(window, KW_STOP) :
+                            create_token(window, TOKEN_MORE);
+        if (end && !over)
+                end->data.stream = stream;
+
+        return over;
+}
+
+/*
+ * Lexes the window after 'n_kept' tokens already in it.
+ */
+static token *fill_window(token_stream *stream, size_t n_kept)
+{
+        assert(stream);
+
+        stream->window.size = n_kept;
+        lex_window(stream, &stream->window, TOKEN_WINDOW);
+
+        return (token *)stream->window.data;
+}
+
+static void init_stream(token_stream *stream, const char *str, intern_table *const idents)
+{
+        assert(stream);
+        assert(str);
+        assert(idents);
+
+        stream->lex.str     = str;
+        stream->lex.start   = str;
+        stream->lex.comment = false;
+        stream->lex.idents  = idents;
+
+        stream->n_tokens = 0;
+}
+
+token *open_token_stream(token_stream *stream, const char *str, intern_table *const idents)
+{
+        init_stream(stream, str, idents);
+        return fill_window(stream, 0);
+}
+
+static const size_t PIPE_SPINS = 64;
+
+/*
+ * Busy waiting for a while, the other thread is likely to be done soon.
+ */
+static inline void pipe_wait(size_t *n_spins)
+{
+        assert(n_spins);
+
+        if ((*n_spins)++ < PIPE_SPINS) {
+#ifdef __x86_64__
+                __builtin_ia32_pause();
+#endif /* __x86_64__ */
+                return;
+        }
+
+        sched_yield();
+}
+
+/*
+ * Lexer thread. The first TOKEN_LOOKAHEAD tokens of every block are
+ * reserved for the ones which the parser carries over from the previous
+ * block, see take_block().
+ */
+static void *lex_blocks(void *arg)
+{
+        assert(arg);
+        token_stream *stream = (token_stream *)arg;
+
+        for (size_t n_block = 0; ; n_block++) {
+                size_t n_spins = 0;
+                while (n_block - __atomic_load_n(&stream->n_done, __ATOMIC_ACQUIRE) >= TOKEN_BLOCKS) {
+                        if (__atomic_load_n(&stream->closed, __ATOMIC_RELAXED))
+                                return nullptr;
+
+                        pipe_wait(&n_spins);
+                }
+
+                array *block = stream->blocks + n_block % TOKEN_BLOCKS;
+                block->size = 0;
+                for (size_t i = 0; i < TOKEN_LOOKAHEAD; i++)
+                        create_token(block, TOKEN_MORE);
+
+                bool over = lex_window(stream, block, TOKEN_LOOKAHEAD + TOKEN_WINDOW);
+                __atomic_store_n(&stream->n_ready, n_block + 1, __ATOMIC_RELEASE);
+
+                if (over)
+                        return nullptr;
+        }
+}
+
+/*
+ * Takes the next lexed block and releases the previous one after 'n_kept'
+ * tokens of it are copied in front of the new one.
+ */
+static token *take_block(token_stream *stream, const token *kept, size_t n_kept)
+{
+        assert(stream);
+        assert(n_kept <= TOKEN_LOOKAHEAD);
+
+        size_t n_block = stream->n_taken;
+        size_t n_spins = 0;
+        while (__atomic_load_n(&stream->n_ready, __ATOMIC_ACQUIRE) <= n_block)
+                pipe_wait(&n_spins);
+
+        token *block = (token *)stream->blocks[n_block % TOKEN_BLOCKS].data;
+        block += TOKEN_LOOKAHEAD - n_kept;
+        if (n_kept)
+                memcpy(block, kept, n_kept * sizeof(token));
+
+        __atomic_store_n(&stream->n_done, n_block, __ATOMIC_RELEASE);
+        stream->n_taken = n_block + 1;
+
+        return block;
+}
+
+token *open_token_pipe(token_stream *stream, const char *str, intern_table *const idents)
+{
+        init_stream(stream, str, idents);
+
+        stream->pipelined = true;
+        stream->closed    = false;
+        stream->n_ready   = 0;
+        stream->n_done    = 0;
+        stream->n_taken   = 0;
+
+        if (pthread_create(&stream->lexer_thread, nullptr, lex_blocks, stream)) {
+                stream->pipelined = false;
+                return core_error();
+        }
+
+        return take_block(stream, nullptr, 0);
+}
+
+void close_token_stream(token_stream *stream)
+{
+        assert(stream);
+
+        /* The parser may stop before KW_STOP on syntax error */
+        if (stream->pipelined) {
+                __atomic_store_n(&stream->closed, true, __ATOMIC_RELAXED);
+                pthread_join(stream->lexer_thread, nullptr);
+
+                for (size_t i = 0; i < TOKEN_BLOCKS; i++)
+                        free_array(stream->blocks + i, sizeof(token));
+
+                stream->pipelined = false;
+        }
+
+        free_array(&stream->window, sizeof(token));
+}
+
+token *pull_tokens(token **toks)
+{
+        assert(toks && *toks);
+
+        token *more = *toks;
+        while (more->type != TOKEN_MORE)
+                more++;
+
+        size_t n_kept = (size_t)(more - *toks);
+        assert(n_kept <= TOKEN_LOOKAHEAD);
+
+        token_stream *stream = more->data.stream;
+        if (stream->pipelined) {
+                *toks = take_block(stream, *toks, n_kept);
+                return *toks;
+        }
+
+        memmove(stream->window.data, *toks, n_kept * sizeof(token));
+
+        *toks = fill_window(stream, n_kept);
+        return *toks;
+}
+
 static token *read_keyword(array *const tokens, const char *str, 
-                           array *const idents, size_t length) 
+                           intern_table *const idents, size_t length) 
 {
         assert(tokens);
         assert(idents);
@@ -147,31 +564,15 @@ static token *create_keyword(array *const tokens, int keyword)
         return newbie;
 }
 
-static token *create_ident(array *const tokens, const char *str, array *const idents, const size_t len)
+static token *create_ident(array *const tokens, const char *str, intern_table *const idents, const size_t len)
 {
         assert(str);
         assert(tokens);
         assert(idents);
 
-        char *ident = nullptr;
-        char **keys = (char **)idents->data;
-        for (size_t i = 0; i < idents->size; i++) {
-                if (strlen(keys[i]) == len && !strncmp(keys[i], str, len)) {
-                        ident = keys[i];
-                        break;
-                }
-        }
-
-        if (!ident) {
-                ident = (char *)calloc(len + 1, sizeof(char));
-                if (!ident)
-                        return core_error();
-
-                strncpy(ident, str, len);
-                ident[len] = '\0';
-
-                array_push(idents, &ident, sizeof(char *));
-        }
+        const char *ident = intern(idents, str, len);
+        if (!ident)
+                return core_error();
 
         token *newbie = create_token(tokens, TOKEN_IDENT);
         if (!newbie)
@@ -187,30 +588,38 @@ static token *create_number(array *const tokens, const char **str)
         assert(str && *str);
         assert(tokens);
 
-        num_t number = 0;
-        int n_skip = 0;
+        /* sscanf() calls strlen() on the whole source for every number */
+        char *end = nullptr;
+        num_t number = strtol(*str, &end, 10);
 
-        sscanf(*str, "%ld%n", &number, &n_skip);
         token *newbie = create_token(tokens, TOKEN_NUMBER);
         if (!newbie)
                 return core_error();
 
         newbie->data.number = number;
 
-        *str += n_skip;
+        *str = end;
 
         return newbie;
 }
 
-void dump_tokens(const token *toks)
+size_t count_tokens(const token *toks)
 {
         assert(toks);
-        
+
         size_t total = 0;
-        const token *iter = toks;
-        while ((iter++)->data.keyword != KW_STOP)
+        while ((toks++)->data.keyword != KW_STOP)
                 total++;
 
+        return total;
+}
+
+void dump_tokens(const token *toks)
+{
+        assert(toks);
+        
+        size_t total = count_tokens(toks);
+
         size_t line = 0;
         fprintf(logs, "Tokens dump:\n\n");
         fprintf(logs, "%s", "================================================\n"
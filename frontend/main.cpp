@@ -1,11 +1,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <logs.h>
+#include <trace.h>
 #include <array.h>
 #include <errno.h>
 #include <iommap.h>
-#include <time.h>
+#include <stats.h>
 
 #include <ast/tree.h>
 #include <frontend/token.h>
@@ -16,80 +18,133 @@ static int file_error(const char *file_name);
 
 int main(int argc, char *argv[])
 {
-        if (argc != 3)
+        stats_format stats = STATS_NONE;
+        argc = stats_options(argc, argv, &stats);
+        if (argc < 3 || argc > 6)
                 return input_error();
 
         const char *src_file  = argv[1];
         const char *tree_file = argv[2];
 
-        FILE *out = fopen(tree_file, "w");
-        if (!out)
-                return file_error(tree_file);
+        /* Text tree is only for debugging, binary one is loaded much faster */
+        bool text = false;
+        /* Lexer runs on its own thread */
+        bool pipeline = false;
+        /* Top-level definitions are parsed on all the CPUs */
+        bool parallel = false;
+        for (int i = 3; i < argc; i++) {
+                if (!strcmp(argv[i], "--text"))
+                        text = true;
+                else if (!strcmp(argv[i], "--pipeline"))
+                        pipeline = true;
+                else if (!strcmp(argv[i], "--parallel"))
+                        parallel = true;
+                else
+                        return input_error();
+        }
+
+        if (pipeline && parallel)
+                return input_error();
 
-        clock_t init = clock();
-        clock_t start = clock();
+        size_t total = stats_begin("tr");
         mmap_data md = {0};
         int error = mmap_in(&md, src_file);
         if (error)
                 return EXIT_FAILURE;
 
-        array names = {0};
+        FILE *out = nullptr;
+        if (text) {
+                out = fopen(tree_file, "w");
+                if (!out) {
+                        mmap_free(&md);
+                        return file_error(tree_file);
+                }
+        }
+
+        intern_table names = {0};
 
-        token *toks = tokenize(md.buf, &names);
-        dump_tokens(toks);
+        ast_arena arena = {};
+        bind_ast_arena(&arena);
 
-        clock_t end = clock();
-        fprintf(stderr, ascii(BLUE, "Tokens created: %lf sec\n"), (end - start) / CLOCKS_PER_SEC);
-        mmap_free(&md);
+        /* The whole tokens array is only made for the dump */
+        if (trace_enabled(TRACE_DUMP)) {
+                token *toks = tokenize(md.buf, &names);
+                dump_tokens(toks);
+                free(toks);
+        }
 
-$       (dump_tokens(toks);)
-$       (dump_array(&names, sizeof(char *), array_string);)
+        size_t phase = 0;
+        ast_node *tree = nullptr;
+        if (parallel) {
+                /* Definitions are found in the whole tokens array */
+                phase = stats_begin("tokenize");
+                token *toks = tokenize(md.buf, &names);
+                stats_end(phase, toks ? count_tokens(toks) : 0, "tokens");
 
-        token *iter = toks;
-        ast_node *tree = grammar_rule(&iter);
-        start = clock();
-        fprintf(stderr, ascii(BLUE, "Tree created:   %lf sec\n"), (start - end) / CLOCKS_PER_SEC);
+                long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+                phase = stats_begin("parallel_grammar_rule");
+                token *iter = toks;
+                tree = toks ? parallel_grammar_rule(&iter, n_cpus > 0 ? (size_t)n_cpus : 1) : nullptr;
+                stats_end(phase, arena.n_nodes, "nodes");
 
-        if (!tree) {
                 free(toks);
-                char **data = (char **)names.data;
-                for (size_t i = 0; i < names.size; i++) {
-                        free(data[i]);
-                }
+        } else {
+                /* Tokens are lexed on demand by the parser */
+                phase = stats_begin("grammar_rule");
+                token_stream stream = {};
+                token *iter = pipeline ? open_token_pipe  (&stream, md.buf, &names) :
+                                         open_token_stream(&stream, md.buf, &names);
+                tree = iter ? grammar_rule(&iter) : nullptr;
+                stats_end(phase, arena.n_nodes, "nodes");
+
+                close_token_stream(&stream);
+        }
+
+        mmap_free(&md);
 
-                free_array(&names, sizeof(char *));
+        trace_dump(dump_intern(&names));
+
+        if (!tree) {
+                free_intern(&names);
+                free_ast_arena(&arena);
+                if (out)
+                        fclose(out);
 
                 fprintf(stderr, ascii(RED, "..................\n"
                                            "Compilation failed\n"));
                 return EXIT_FAILURE;
         }
 
-        if (tree) {
-                $(dump_tree(tree);)
-        }
+        trace_dump(dump_tree(tree));
 
-        save_ast_tree(out, tree);
+        phase = stats_begin(text ? "save_ast_tree" : "save_ast_binary");
+        if (text)
+                save_ast_tree(out, tree);
+        else
+                error = save_ast_binary(tree_file, tree);
 
-        end = clock();
-        fprintf(stderr, ascii(BLUE, "Tree saved:     %lf sec\n"), (end - start) / CLOCKS_PER_SEC);
-        free(toks);
+        stats_end(phase, arena.n_nodes, "nodes");
+        free_intern(&names);
+        free_ast_arena(&arena);
+        if (out)
+                fclose(out);
 
-        char **data = (char **)names.data;
-        for (size_t i = 0; i < names.size; i++) {
-                free(data[i]);
+        if (error) {
+                fprintf(stderr, ascii(RED, "Can't save tree\n"));
+                return EXIT_FAILURE;
         }
 
-        free_array(&names, sizeof(char *));
-        fclose(out);
+        stats_end(total);
+        stats_report(stdout, stats);
 
-        end = clock();
-        fprintf(stderr, ascii(GREEN, "Abstract syntax tree compiled: %lf sec\n"), (end - init) / CLOCKS_PER_SEC);
+        fprintf(stderr, ascii(GREEN, "Abstract syntax tree compiled\n"));
         return EXIT_SUCCESS;
 }
 
 static int input_error()
 {
-        fprintf(stderr, ascii(RED, "There must be 3 arguments\n"));
+        fprintf(stderr, ascii(RED, "Usage: tr [--stats[=text|json]] [source] [tree] [--text] [--pipeline | --parallel]\n"));
         return EXIT_FAILURE;
 }
 
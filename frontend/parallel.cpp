@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <logs.h>
+#include <array.h>
+
+#include <ast/tree.h>
+#include <ast/keyword.h>
+
+#include <frontend/keyword.h>
+#include <frontend/token.h>
+#include <frontend/compile.h>
+
+/*
+ * Parallel parsing of top-level definitions.
+ *
+ * Definitions are independent, so the token array is split into chunks
+ * of whole definitions by matching brackets, without parsing. Chunks
+ * are parsed by the workers in any order, every worker allocates nodes
+ * from its own arena. Then the chunks are linked to the AST_STMT chain
+ * in the source order, as grammar_rule() does.
+ *
+ * If any chunk fails, the whole array is parsed by grammar_rule(), so
+ * syntax errors are reported as before.
+ */
+
+/* Chunks are at least this long, so there are few of them */
+static const size_t CHUNK_TOKENS = 4096;
+
+struct parse_chunk {
+        token *begin = nullptr; /* the first definition            */
+        token *end   = nullptr; /* the token after the last one     */
+
+        ast_node *first = nullptr; /* AST_STMT of the first definition */
+        ast_node *last  = nullptr; /* AST_STMT of the last one, root   */
+};
+
+struct parse_pool {
+        parse_chunk *chunks = nullptr;
+        size_t n_chunks = 0;
+
+        size_t next = 0;     /* the chunk to take, atomic  */
+        bool failed = false; /* atomic */
+};
+
+struct parse_worker {
+        parse_pool *pool = nullptr;
+        ast_arena arena  = {};
+
+        pthread_t thread = {};
+};
+
+static int keyword(const token *tok)
+{
+        assert(tok);
+        return tok->type == TOKEN_KEYWORD ? tok->data.keyword : 0;
+}
+
+/*
+ * A definition starts with 'dump' or 'assert' out of any brackets right
+ * after ';' or '}'. Function body may be a single statement, so it is
+ * not the one after ')'. Returns false if brackets don't match.
+ */
+static bool split_chunks(token *toks, array *const chunks)
+{
+        assert(toks);
+        assert(chunks);
+
+        long depth = 0;
+        int  prev  = KW_SEMICOL;
+
+        parse_chunk chunk = {};
+        chunk.begin = toks;
+
+        token *tok = toks;
+        for ( ; keyword(tok) != KW_STOP; tok++) {
+                int kw = keyword(tok);
+                switch (kw) {
+                case KW_OPEN:
+                case KW_BEGIN:
+                case KW_QOPEN:
+                        depth++;
+                        break;
+                case KW_CLOSE:
+                case KW_END:
+                case KW_QCLOSE:
+                        if (--depth < 0)
+                                return false;
+                        break;
+                case KW_DEFINE:
+                case KW_ASSERT:
+                        if (depth || (prev != KW_SEMICOL && prev != KW_END))
+                                break;
+
+                        if ((size_t)(tok - chunk.begin) >= CHUNK_TOKENS) {
+                                chunk.end = tok;
+                                if (!array_push(chunks, &chunk, sizeof(parse_chunk)))
+                                        return false;
+
+                                chunk.begin = tok;
+                        }
+                        break;
+                default:
+                        break;
+                }
+
+                prev = kw;
+        }
+
+        if (depth)
+                return false;
+
+        chunk.end = tok;
+        return array_push(chunks, &chunk, sizeof(parse_chunk));
+}
+
+/*
+ * The chunk must be parsed exactly up to its end.
+ */
+static bool parse_chunk_range(parse_chunk *chunk)
+{
+        assert(chunk);
+
+        token *iter = chunk->begin;
+        while (iter < chunk->end) {
+                ast_node *stmt = toplevel_rule(&iter);
+                if (!stmt)
+                        return false;
+
+                stmt->left = chunk->last;
+                chunk->last = stmt;
+
+                if (!chunk->first)
+                        chunk->first = stmt;
+        }
+
+        return iter == chunk->end;
+}
+
+static void parse_chunks(parse_pool *pool)
+{
+        assert(pool);
+
+        bool silent = silence_syntax_errors(true);
+        while (!__atomic_load_n(&pool->failed, __ATOMIC_RELAXED)) {
+                size_t i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+                if (i >= pool->n_chunks)
+                        break;
+
+                if (!parse_chunk_range(pool->chunks + i))
+                        __atomic_store_n(&pool->failed, true, __ATOMIC_RELAXED);
+        }
+
+        silence_syntax_errors(silent);
+}
+
+static void *parse_worker_thread(void *arg)
+{
+        assert(arg);
+        parse_worker *worker = (parse_worker *)arg;
+
+        bind_ast_arena(&worker->arena);
+        parse_chunks(worker->pool);
+        bind_ast_arena(nullptr);
+
+        return nullptr;
+}
+
+ast_node *parallel_grammar_rule(token **toks, size_t n_threads)
+{
+        assert(toks && *toks);
+
+        if (n_threads < 2)
+                return grammar_rule(toks);
+
+        array chunks = {0};
+        if (!split_chunks(*toks, &chunks) || chunks.size < 2) {
+                free_array(&chunks, sizeof(parse_chunk));
+                return grammar_rule(toks);
+        }
+
+        parse_pool pool = {};
+        pool.chunks   = (parse_chunk *)chunks.data;
+        pool.n_chunks = chunks.size;
+
+        if (n_threads > PARSE_MAX_THREADS)
+                n_threads = PARSE_MAX_THREADS;
+        if (n_threads > pool.n_chunks)
+                n_threads = pool.n_chunks;
+
+        /* The calling thread is the first worker */
+        parse_worker workers[PARSE_MAX_THREADS] = {};
+        size_t n_workers = 1;
+        for ( ; n_workers < n_threads; n_workers++) {
+                parse_worker *worker = workers + n_workers;
+                worker->pool = &pool;
+
+                if (pthread_create(&worker->thread, nullptr, parse_worker_thread, worker))
+                        break;
+        }
+
+        parse_chunks(&pool);
+
+        ast_arena *arena = bind_ast_arena(nullptr);
+        bind_ast_arena(arena);
+
+        for (size_t i = 1; i < n_workers; i++) {
+                pthread_join(workers[i].thread, nullptr);
+                merge_ast_arena(arena, &workers[i].arena);
+        }
+
+        ast_node *root = nullptr;
+        if (!pool.failed) {
+                for (size_t i = 1; i < pool.n_chunks; i++)
+                        pool.chunks[i].first->left = pool.chunks[i - 1].last;
+
+                root  = pool.chunks[pool.n_chunks - 1].last;
+                *toks = pool.chunks[pool.n_chunks - 1].end;
+        }
+
+        free_array(&chunks, sizeof(parse_chunk));
+
+        /* Nodes of the failed parse are released with the arena */
+        if (!root)
+                return grammar_rule(toks);
+
+        return root;
+}
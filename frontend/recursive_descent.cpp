@@ -2,12 +2,14 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <logs.h>
+#include <trace.h>
 
 #include <ast/tree.h>
 #include <ast/keyword.h>
 
 #include <frontend/keyword.h>
 #include <frontend/token.h>
+#include <frontend/compile.h>
 
 //#define ERROR_TRACE
 
@@ -46,17 +48,20 @@ static int       keyword(token *tok);
 static num_t     *number(token *tok);
 static const char *ident(token *tok);
 
-ast_node    *grammar_rule(token **toks);
 ast_node     *assign_rule(token **toks);
 ast_node     *define_rule(token **toks);
 ast_node      *block_rule(token **toks);
 ast_node  *statement_rule(token **toks);
 ast_node *expression_rule(token **toks);
+#ifdef PARSER_CASCADE
 ast_node   *additive_rule(token **toks);
 ast_node     *factor_rule(token **toks);
-ast_node   *exponent_rule(token **toks);
 ast_node    *boolean_rule(token **toks);
 ast_node    *logical_rule(token **toks);
+#else
+static ast_node *binary_rule(token **toks, int min_precedence);
+#endif /* PARSER_CASCADE */
+ast_node   *exponent_rule(token **toks);
 
 ast_node         *if_rule(token **toks);
 ast_node      *while_rule(token **toks);
@@ -71,27 +76,26 @@ ast_node *create_ast(const char *source_code)
 {
         assert(source_code);
 
-        array names = {0};
+        ast_arena arena = {};
+        ast_arena *prev = bind_ast_arena(&arena);
+
+        intern_table names = {0};
         token *toks = tokenize(source_code, &names);
         fprintf(logs, "\n\n%s\n\n", source_code);
-$       (dump_tokens(toks);)
-$       (dump_array(&names, sizeof(char *), array_string);)
+        trace_dump(dump_tokens(toks));
+        trace_dump(dump_intern(&names));
 
         token *iter = toks;
 
         ast_node *tree = grammar_rule(&iter);
         fprintf(logs, "\n\n%s\n\n", source_code);
-        $(dump_tree(tree);)
+        trace_dump(dump_tree(tree));
 
-        free_tree(tree);
+        free_ast_arena(&arena);
+        bind_ast_arena(prev);
         free(toks);
 
-        char **data = (char **)names.data;
-        for (size_t i = 0; i < names.size; i++) {
-                free(data[i]);
-        }
-
-        free_array(&names, sizeof(char *));
+        free_intern(&names);
 
         return nullptr;
 }
@@ -105,34 +109,9 @@ ast_node *grammar_rule(token **toks)
         while (keyword(*toks) == KW_DEFINE || 
                keyword(*toks) == KW_ASSERT) { 
 
-                ast_node *stmt = create_ast_keyword(AST_STMT);
+                ast_node *stmt = toplevel_rule(toks);
                 if (!stmt)
-                        return core_error(toks);
-
-                switch (keyword(*toks)) {
-
-                case KW_ASSERT:
-                        require(KW_ASSERT);
-                        require(KW_OPEN);
-
-                        stmt->right = assign_rule(toks);
-                        if (!stmt->right)
-                                return syntax_error(toks);
-
-                        require(KW_CLOSE);
-                        require(KW_SEMICOL);
-                        break;
-                case KW_DEFINE:
-                        move(toks);
-
-                        stmt->right = define_rule(toks);
-                        if (!stmt->right)
-                                return syntax_error(toks);
-                        break;
-                default:
-                        assert(0);
-                        break;
-                }
+                        return nullptr;
 
                 stmt->left = root;
                 root = stmt;
@@ -144,6 +123,41 @@ ast_node *grammar_rule(token **toks)
         return root;
 }
 
+ast_node *toplevel_rule(token **toks)
+{
+        assert(toks);
+
+        ast_node *stmt = create_ast_keyword(AST_STMT);
+        if (!stmt)
+                return core_error(toks);
+
+        switch (keyword(*toks)) {
+
+        case KW_ASSERT:
+                require(KW_ASSERT);
+                require(KW_OPEN);
+
+                stmt->right = assign_rule(toks);
+                if (!stmt->right)
+                        return syntax_error(toks);
+
+                require(KW_CLOSE);
+                require(KW_SEMICOL);
+                break;
+        case KW_DEFINE:
+                move(toks);
+
+                stmt->right = define_rule(toks);
+                if (!stmt->right)
+                        return syntax_error(toks);
+                break;
+        default:
+                return syntax_error(toks);
+        }
+
+        return stmt;
+}
+
 ast_node *assign_rule(token **toks)
 {
         assert(toks);
@@ -182,69 +196,50 @@ ast_node *assign_rule(token **toks)
 ast_node *define_rule(token **toks)
 {
         assert(toks);
-$$
+        trace_point(TRACE_FRONTEND, *toks);
         ast_node *root = create_ast_keyword(AST_DEFINE);
-$$
         if (!root)
                 return core_error(toks);
 
-$$
         ast_node *func = create_ast_keyword(AST_FUNC);
-$$
         if (!func)
                 return core_error(toks);
-$$
 
         func->left = ident_rule(toks);
-$$
         if (!func->left)
                 return syntax_error(toks);
-$$
 
         root->left = func;
-$$
 
         require(KW_OPEN);
-$$
 
         if (ident(*toks)) {
-$$
                 func->right = create_ast_keyword(AST_PARAM);
-$$
                 if (!func->right)
                         return core_error(toks);
-$$
 
                 func->right->right = ident_rule(toks);
-$$
                 if (!func->right->right)
                         return syntax_error(toks);
 
-$$
                 while (keyword(*toks) == KW_COMMA) {
-$$
                         require(KW_COMMA);
                         ast_node *param = create_ast_keyword(AST_PARAM);
                         if (!param)
                                 return core_error(toks);
-$$
 
                         param->right = ident_rule(toks);
                         if (!param->right)
                                 return syntax_error(toks);
-$$
 
                         param->left = func->right;
                         func->right = param;
                 }
         }
-$$
 
         require(KW_CLOSE);
 
-$$
         root->right = block_rule(toks);
-$$
         if (!root->right)
                 return syntax_error(toks);
 
@@ -275,7 +270,6 @@ ast_node *block_rule(token **toks)
 
                                 last->left = root;
                                 root = stmt->right;
-                                free(stmt);
                                 continue;
                         }
 
@@ -467,6 +461,121 @@ ast_node *statement_rule(token **toks)
         return root;
 }
 
+#ifndef PARSER_CASCADE
+/*
+ * Binary operators parser.
+ *
+ * Expressions are parsed by precedence climbing. Operators table is
+ * built from OPERATORS at compile time, so an operand doesn't go through
+ * a rule per precedence level: one binary_rule() call takes all the
+ * operators of its precedence and higher ones. Trees are the same as
+ * the rules cascade makes.
+ *
+ * Define PARSER_CASCADE to get the cascade back.
+ */
+enum parse_assoc {
+        ASSOC_LEFT = 0,
+        ASSOC_NONE = 1,
+};
+
+struct parse_op {
+        int ast;
+        int precedence; /* 0 -- the keyword is not a binary operator */
+        parse_assoc assoc;
+};
+
+static const size_t PARSE_KEYWORDS = 256;
+
+struct parse_ops {
+        parse_op ops[PARSE_KEYWORDS];
+};
+
+#define OPERATOR(kw, node, prec, assoc)                                 \
+        static_assert(KW_##kw > 0 && KW_##kw < PARSE_KEYWORDS,          \
+                      "Operator keyword is out of the table");          \
+        static_assert(prec > 0, "Operator precedence must be positive");
+
+#include "../OPERATORS"
+
+#undef OPERATOR
+
+static constexpr parse_ops build_parse_ops()
+{
+        parse_ops table = {};
+
+#define OPERATOR(kw, node, prec, assoc) \
+        table.ops[KW_##kw] = {AST_##node, prec, ASSOC_##assoc};
+
+#include "../OPERATORS"
+
+#undef OPERATOR
+
+        return table;
+}
+
+static constexpr parse_ops PARSE_OPS = build_parse_ops();
+
+static inline const parse_op *binary_op(token *tok)
+{
+        int kw = keyword(tok);
+        if (kw < 0 || (size_t)kw >= PARSE_KEYWORDS)
+                kw = 0;
+
+        return PARSE_OPS.ops + kw;
+}
+
+/*
+ * Parses operators of 'min_precedence' and higher ones. The right
+ * operand takes only higher ones, so equal operators go left to right.
+ */
+static ast_node *binary_rule(token **toks, int min_precedence)
+{
+        assert(toks);
+
+        ast_node *root = exponent_rule(toks);
+        if (!root)
+                return syntax_error(toks);
+
+        for (;;) {
+                const parse_op *op = binary_op(*toks);
+                if (op->precedence < min_precedence)
+                        break;
+
+                move(toks);
+
+                ast_node *node = create_ast_keyword(op->ast);
+                if (!node)
+                        return core_error(toks);
+
+                node->right = binary_rule(toks, op->precedence + 1);
+                if (!node->right)
+                        return syntax_error(toks);
+
+                node->left = root;
+                root = node;
+
+                /*
+                 * The right operand leaves an operator it could take only
+                 * after a non-associative one. Then the whole expression
+                 * ends there, as it did in the cascade: a * b ^ c ^ d.
+                 */
+                int next = binary_op(*toks)->precedence;
+                if (next > op->precedence ||
+                   (next == op->precedence && op->assoc == ASSOC_NONE))
+                        break;
+        }
+
+        return root;
+}
+
+ast_node *expression_rule(token **toks)
+{
+        assert(toks);
+
+        return binary_rule(toks, 1);
+}
+
+#else /* PARSER_CASCADE */
 ast_node *boolean_rule(token **toks)
 {
         assert(toks);
@@ -659,6 +768,7 @@ ast_node *factor_rule(token **toks)
 
         return root;
 }
+#endif /* PARSER_CASCADE */
 
 
 ast_node *function_rule(token **toks) 
@@ -859,10 +969,24 @@ ast_node *ident_rule(token **toks)
         return root;
 }
 
+/*
+ * Parallel parser workers don't report errors, see frontend/parallel.cpp.
+ */
+static thread_local bool SILENT = false;
+
+bool silence_syntax_errors(bool silent)
+{
+        bool prev = SILENT;
+        SILENT = silent;
+        return prev;
+}
+
 #ifndef ERROR_TRACE
 static ast_node *syntax_error(token **toks)
 {
         assert(toks);
+        if (SILENT)
+                return nullptr;
 
         fprintf(stderr, ascii(RED, "Syntax error -- "));
         print_token(*toks);
@@ -873,6 +997,8 @@ static ast_node *syntax_error(token **toks)
 static ast_node *core_error(token **toks)
 {
         assert(toks);
+        if (SILENT)
+                return nullptr;
 
         fprintf(stderr, ascii(RED, "Core error -- "));
         print_token(*toks);
@@ -880,9 +1006,17 @@ static ast_node *core_error(token **toks)
 }
 #endif
 
+/*
+ * Tokens may come from the token_stream, its windows are ended by
+ * TOKEN_MORE. There is nothing after KW_STOP.
+ */
 static token *next(token **toks) 
 {
         assert(toks);
+
+        if (keyword(*toks) != KW_STOP && (*toks)[1].type == TOKEN_MORE)
+                pull_tokens(toks);
+
         return (*toks) + 1;
 }
 
@@ -890,6 +1024,10 @@ static token *move(token **toks)
 {
         assert(toks);
         (*toks)++;
+
+        if ((*toks)->type == TOKEN_MORE)
+                pull_tokens(toks);
+
         return (*toks);
 }
 
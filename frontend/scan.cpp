@@ -0,0 +1,285 @@
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <frontend/scan.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif /* __x86_64__ */
+
+/* Vector loads are aligned, so they never cross a page. But the aligned
+   block may end after '\0', out of the object as ASan sees it. */
+#define SCAN_NO_ASAN __attribute__((no_sanitize_address))
+
+struct scan_ops {
+        const char *(*spaces) (const char *str);
+        const char *(*comment)(const char *str);
+        const char *(*word)   (const char *str, const char *breaks);
+};
+
+static inline bool is_space(char c)
+{
+        return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+static inline bool is_word(char c)
+{
+        return (unsigned char)(c - '0') <= 9 || (unsigned char)((c | 0x20) - 'a') <= 25 || c == '_';
+}
+
+static const char *scalar_spaces(const char *str)
+{
+        while (is_space(*str))
+                str++;
+
+        return str;
+}
+
+static const char *scalar_comment(const char *str)
+{
+        while (*str != '#' && *str != '\0')
+                str++;
+
+        return str;
+}
+
+static const char *scalar_word(const char *str, const char *breaks)
+{
+        while (is_word(*str) && !strchr(breaks, *str))
+                str++;
+
+        return str;
+}
+
+static const scan_ops SCALAR_OPS = {
+        scalar_spaces,
+        scalar_comment,
+        scalar_word,
+};
+
+#ifdef __x86_64__
+
+/*
+ * SSE2 has no unsigned comparisons: lo <= x <= lo + n is min(x - lo, n) == x - lo.
+ */
+static inline __m128i sse2_range(__m128i x, char lo, char n)
+{
+        __m128i t = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+        return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(n)), t);
+}
+
+static inline unsigned sse2_spaces_stop(__m128i x)
+{
+        __m128i space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                     sse2_range(x, '\t', '\r' - '\t'));
+
+        return ~(unsigned)_mm_movemask_epi8(space) & 0xffff;
+}
+
+static inline unsigned sse2_comment_stop(__m128i x)
+{
+        __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('#')),
+                                    _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+
+        return (unsigned)_mm_movemask_epi8(stop);
+}
+
+static inline unsigned sse2_word_stop(__m128i x, const char *breaks)
+{
+        __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        __m128i word  = _mm_or_si128(_mm_or_si128(sse2_range(x, '0', 9),
+                                                  sse2_range(lower, 'a', 25)),
+                                     _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+
+        for (; *breaks; breaks++)
+                word = _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(*breaks)), word);
+
+        return ~(unsigned)_mm_movemask_epi8(word) & 0xffff;
+}
+
+/*
+ * Bytes before 'str' in the first aligned block are masked out.
+ */
+#define SSE2_SCAN(str, stop_mask, ...)                                              \
+        do {                                                                        \
+                size_t skip = (uintptr_t)(str) & 0xf;                               \
+                const __m128i *block = (const __m128i *)((str) - skip);             \
+                                                                                    \
+                unsigned stop = stop_mask(_mm_load_si128(block), ##__VA_ARGS__);    \
+                stop &= ~0u << skip;                                                \
+                while (!stop)                                                       \
+                        stop = stop_mask(_mm_load_si128(++block), ##__VA_ARGS__);   \
+                                                                                    \
+                return (const char *)block + __builtin_ctz(stop);                   \
+        } while (0)
+
+SCAN_NO_ASAN static const char *sse2_spaces(const char *str)
+{
+        SSE2_SCAN(str, sse2_spaces_stop);
+}
+
+SCAN_NO_ASAN static const char *sse2_comment(const char *str)
+{
+        SSE2_SCAN(str, sse2_comment_stop);
+}
+
+SCAN_NO_ASAN static const char *sse2_word(const char *str, const char *breaks)
+{
+        SSE2_SCAN(str, sse2_word_stop, breaks);
+}
+
+static const scan_ops SSE2_OPS = {
+        sse2_spaces,
+        sse2_comment,
+        sse2_word,
+};
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i avx2_range(__m256i x, char lo, char n)
+{
+        __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(n)), t);
+}
+
+AVX2 static inline unsigned avx2_spaces_stop(__m256i x)
+{
+        __m256i space = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                                        avx2_range(x, '\t', '\r' - '\t'));
+
+        return ~(unsigned)_mm256_movemask_epi8(space);
+}
+
+AVX2 static inline unsigned avx2_comment_stop(__m256i x)
+{
+        __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('#')),
+                                       _mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+
+        return (unsigned)_mm256_movemask_epi8(stop);
+}
+
+AVX2 static inline unsigned avx2_word_stop(__m256i x, const char *breaks)
+{
+        __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+        __m256i word  = _mm256_or_si256(_mm256_or_si256(avx2_range(x, '0', 9),
+                                                        avx2_range(lower, 'a', 25)),
+                                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+
+        for (; *breaks; breaks++)
+                word = _mm256_andnot_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(*breaks)), word);
+
+        return ~(unsigned)_mm256_movemask_epi8(word);
+}
+
+#define AVX2_SCAN(str, stop_mask, ...)                                              \
+        do {                                                                        \
+                size_t skip = (uintptr_t)(str) & 0x1f;                              \
+                const __m256i *block = (const __m256i *)((str) - skip);             \
+                                                                                    \
+                unsigned stop = stop_mask(_mm256_load_si256(block), ##__VA_ARGS__); \
+                stop &= ~0u << skip;                                                \
+                while (!stop)                                                       \
+                        stop = stop_mask(_mm256_load_si256(++block), ##__VA_ARGS__);\
+                                                                                    \
+                return (const char *)block + __builtin_ctz(stop);                   \
+        } while (0)
+
+AVX2 SCAN_NO_ASAN static const char *avx2_spaces(const char *str)
+{
+        AVX2_SCAN(str, avx2_spaces_stop);
+}
+
+AVX2 SCAN_NO_ASAN static const char *avx2_comment(const char *str)
+{
+        AVX2_SCAN(str, avx2_comment_stop);
+}
+
+AVX2 SCAN_NO_ASAN static const char *avx2_word(const char *str, const char *breaks)
+{
+        AVX2_SCAN(str, avx2_word_stop, breaks);
+}
+
+static const scan_ops AVX2_OPS = {
+        avx2_spaces,
+        avx2_comment,
+        avx2_word,
+};
+
+#endif /* __x86_64__ */
+
+static const scan_ops *isa_ops(scan_isa isa)
+{
+        switch (isa) {
+#ifdef __x86_64__
+        case SCAN_AVX2:
+                return &AVX2_OPS;
+        case SCAN_SSE2:
+                return &SSE2_OPS;
+#endif /* __x86_64__ */
+        case SCAN_SCALAR:
+        default:
+                return &SCALAR_OPS;
+        }
+}
+
+scan_isa detect_scan_isa()
+{
+#ifdef __x86_64__
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+                return SCAN_AVX2;
+
+        /* x86-64 baseline */
+        return SCAN_SSE2;
+#else /* __x86_64__ */
+        return SCAN_SCALAR;
+#endif /* __x86_64__ */
+}
+
+static scan_isa current_isa = detect_scan_isa();
+static const scan_ops *current = isa_ops(current_isa);
+
+scan_isa set_scan_isa(scan_isa isa)
+{
+        scan_isa prev = current_isa;
+        if (isa > detect_scan_isa())
+                return prev;
+
+        current_isa = isa;
+        current     = isa_ops(isa);
+
+        return prev;
+}
+
+const char *scan_isa_string(scan_isa isa)
+{
+        switch (isa) {
+        case SCAN_AVX2:
+                return "avx2";
+        case SCAN_SSE2:
+                return "sse2";
+        case SCAN_SCALAR:
+        default:
+                return "scalar";
+        }
+}
+
+const char *scan_spaces(const char *str)
+{
+        assert(str);
+        return current->spaces(str);
+}
+
+const char *scan_comment(const char *str)
+{
+        assert(str);
+        return current->comment(str);
+}
+
+const char *scan_word(const char *str, const char *breaks)
+{
+        assert(str);
+        assert(breaks);
+        return current->word(str, breaks);
+}
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <array.h>
+#include <intern.h>
 
 typedef int64_t num_t;
 
@@ -39,6 +40,34 @@ ast_node *create_ast_keyword(int keyword);
 ast_node *create_ast_number(num_t number);
 ast_node *create_ast_ident  (const char *ident);
 
+struct ast_chunk;
+
+/*
+ * Bump-pointer nodes allocator.
+ *
+ * Nodes are placed contiguously in chunks and can't be freed one by one.
+ * The whole tree is released at once by free_ast_arena().
+ */
+struct ast_arena {
+        ast_chunk *chunks = nullptr;
+        size_t n_nodes    = 0;
+};
+
+/*
+ * Binds 'arena' to the current thread. create_ast_node() and
+ * all the other node constructors allocate from the bound arena.
+ *
+ * Returns the previously bound arena.
+ */
+ast_arena *bind_ast_arena(ast_arena *arena);
+void free_ast_arena(ast_arena *arena);
+
+/*
+ * Moves all the nodes of 'src' to 'dst', so they are released with 'dst'.
+ * It is used to collect the trees built by several threads.
+ */
+void merge_ast_arena(ast_arena *dst, ast_arena *src);
+
 /*
  * Jumps from node to node recursively. 
  * Then applies 'action' to the current node.
@@ -47,14 +76,87 @@ ast_node *create_ast_ident  (const char *ident);
  */
 void visit_tree(ast_node *root, void (*action)(ast_node *nd));
 
-void free_tree(ast_node *root);
 ast_node *create_ast_node(int type);
 ast_node *copy_tree(ast_node *n);
 
+/*
+ * Text format: "(left data right)". Readable, so keep it for debugging.
+ */
 void save_ast_tree(FILE *file, ast_node *const tree);
-ast_node *read_ast_tree(char **str, array *const idents);
+ast_node *read_ast_tree(char **str, intern_table *const idents);
+
+/*
+ * Binary format: header, identifiers table and pre-order node records.
+ * See ast/binary.cpp. The file is written and read via mmap.
+ */
+int save_ast_binary(const char *file, ast_node *const tree);
+ast_node *read_ast_binary(const char *buf, size_t size, intern_table *const idents);
+bool is_ast_binary(const char *buf, size_t size);
+
+/*
+ * Reads the tree in any format. Binary one is detected by its magic.
+ * Note! Text parser needs null-terminated 'buf' as mmap_in() gives.
+ */
+ast_node *load_ast_tree(char *buf, size_t size, intern_table *const idents);
+
+/*
+ * Folds constant expressions and simplifies identities like 'x * 1'
+ * in place, see ast/fold.cpp. Returns the new root. The number of
+ * eliminated nodes is stored in 'n_folded' if it's not null.
+ */
+ast_node *fold_tree(ast_node *root, size_t *n_folded = nullptr);
+
+/*
+ * Removes functions unreachable from main() and global initializers,
+ * statements after return and branches with constant conditions,
+ * see ast/dce.cpp. Runs after fold_tree(). The number of eliminated
+ * nodes is stored in 'n_dead' if it's not null.
+ */
+ast_node *eliminate_dead_code(ast_node *root, size_t *n_dead = nullptr);
+
+/*
+ * Control never passes to the statement after 'stmt': it returns
+ * on all paths or loops forever.
+ */
+bool is_terminating(const ast_node *stmt);
+
+const size_t INLINE_BUDGET = 64;
+
+/*
+ * Substitutes bodies of small leaf functions at the call sites, see
+ * ast/inline.cpp. Bodies larger than 'budget' nodes are not inlined.
+ * Callee locals get new names interned to 'idents'. The number of
+ * inlined calls is stored in 'n_inlined' if it's not null.
+ */
+ast_node *inline_calls(ast_node *root, intern_table *idents,
+                       size_t budget = INLINE_BUDGET, size_t *n_inlined = nullptr);
+
+struct ast_tail_call {
+        ast_node *call    = nullptr;
+        ast_node *operand = nullptr;    /* accumulated, if any */
+        int op = 0;                     /* AST_ADD or AST_MUL */
+};
+
+/*
+ * Matches 'return f(...)', 'return e + f(...)' and 'return e * f(...)'
+ * in the function 'func' with the AST_PARAM chain 'params', see
+ * ast/tail.cpp. 'func' is interned.
+ */
+bool match_tail_call(const ast_node *ret, const char *func, const ast_node *params,
+                     ast_tail_call *tail);
+
+/*
+ * Returns the operation of the accumulating tail calls of the function
+ * or AST_NULL if there are none or they use different operations.
+ */
+int tail_accumulator(const ast_node *define);
 
 size_t calc_tree_size(ast_node *n);
+
+/*
+ * Returns the first node where the trees differ or nullptr
+ * if they are the same.
+ */
 ast_node *compare_trees(ast_node *t1, ast_node *t2);
 
 const char *ast_keyword_string(int keyword);
@@ -3,9 +3,11 @@
 
 #include <elf.h>
 #include <stack.h>
+#include <array.h>
 #include <ast/tree.h>
 #include <backend/legacy/iencode.h>
 #include <backend/legacy/elf64.h>
+#include <backend/legacy/peephole.h>
 
 enum ac_symbol_type {
         AC_SYM_UND     = 0,
@@ -30,6 +32,12 @@ struct ac_symbol {
         imm32 addend      = 0;
         ptrdiff_t offset  = 0;
         ptrdiff_t info    = 0;
+
+        /* Parameter kept in its argument register, -1 if it's in memory */
+        int reg = -1;
+
+        /* Function calls nothing, it takes the first arguments in registers */
+        bool leaf = false;
 };
 
 const size_t SEG_ALLOC_INIT = 256;
@@ -49,19 +57,80 @@ char *section_mmap(
         size_t size
 );
 
+/*
+ * Expressions are evaluated on the operands stack.
+ * Operand lives in one of r8-r15 registers ('reg' is the
+ * register number without r8) or it is spilled to the
+ * stack frame slot [rbp + slot] if there are no free registers.
+ */
+struct ac_operand {
+        int   reg  = -1;
+        imm32 slot = 0;
+};
+
+const int AC_N_REGS = 8;
+
+/*
+ * Leaf assert functions take the first arguments in rdi, rsi, rdx, rcx,
+ * r8 and r9 as SysV ABI does, the rest are pushed to the stack.
+ * Functions which make calls take all the arguments on the stack.
+ */
+const int AC_N_ARG_REGS = 6;
+
+/*
+ * Call of the function which is not compiled yet.
+ * Its rel32 at 'addr' is patched when all the functions are placed.
+ */
+struct ac_fixup {
+        ptrdiff_t   addr  = 0;
+        const char *ident = nullptr;  /* interned function name */
+};
+
 struct ac_virtual_memory {
         ptrdiff_t _start = 0;
-        ac_symbol *main  = 0;
+        const char *main = nullptr;  /* interned name of main() */
+
+        /* Words pushed below the aligned stack frame: 
+           arguments and padding of the unfinished calls */
+        size_t n_pushed  = 0;
+
+        /* Self tail calls jump to 'body' of the function being compiled,
+           see ast/tail.cpp. 'acc' is the accumulator's frame slot. */
         struct {
-                int stack = 0;
+                const char *func = nullptr;  /* interned */
+                ast_node *params = nullptr;  /* AST_PARAM chain */
+                ptrdiff_t body   = 0;
+                int   acc_op     = 0;
+                imm32 acc        = 0;
+        } tail;
+
+        struct {
+                array stack   = {};  /* ac_operand */
+                array slots   = {};  /* free spill slots: imm32 */
+                unsigned busy = 0;   /* r8-r15 allocated registers mask */
+                unsigned hold = 0;   /* popped, but not consumed yet */
                 const int ret  = IE64_RAX;
                 const int call = IE64_RDI; 
         } reg;
 
+        array fixups = {};  /* ac_fixup */
+        ac_peephole peep = {};
+
         elf64_section *secs = nullptr;
         elf64_symbol  *syms = nullptr;
 }; 
 
-ast_node *compile_tree(ast_node *tree, elf64_section *secs, elf64_symbol *syms);
+/*
+ * Emitted code goes through the peephole optimizer unless 'peephole'
+ * is false, see backend/legacy/peephole.cpp.
+ */
+ast_node *compile_tree(ast_node *tree, elf64_section *secs, elf64_symbol *syms,
+                       bool peephole = true);
+
+/*
+ * Compiles the tree into ELF object 'file_name' to be linked with asslib.
+ * Returns nonzero on error.
+ */
+int compile_elf64(ast_node *tree, const char *file_name, bool peephole = true);
 
 #endif /* BACKEND_H */
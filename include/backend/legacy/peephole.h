@@ -0,0 +1,54 @@
+#ifndef ASSERT_PEEPHOLE_H
+#define ASSERT_PEEPHOLE_H
+
+#include <stddef.h>
+#include <backend/legacy/iencode.h>
+#include <backend/legacy/elf64.h>
+
+const size_t AC_PEEPHOLE_WINDOW = 8;
+const size_t AC_INSN_MAX        = 15;
+
+struct ac_insn {
+        ubyte bytes[AC_INSN_MAX] = {};
+        size_t size = 0;
+
+        /* r8-r15 registers popped from the operands stack before the
+           instruction. The ones it reads aren't used after it. */
+        unsigned dead = 0;
+};
+
+/*
+ * Peephole optimizer of the legacy backend.
+ *
+ * The last emitted instructions are kept in 'window' before they are
+ * copied to .text, so every new one is matched with the previous ones:
+ * moves through the operand registers are merged, immediates and
+ * displacements get the shortest encodings, comparison results tested
+ * by the branch are fused into jcc.
+ *
+ * Instructions never move after their address is taken, so the window
+ * is flushed by rip() and patched instructions bypass it.
+ */
+struct ac_peephole {
+        ac_insn window[AC_PEEPHOLE_WINDOW] = {};
+        size_t size = 0;
+
+        bool enabled = true;
+};
+
+/*
+ * Appends the instruction to the window. Instructions which are patched
+ * or relocated later are 'pinned': they are copied to 'text' as is.
+ */
+void peephole_emit(ac_peephole *peep, elf64_section *text, const void *insn,
+                   size_t size, unsigned dead, bool pinned = false);
+
+/*
+ * Fuses 'test r, r' of the comparison result with the following
+ * je/jne. Returns the second opcode byte of the jcc to emit.
+ */
+ubyte peephole_branch(ac_peephole *peep, ubyte opcode);
+
+void peephole_flush(ac_peephole *peep, elf64_section *text);
+
+#endif /* ASSERT_PEEPHOLE_H */
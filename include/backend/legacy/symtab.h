@@ -0,0 +1,61 @@
+#ifndef ASSERT_SYMTAB_H
+#define ASSERT_SYMTAB_H
+
+#include <stddef.h>
+#include <array.h>
+
+struct ac_symbol;
+
+struct ac_symtab_slot {
+        const char *ident = nullptr;
+        ptrdiff_t   top   = -1;      /* innermost entry, -1 if out of scope */
+};
+
+/*
+ * Scoped symbol table of the legacy backend.
+ *
+ * Symbols are kept in 'entries' in the declaration order, the innermost
+ * scope is the last one. The open-addressing hash table maps interned
+ * name pointer to its innermost entry, every entry remembers the one it
+ * shadows. Popping the scope truncates 'entries' and restores the slots
+ * of the removed names only.
+ *
+ * Note! Symbols move when the table grows, so pointers returned by
+ * symtab_find() and symtab_insert() are valid until the next insert.
+ */
+struct ac_symtab {
+        array entries = {};  /* ac_symtab_entry */
+        array scopes  = {};  /* size_t: entries.size at scope push */
+
+        ac_symtab_slot *slots = nullptr;
+        size_t capacity = 0;
+        size_t n_idents = 0;
+};
+
+int  symtab_push_scope(ac_symtab *tab);
+void symtab_pop_scope (ac_symtab *tab);
+
+/*
+ * Number of the opened scopes.
+ */
+size_t symtab_depth(const ac_symtab *tab);
+
+/*
+ * Declares the symbol in the innermost scope.
+ * Returns its copy in the table or nullptr if there is no memory.
+ */
+ac_symbol *symtab_insert(ac_symtab *tab, const ac_symbol *sym);
+ac_symbol *symtab_find  (ac_symtab *tab, const char *ident);
+
+/*
+ * Returns 'n'-th symbol in the declaration order.
+ * Symbols of the scope 'depth' start at symtab_scope_begin().
+ */
+ac_symbol *symtab_symbol(ac_symtab *tab, size_t n);
+size_t symtab_scope_begin(const ac_symtab *tab, size_t depth);
+size_t symtab_size(const ac_symtab *tab);
+
+void free_symtab(ac_symtab *tab);
+void dump_symtab(ac_symtab *tab);
+
+#endif /* ASSERT_SYMTAB_H */
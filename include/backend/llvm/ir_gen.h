@@ -1,30 +1,44 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
 #include <memory>
 #include <iostream>
-#include <map>
+#include <cassert>
 #include <vector>
 #include "logs.h"
+#include "trace.h"
 #include "ast/tree.h"
 
 /**
  * About
  *
- *
+ * Translates AST into LLVM module. Module can be optimized with
+ * the new pass manager default pipeline, printed either as
+ * textual IR or as native object file, or executed in-process
+ * with ORC JIT.
  */
 class IRGenerator
 {
 public:
     IRGenerator( std::string name)
-        : context_{}
-        , builder_{ std::make_unique<llvm::IRBuilder<>>( context_)}
-        , module_{ std::make_unique<llvm::Module>( name, context_)}
+        : context_{ std::make_unique<llvm::LLVMContext>()}
+        , builder_{ std::make_unique<llvm::IRBuilder<>>( *context_)}
+        , module_{ std::make_unique<llvm::Module>( name, *context_)}
+        , target_{}
     {}
 
 public:
-    //llvm::Module* compile( const ast_node* root);
-    void compile( const ast_node* root, llvm::raw_fd_ostream& os);
+    void compile( const ast_node* root);
+
+    // Runs default -O<level> pipeline. Level 0 leaves module untouched.
+    void optimize( unsigned level);
+
+    void print( llvm::raw_ostream& os) const;
+    void emit_object( llvm::raw_pwrite_stream& os);
+
+    // JIT-compiles the module and executes main(). The module is consumed.
+    int64_t run();
 
 private:
     llvm::Value* compile_stdcall( const ast_node* node);
@@ -38,10 +52,17 @@ private:
     llvm::Value* compile_cond   ( const ast_node* node);
     llvm::Value* compile_call   ( const ast_node* node);
     llvm::Value* compile_call   ( llvm::Function* func, const ast_node* params);
+    llvm::Value* compile_pow    ( llvm::Value* base, llvm::Value* exp);
+    llvm::Value* compile_tail_call( const ast_tail_call& tail);
+    llvm::Value* accumulate( llvm::Value* value);
 
 
     void declare_functions( const ast_node* node);
     void declare_stdlib();
+    void init_target();
+
+    // All allocas are placed in the function entry block to be promoted by mem2reg.
+    llvm::AllocaInst* create_entry_alloca( llvm::Type* type);
 
     struct Declaration
     {
@@ -52,30 +73,30 @@ private:
     void define_symbol( const char* symbol);
 
 private:
-    llvm::LLVMContext context_;
+    // Context is owned by pointer to be passed to JIT together with the module
+    std::unique_ptr<llvm::LLVMContext> context_;
     std::unique_ptr<llvm::IRBuilder<>> builder_;
     std::unique_ptr<llvm::Module> module_;
+    std::unique_ptr<llvm::TargetMachine> target_;
 
-    llvm::Value* get_element_ptr( const std::string& ident,
+    llvm::Value* get_element_ptr( const char* ident,
                                   size_t shift = 0)
     {
-        return get_element_ptr( std::move( ident),
-                                llvm::ConstantInt::get( llvm::Type::getInt64Ty( context_), shift));
+        return get_element_ptr( ident,
+                                llvm::ConstantInt::get( llvm::Type::getInt64Ty( *context_), shift));
     }
 
-    llvm::Value* get_element_ptr( const std::string& ident,
+    llvm::Value* get_element_ptr( const char* ident,
                                   llvm::Value* shift)
     {
-$$
-        std::fprintf( logs, "Try to find: %s\n", ident.c_str());
+        trace_point( TRACE_LLVM, nullptr);
         Allocation alloc = scopes_.get( ident);
 
         llvm::Value *idxs[] = {
-            llvm::ConstantInt::get( llvm::Type::getInt64Ty( context_), 0),
+            llvm::ConstantInt::get( llvm::Type::getInt64Ty( *context_), 0),
             shift
         };
 
-        std::fprintf( logs, "Found: %s\n", ident.c_str());
         return builder_->CreateGEP( alloc.type, alloc.value, idxs);
     }
 
@@ -85,15 +106,37 @@ $$
         llvm::Type* type;
     };
 
-    using Scope = std::map<std::string, Allocation>;
-
+    //
+    // Scoped symbol table keyed by interned names.
+    //
+    // Variables are kept in declaration order, the innermost scope is the
+    // last one. Open-addressing table maps name pointer to its innermost
+    // declaration, which remembers the declaration it shadows. So lookup
+    // is a single probe sequence without allocations, and popping a scope
+    // restores the slots of its own names only.
+    //
     class SymbolTable
-        : public std::vector<Scope>
     {
     public:
-        Allocation get( const std::string& ident) const
+        void push_scope() { scopes_.push_back( entries_.size()); }
+        void pop_scope();
+
+        std::size_t depth() const { return scopes_.size(); }
+        bool is_global() const { return !!(depth() == 1); }
+
+        // Number of variables declared in the innermost scope
+        std::size_t scope_size() const
+        {
+            assert( !scopes_.empty() );
+            return entries_.size() - scopes_.back();
+        }
+
+        // Declares variable in the innermost scope
+        void insert( const char* ident, Allocation alloc);
+
+        Allocation get( const char* ident) const
         {
-            Allocation value = find( std::move( ident));
+            Allocation value = find( ident);
             if ( !value.value )
             {
                 throw std::out_of_range{ "find variable symbol not found!"};
@@ -102,31 +145,73 @@ $$
             return value;
         }
 
-        Scope& emplace_back()
+        Allocation find( const char* ident) const
         {
-            std::vector<Scope>::emplace_back();
-            return back();
+            assert( ident );
+            if ( slots_.empty() )
+            {
+                return Allocation{};
+            }
+
+            const Slot& slot = slots_[find_slot( slots_, ident)];
+            return slot.top < 0 ? Allocation{}
+                                : entries_[(std::size_t)slot.top].alloc;
         }
 
-        bool is_global() const { return !!(size() == 1); }
+    private:
+        struct Entry
+        {
+            const char* ident;
+            Allocation alloc;
+            std::ptrdiff_t shadowed; // same name in the outer scope, -1 if none
+        };
+
+        struct Slot
+        {
+            const char* ident = nullptr;
+            std::ptrdiff_t top = -1; // innermost entry, -1 if out of scope
+        };
 
-        Allocation find( const std::string& ident) const
+        static std::size_t find_slot( const std::vector<Slot>& slots, const char* ident)
         {
-            for ( const Scope& symtab : *this )
+            // Names are interned, so the pointer itself is the key
+            std::size_t mask = slots.size() - 1;
+            std::size_t i = ((uintptr_t)ident * 0x9e3779b97f4a7c15ull >> 32) & mask;
+            while ( slots[i].ident && slots[i].ident != ident )
             {
-                auto symbol = symtab.find( ident);
-                if ( symbol != symtab.end() )
-                {
-                    return symbol->second;
-                }
+                i = (i + 1) & mask;
             }
 
-            return Allocation{};
+            return i;
         }
+
+        void grow();
+
+        std::vector<Entry> entries_{};
+        std::vector<std::size_t> scopes_{}; // entries_.size() at scope push
+        std::vector<Slot> slots_{};         // power of two
+        std::size_t n_idents_ = 0;
     };
 
 
-    SymbolTable scopes_;
+    SymbolTable scopes_{};
+
+    //
+    // Self tail call stores arguments to the parameters and branches to
+    // the function body, see ast/tail.cpp. Returns of the function with
+    // accumulating tail calls apply the accumulator.
+    //
+    struct TailCalls
+    {
+        const char* func = nullptr; // interned
+        llvm::BasicBlock* body = nullptr;
+        std::vector<llvm::Value*> params{};
+        const ast_node* args = nullptr; // AST_PARAM chain of the definition
+        llvm::AllocaInst* acc = nullptr;
+        int acc_op = 0;
+    };
+
+    TailCalls tail_{};
 };
 
 
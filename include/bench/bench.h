@@ -0,0 +1,64 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+#include <array.h>
+#include <ast/tree.h>
+
+/*
+ * Generates a valid Assert program with 'n_funcs' functions.
+ * Every function has its own local names, loops, branches and
+ * calls the previous one. So the program can be compiled by 
+ * both backends and executed.
+ *
+ * The result must be freed with free().
+ */
+char *generate_program(size_t n_funcs, size_t *size = nullptr);
+
+/* Generated programs start from the same seed */
+const size_t BENCH_SEED = 0xDED32;
+
+/*
+ * Simple LCG keeps generated programs reproducible.
+ * Returns the next number below 'n'.
+ */
+size_t bench_roll(size_t *seed, size_t n);
+
+/*
+ * Appends the formatted text to the generated source.
+ */
+void bench_print(array *const src, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+
+/*
+ * Terminates the generated source and takes it from 'src'.
+ * The result must be freed with free().
+ */
+char *bench_source(array *const src, size_t *size = nullptr);
+
+/*
+ * Monotonic wall clock in seconds.
+ */
+double bench_clock();
+
+/*
+ * Parses 'src' to the bound arena and simplifies the tree the way
+ * the backends do. Calls are inlined if 'optimize' is set, as with
+ * 'cum -O'. Returns nullptr on error.
+ */
+ast_node *bench_tree(const char *src, intern_table *names,
+                     bool optimize = false, size_t *n_inlined = nullptr);
+
+/*
+ * Links the legacy 'object' with asslib.o, or the LLVM one with
+ * asslib-llvm.c. Must be run from the repository root after 'make'.
+ */
+int bench_link(const char *object, const char *binary, bool llvm = false);
+
+/*
+ * Runs the binary 'n_rounds' times with 'input' on stdin.
+ * Returns the best wall time or -1 on error.
+ */
+double bench_run(const char *binary, const char *input, size_t n_rounds);
+
+#endif /* BENCH_H */
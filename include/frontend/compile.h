@@ -1,6 +1,30 @@
 #ifndef FT_COMPILE_H
 #define FT_COMPILE_H
 
+#include <stddef.h>
+
 ast_node *grammar_rule(token **toks);
 
+/*
+ * Parses one top-level 'dump' definition or global 'assert'.
+ * Returns its AST_STMT node, the left one is not linked.
+ */
+ast_node *toplevel_rule(token **toks);
+
+/*
+ * Syntax errors are not printed by the calling thread if 'silent'.
+ * Returns the previous value.
+ */
+bool silence_syntax_errors(bool silent);
+
+const size_t PARSE_MAX_THREADS = 64;
+
+/*
+ * Parses top-level definitions on 'n_threads' threads, see
+ * frontend/parallel.cpp. 'toks' must be the whole array made by
+ * tokenize(). The tree is the same as grammar_rule() one and its
+ * nodes are moved to the arena bound to the calling thread.
+ */
+ast_node *parallel_grammar_rule(token **toks, size_t n_threads);
+
 #endif /* FT_COMPILE_H */
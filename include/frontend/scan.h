@@ -0,0 +1,47 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Lexer input scanning.
+ *
+ * Whitespace, comment bodies and identifier runs are skipped 16 (SSE2)
+ * or 32 (AVX2) bytes at a time. The instruction set is chosen once by
+ * the CPU, scalar loops are used on the other architectures.
+ *
+ * All the scanners stop at '\0'. They may read the input past it, but
+ * never cross the aligned block where it is.
+ */
+enum scan_isa {
+        SCAN_SCALAR = 0x00,
+        SCAN_SSE2   = 0x01,
+        SCAN_AVX2   = 0x02,
+};
+
+/* Bytes of [A-Za-z0-9_] which stop an identifier run */
+const size_t SCAN_MAX_BREAKS = 4;
+
+/* Returns the first byte not in " \t\n\v\f\r" */
+const char *scan_spaces(const char *str);
+
+/* Returns the first '#' or '\0' */
+const char *scan_comment(const char *str);
+
+/* Returns the first byte not in [A-Za-z0-9_] or in 'breaks' */
+const char *scan_word(const char *str, const char *breaks);
+
+/*
+ * The best instruction set supported by the CPU.
+ */
+scan_isa detect_scan_isa();
+
+/*
+ * Switches the scanners to 'isa' if the CPU supports it.
+ * Returns the previously used one.
+ */
+scan_isa set_scan_isa(scan_isa isa);
+
+const char *scan_isa_string(scan_isa isa);
+
+#endif /* SCAN_H */
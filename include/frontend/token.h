@@ -1,14 +1,19 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include <pthread.h>
 #include <array.h>
+#include <intern.h>
 
 enum token_type {
         TOKEN_KEYWORD = 0x01,
         TOKEN_IDENT   = 0x02,
         TOKEN_NUMBER  = 0x03,
+        TOKEN_MORE    = 0x04, /* End of the stream window, see below */
 };
 
+struct token_stream;
+
 struct token {
         int type = 0;
 
@@ -16,12 +21,88 @@ struct token {
                 const char *ident;
                 num_t      number;
                 int       keyword;
+                token_stream *stream;
         } data;
 };
 
-token *tokenize(const char *str, array *const variables);
+token *tokenize(const char *str, intern_table *const idents);
+
+/*
+ * Resumable lexer state. 'start' is the beginning of the current
+ * identifier or keyword run.
+ */
+struct lexer {
+        const char *str   = nullptr;
+        const char *start = nullptr;
+        bool comment      = false;
+
+        intern_table *idents = nullptr;
+};
+
+const size_t TOKEN_WINDOW    = 256;
+const size_t TOKEN_LOOKAHEAD = 1;
+const size_t TOKEN_BLOCKS    = 8;
+
+/*
+ * Pull-based tokens source.
+ *
+ * Tokens are lexed on demand into 'window' which is ended by TOKEN_MORE
+ * pointing to the stream or by KW_STOP. When the parser reaches the
+ * TOKEN_MORE one, pull_tokens() lexes the next window. So the parser
+ * keeps its 'token **' cursor, and only TOKEN_WINDOW tokens are in
+ * memory instead of the whole source ones.
+ *
+ * The source must live until the stream is closed.
+ */
+struct token_stream {
+        lexer lex    = {};
+        array window = {0};
+
+        size_t n_tokens = 0; /* lexed so far, KW_STOP and TOKEN_MORE aren't counted */
+
+        /* Pipelined mode, see open_token_pipe() */
+        bool pipelined = false;
+        bool closed    = false;
+
+        array blocks[TOKEN_BLOCKS] = {};
+        size_t n_ready = 0; /* blocks lexed, written by the lexer thread  */
+        size_t n_done  = 0; /* blocks parsed, written by the parser thread */
+        size_t n_taken = 0;
+
+        pthread_t lexer_thread = {};
+};
+
+/*
+ * Returns the first window of tokens or nullptr if there is no memory.
+ */
+token *open_token_stream(token_stream *stream, const char *str, intern_table *const idents);
+
+/*
+ * Pipelined token stream: the windows are lexed by a separate thread
+ * into the ring of TOKEN_BLOCKS blocks, the parser takes them in order.
+ * The ring is a lock-free single-producer/single-consumer queue: the
+ * lexer thread only waits for the block parsed TOKEN_BLOCKS ago to be
+ * released, the parser only for the next block to be lexed.
+ *
+ * 'idents' belong to the lexer thread until the stream is closed.
+ * Returns the first window or nullptr if the thread can't be started.
+ */
+token *open_token_pipe(token_stream *stream, const char *str, intern_table *const idents);
+
+void close_token_stream(token_stream *stream);
+
+/*
+ * Lexes the next window of the stream. The tokens from *toks to the
+ * TOKEN_MORE one (at most TOKEN_LOOKAHEAD) are moved to its beginning.
+ * Then *toks points to the beginning. Returns *toks or nullptr if there
+ * is no memory.
+ */
+token *pull_tokens(token **toks);
 void dump_tokens(const token *toks);
 
+/* Number of tokens before the KW_STOP one */
+size_t count_tokens(const token *toks);
+
 
 
 #endif /* TOKEN_H */
@@ -0,0 +1,42 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct intern_entry {
+        const char *str = nullptr;
+        size_t      len = 0;
+        uint32_t   hash = 0;
+};
+
+struct intern_chunk;
+
+/*
+ * Identifiers interning table.
+ *
+ * It is an open-addressing hash table with linear probing.
+ * Strings are copied to the chunks arena, so every interned 
+ * name has a stable address until free_intern() is called.
+ * Equal names always have equal pointers. 
+ */
+struct intern_table {
+        intern_entry *entries = nullptr;
+        size_t capacity       = 0;
+        size_t size           = 0;
+
+        intern_chunk *chunks  = nullptr;
+};
+
+/*
+ * Returns the interned copy of the first 'len' characters of 'str'.
+ * The copy is always null-terminated.
+ *
+ * Returns nullptr if there is no memory.
+ */
+const char *intern(intern_table *const tab, const char *str, size_t len);
+
+void free_intern(intern_table *const tab);
+void dump_intern(intern_table *const tab);
+
+#endif /* INTERN_H */
@@ -0,0 +1,63 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Compilation phases instrumentation.
+ *
+ * Every phase records monotonic wall time, peak RSS at its end,
+ * allocations made by the compiler containers (arrays, arenas,
+ * intern table, sections) and the number of produced items
+ * (tokens, nodes, bytes...).
+ *
+ * Phases can be nested. Allocations are counted from any thread.
+ */
+
+enum stats_format {
+        STATS_NONE = 0,
+        STATS_TEXT = 1,
+        STATS_JSON = 2,
+};
+
+struct stats_phase {
+        const char *name  = nullptr;
+        const char *unit  = nullptr; /* what 'n_items' are */
+        int         depth = 0;
+
+        double time       = 0;       /* sec */
+        size_t max_rss    = 0;       /* KiB */
+        size_t n_allocs   = 0;
+        size_t alloc_size = 0;       /* bytes */
+        size_t n_items    = 0;
+};
+
+const size_t STATS_MAX_PHASES = 64;
+
+/*
+ * Starts the phase. Returns its id for stats_end().
+ */
+size_t stats_begin(const char *name);
+
+/*
+ * Finishes the phase started by stats_begin().
+ */
+void stats_end(size_t id, size_t n_items = 0, const char *unit = nullptr);
+
+/*
+ * Accounts one allocation of 'size' bytes to the running phases.
+ */
+void stats_alloc(size_t size);
+
+/*
+ * Removes '--stats', '--stats=text' and '--stats=json' options from the
+ * arguments. Returns the new arguments number or -1 if the format is
+ * unknown. 'format' is STATS_NONE if there is no such option,
+ * STATS_TEXT is the default one.
+ */
+int stats_options(int argc, char *argv[], stats_format *format);
+
+void stats_report(FILE *file, stats_format format);
+
+#endif /* STATS_H */
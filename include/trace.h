@@ -0,0 +1,140 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Binary tracing.
+ *
+ * Events are fixed-size records written into a per-thread ring buffer.
+ * The ring has the only writer, so recording is a few stores without
+ * locks. When the ring is full the oldest events are overwritten.
+ *
+ * Categories are enabled at runtime by ASS_TRACE environment variable:
+ * comma separated category names or "all". Disabled trace points cost
+ * one load and a branch. Rings are written to ASS_TRACE_FILE
+ * ("trace.bin" by default) at exit and decoded offline by 'asstrace'.
+ */
+
+enum trace_category {
+        TRACE_PHASE    = 1 << 0, /* stats phases                   */
+        TRACE_FRONTEND = 1 << 1, /* recursive descent rules        */
+        TRACE_LEGACY   = 1 << 2, /* legacy x86-64 code generation  */
+        TRACE_LLVM     = 1 << 3, /* LLVM IR generation             */
+        TRACE_DUMP     = 1 << 4, /* HTML and graphviz debug dumps  */
+};
+
+static const char *const TRACE_CATEGORIES[] = {
+        "phase", "frontend", "legacy", "llvm", "dump",
+};
+
+const size_t N_TRACE_CATEGORIES = sizeof(TRACE_CATEGORIES) / sizeof(*TRACE_CATEGORIES);
+
+enum trace_kind {
+        TRACE_POINT = 0,
+        TRACE_BEGIN = 1,
+        TRACE_END   = 2,
+};
+
+/*
+ * In-memory event. 'func' points to the static function name,
+ * it is replaced with the strings table index in the file.
+ */
+struct trace_event {
+        uint64_t    time     = 0; /* nsec, monotonic */
+        const char *func     = nullptr;
+        uint64_t    node     = 0; /* node address, 0 if there is no node */
+        uint32_t    line     = 0;
+        uint8_t     category = 0;
+        uint8_t     kind     = 0;
+};
+
+/*
+ * File format:
+ *
+ *      trace_header
+ *      n_strings of { uint32_t length, chars without null }
+ *      n_rings   of { trace_ring_header, n_events of trace_record }
+ */
+const char TRACE_MAGIC[8] = {'A', 'S', 'S', 'T', 'R', 'A', 'C', 'E'};
+const uint32_t TRACE_VERSION = 1;
+
+struct trace_header {
+        char     magic[8]  = {};
+        uint32_t version   = 0;
+        uint32_t n_strings = 0;
+        uint32_t n_rings   = 0;
+        uint32_t reserved  = 0;
+};
+
+struct trace_ring_header {
+        uint32_t tid      = 0;
+        uint32_t n_events = 0;
+        uint64_t n_lost   = 0;    /* overwritten events */
+};
+
+struct trace_record {
+        uint64_t time     = 0;
+        uint64_t node     = 0;
+        uint32_t func     = 0;
+        uint32_t line     = 0;
+        uint8_t  category = 0;
+        uint8_t  kind     = 0;
+        uint8_t  reserved[6] = {};
+};
+
+extern uint32_t TRACE_MASK;
+
+static inline bool trace_enabled(uint32_t category)
+{
+        return __builtin_expect(__atomic_load_n(&TRACE_MASK, __ATOMIC_RELAXED) & category, 0);
+}
+
+void trace_event_write(uint32_t category, uint8_t kind, const char *func,
+                       uint32_t line, const void *node);
+
+/*
+ * Writes all the rings to 'file'. Returns non-zero on failure.
+ * It is called at exit, if any category is enabled.
+ */
+int trace_save(FILE *file);
+
+/*
+ * Parses comma separated categories. Returns -1 on unknown one.
+ */
+int trace_parse_categories(const char *str, uint32_t *mask);
+
+#define trace_point(__category, __node)                                         \
+        do {                                                                    \
+        if (trace_enabled(__category))                                          \
+                trace_event_write(__category, TRACE_POINT, __func__,            \
+                                  __LINE__, __node);                            \
+        } while (0)
+
+#define trace_begin(__category, __name)                                         \
+        do {                                                                    \
+        if (trace_enabled(__category))                                          \
+                trace_event_write(__category, TRACE_BEGIN, __name,              \
+                                  __LINE__, nullptr);                           \
+        } while (0)
+
+#define trace_end(__category, __name)                                           \
+        do {                                                                    \
+        if (trace_enabled(__category))                                          \
+                trace_event_write(__category, TRACE_END, __name,                \
+                                  __LINE__, nullptr);                           \
+        } while (0)
+
+/*
+ * Runs the debug dump statement only if TRACE_DUMP is enabled.
+ */
+#define trace_dump(...)                                                         \
+        do {                                                                    \
+        if (trace_enabled(TRACE_DUMP)) {                                        \
+                __VA_ARGS__;                                                    \
+        }                                                                       \
+        } while (0)
+
+#endif /* TRACE_H */
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <logs.h>
 #include <array.h>
+#include <stats.h>
 #include <string.h>
 
 static const size_t INIT_CAPACITY = 2;
@@ -57,6 +58,8 @@ void *realloc_array(array *const arr, size_t capacity, size_t item_size)
                 return nullptr;
         }
 
+        stats_alloc(capacity * item_size);
+
         memset((char *)data + arr->size * item_size, 0, (capacity - arr->size) * item_size);
 
         arr->capacity = capacity;
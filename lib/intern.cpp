@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdio.h>
+#include <logs.h>
+#include <intern.h>
+#include <stats.h>
+
+static const size_t INIT_CAPACITY   = 64;
+static const size_t INIT_CHUNK_SIZE = 0x400;
+static const size_t MAX_CHUNK_SIZE  = 0x10000;
+
+struct intern_chunk {
+        intern_chunk *next = nullptr;
+        size_t size        = 0;
+        size_t used        = 0;
+};
+
+static intern_entry *realloc_intern(intern_table *const tab, size_t capacity);
+static char *intern_alloc(intern_table *const tab, size_t size);
+
+/*
+ * FNV-1a hash function.
+ */
+static inline uint32_t intern_hash(const char *str, size_t len)
+{
+        assert(str);
+
+        uint32_t hash = 0x811c9dc5;
+        for (size_t i = 0; i < len; i++) {
+                hash ^= (unsigned char)str[i];
+                hash *= 0x01000193;
+        }
+
+        return hash;
+}
+
+const char *intern(intern_table *const tab, const char *str, size_t len)
+{
+        assert(tab);
+        assert(str);
+
+        /* Keep load factor below 1/2 */
+        if (2 * (tab->size + 1) > tab->capacity) {
+                size_t capacity = tab->capacity ? 2 * tab->capacity : INIT_CAPACITY;
+                if (!realloc_intern(tab, capacity))
+                        return nullptr;
+        }
+
+        uint32_t hash = intern_hash(str, len);
+        size_t   mask = tab->capacity - 1;
+
+        size_t i = hash & mask;
+        for ( ; tab->entries[i].str; i = (i + 1) & mask) {
+                intern_entry *entry = tab->entries + i;
+                if (entry->hash == hash && entry->len == len && 
+                    !memcmp(entry->str, str, len))
+                        return entry->str;
+        }
+
+        char *copy = intern_alloc(tab, len + 1);
+        if (!copy)
+                return nullptr;
+
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+
+        tab->entries[i].str  = copy;
+        tab->entries[i].len  = len;
+        tab->entries[i].hash = hash;
+        tab->size++;
+
+        return copy;
+}
+
+void free_intern(intern_table *const tab)
+{
+        assert(tab);
+
+        intern_chunk *chunk = tab->chunks;
+        while (chunk) {
+                intern_chunk *next = chunk->next;
+                free(chunk);
+                chunk = next;
+        }
+
+        free(tab->entries);
+
+        tab->entries  = nullptr;
+        tab->chunks   = nullptr;
+        tab->capacity = 0;
+        tab->size     = 0;
+}
+
+void dump_intern(intern_table *const tab)
+{
+        assert(tab);
+
+        fprintf(logs, "================================================\n"
+                      "| <b>Intern table %p dump</b>                   \n"
+                      "================================================\n", tab);
+
+        for (size_t i = 0; i < tab->capacity; i++) {
+                if (!tab->entries[i].str)
+                        continue;
+
+                fprintf(logs, "------------------------------------------------\n"
+                              "| %-4lu | %08x | %s [%p]\n", i, tab->entries[i].hash,
+                              tab->entries[i].str, tab->entries[i].str);
+        }
+
+        fprintf(logs, "================================================\n"
+                      "| Fill: %lu/%lu                                 \n"
+                      "================================================\n\n",
+                      tab->size, tab->capacity);
+}
+
+static intern_entry *realloc_intern(intern_table *const tab, size_t capacity)
+{
+        assert(tab);
+        assert(!(capacity & (capacity - 1)));
+
+        intern_entry *entries = (intern_entry *)calloc(capacity, sizeof(intern_entry));
+        if (!entries) {
+                perror("Can't realloc intern table");
+                return nullptr;
+        }
+
+        stats_alloc(capacity * sizeof(intern_entry));
+
+        /* Rehash, strings stay where they are */
+        size_t mask = capacity - 1;
+        for (size_t i = 0; i < tab->capacity; i++) {
+                if (!tab->entries[i].str)
+                        continue;
+
+                size_t j = tab->entries[i].hash & mask;
+                while (entries[j].str)
+                        j = (j + 1) & mask;
+
+                entries[j] = tab->entries[i];
+        }
+
+        free(tab->entries);
+
+        tab->entries  = entries;
+        tab->capacity = capacity;
+
+        return entries;
+}
+
+static char *intern_alloc(intern_table *const tab, size_t size)
+{
+        assert(tab);
+
+        intern_chunk *chunk = tab->chunks;
+        if (!chunk || chunk->size - chunk->used < size) {
+                /* Chunks grow twice up to MAX_CHUNK_SIZE */
+                size_t chunk_size = chunk ? 2 * chunk->size : INIT_CHUNK_SIZE;
+                if (chunk_size > MAX_CHUNK_SIZE)
+                        chunk_size = MAX_CHUNK_SIZE;
+                if (chunk_size < size)
+                        chunk_size = size;
+
+                chunk = (intern_chunk *)malloc(sizeof(intern_chunk) + chunk_size);
+                if (!chunk) {
+                        perror("Can't allocate intern chunk");
+                        return nullptr;
+                }
+
+                stats_alloc(sizeof(intern_chunk) + chunk_size);
+
+                chunk->size = chunk_size;
+                chunk->used = 0;
+                chunk->next = tab->chunks;
+                tab->chunks = chunk;
+        }
+
+        char *data = (char *)(chunk + 1) + chunk->used;
+        chunk->used += size;
+
+        return data;
+}
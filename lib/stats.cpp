@@ -0,0 +1,167 @@
+#include <time.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/resource.h>
+#include <logs.h>
+#include <stats.h>
+#include <trace.h>
+
+struct stats_state {
+        stats_phase phases[STATS_MAX_PHASES] = {};
+        size_t n_phases = 0;
+        int depth = 0;
+
+        /* Values at the beginning of the running phases */
+        double start       [STATS_MAX_PHASES] = {};
+        size_t start_allocs[STATS_MAX_PHASES] = {};
+        size_t start_size  [STATS_MAX_PHASES] = {};
+};
+
+static stats_state STATS = {};
+
+/* Updated from any thread, see stats_alloc() */
+static size_t N_ALLOCS   = 0;
+static size_t ALLOC_SIZE = 0;
+
+static double stats_clock()
+{
+        struct timespec ts = {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static size_t stats_max_rss()
+{
+        struct rusage usage = {};
+        if (getrusage(RUSAGE_SELF, &usage))
+                return 0;
+
+        /* Linux reports kilobytes */
+        return (size_t)usage.ru_maxrss;
+}
+
+size_t stats_begin(const char *name)
+{
+        assert(name);
+
+        /* Phases over the limit are not recorded */
+        size_t id = STATS.n_phases;
+        if (id == STATS_MAX_PHASES)
+                return id;
+
+        STATS.n_phases++;
+
+        stats_phase *phase = STATS.phases + id;
+        phase->name  = name;
+        phase->depth = STATS.depth++;
+
+        STATS.start_allocs[id] = __atomic_load_n(&N_ALLOCS,   __ATOMIC_RELAXED);
+        STATS.start_size  [id] = __atomic_load_n(&ALLOC_SIZE, __ATOMIC_RELAXED);
+        STATS.start[id] = stats_clock();
+
+        trace_begin(TRACE_PHASE, name);
+        return id;
+}
+
+void stats_end(size_t id, size_t n_items, const char *unit)
+{
+        if (id >= STATS_MAX_PHASES)
+                return;
+
+        double end = stats_clock();
+
+        stats_phase *phase = STATS.phases + id;
+        trace_end(TRACE_PHASE, phase->name);
+
+        phase->time       = end - STATS.start[id];
+        phase->max_rss    = stats_max_rss();
+        phase->n_allocs   = __atomic_load_n(&N_ALLOCS,   __ATOMIC_RELAXED) - STATS.start_allocs[id];
+        phase->alloc_size = __atomic_load_n(&ALLOC_SIZE, __ATOMIC_RELAXED) - STATS.start_size[id];
+        phase->n_items    = n_items;
+        phase->unit       = unit;
+
+        STATS.depth--;
+}
+
+void stats_alloc(size_t size)
+{
+        __atomic_fetch_add(&N_ALLOCS,   1,    __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ALLOC_SIZE, size, __ATOMIC_RELAXED);
+}
+
+int stats_options(int argc, char *argv[], stats_format *format)
+{
+        assert(argv);
+        assert(format);
+
+        *format = STATS_NONE;
+
+        int n_args = 0;
+        for (int i = 0; i < argc; i++) {
+                const char *arg = argv[i];
+                if (strncmp(arg, "--stats", sizeof("--stats") - 1)) {
+                        argv[n_args++] = argv[i];
+                        continue;
+                }
+
+                arg += sizeof("--stats") - 1;
+                if (!strcmp(arg, "") || !strcmp(arg, "=text"))
+                        *format = STATS_TEXT;
+                else if (!strcmp(arg, "=json"))
+                        *format = STATS_JSON;
+                else
+                        return -1;
+        }
+
+        argv[n_args] = nullptr;
+        return n_args;
+}
+
+static void report_text(FILE *file)
+{
+        fprintf(file, "%-24s %10s %10s %8s %10s %12s\n",
+                      "phase", "time, sec", "rss, KiB", "allocs", "alloc, KiB", "items");
+
+        for (size_t i = 0; i < STATS.n_phases; i++) {
+                const stats_phase *phase = STATS.phases + i;
+                fprintf(file, "%*s%-*s %10.6lf %10zu %8zu %10zu %12zu %s\n",
+                              2 * phase->depth, "", 24 - 2 * phase->depth, phase->name,
+                              phase->time, phase->max_rss, phase->n_allocs,
+                              phase->alloc_size / 1024, phase->n_items,
+                              phase->unit ? phase->unit : "");
+        }
+}
+
+static void report_json(FILE *file)
+{
+        fprintf(file, "{\"phases\": [");
+        for (size_t i = 0; i < STATS.n_phases; i++) {
+                const stats_phase *phase = STATS.phases + i;
+                fprintf(file, "%s\n  {\"name\": \"%s\", \"depth\": %d, \"time\": %.9lf, "
+                              "\"max_rss_kib\": %zu, \"allocs\": %zu, \"alloc_bytes\": %zu, "
+                              "\"items\": %zu, \"unit\": \"%s\"}",
+                              i ? "," : "", phase->name, phase->depth, phase->time,
+                              phase->max_rss, phase->n_allocs, phase->alloc_size,
+                              phase->n_items, phase->unit ? phase->unit : "");
+        }
+
+        fprintf(file, "\n], \"max_rss_kib\": %zu}\n", stats_max_rss());
+}
+
+void stats_report(FILE *file, stats_format format)
+{
+        assert(file);
+
+        switch (format) {
+        case STATS_TEXT:
+                report_text(file);
+                break;
+        case STATS_JSON:
+                report_json(file);
+                break;
+        case STATS_NONE:
+        default:
+                break;
+        }
+}
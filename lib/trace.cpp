@@ -0,0 +1,240 @@
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <logs.h>
+#include <trace.h>
+
+static const size_t RING_SIZE = 1 << 16; /* events, power of two */
+
+struct trace_ring {
+        trace_ring *next = nullptr;
+        uint32_t    tid  = 0;
+        uint64_t    head = 0;   /* total events written */
+
+        trace_event events[RING_SIZE] = {};
+};
+
+uint32_t TRACE_MASK = 0;
+
+/* Rings of all threads. They are pushed once and live until exit */
+static trace_ring *RINGS = nullptr;
+static uint32_t    N_THREADS = 0;
+
+static thread_local trace_ring *RING = nullptr;
+
+static uint64_t trace_clock()
+{
+        struct timespec ts = {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static trace_ring *create_ring()
+{
+        trace_ring *ring = (trace_ring *)calloc(1, sizeof(trace_ring));
+        if (!ring)
+                return nullptr;
+
+        ring->tid = __atomic_fetch_add(&N_THREADS, 1, __ATOMIC_RELAXED);
+
+        /* Lock-free push */
+        ring->next = __atomic_load_n(&RINGS, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&RINGS, &ring->next, ring, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+                ;
+
+        return ring;
+}
+
+void trace_event_write(uint32_t category, uint8_t kind, const char *func,
+                       uint32_t line, const void *node)
+{
+        trace_ring *ring = RING;
+        if (!ring) {
+                ring = RING = create_ring();
+                if (!ring)
+                        return;
+        }
+
+        trace_event *event = ring->events + (ring->head & (RING_SIZE - 1));
+        event->time     = trace_clock();
+        event->func     = func;
+        event->node     = (uintptr_t)node;
+        event->line     = line;
+        event->category = (uint8_t)category;
+        event->kind     = kind;
+
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+int trace_parse_categories(const char *str, uint32_t *mask)
+{
+        assert(str);
+        assert(mask);
+
+        *mask = 0;
+        while (*str) {
+                size_t len = strcspn(str, ",");
+
+                if (len == sizeof("all") - 1 && !strncmp(str, "all", len)) {
+                        *mask = ~0u;
+                } else {
+                        size_t i = 0;
+                        while (i < N_TRACE_CATEGORIES &&
+                               (strlen(TRACE_CATEGORIES[i]) != len ||
+                                strncmp(str, TRACE_CATEGORIES[i], len)))
+                                i++;
+
+                        if (i == N_TRACE_CATEGORIES)
+                                return -1;
+
+                        *mask |= 1u << i;
+                }
+
+                str += len;
+                if (*str == ',')
+                        str++;
+        }
+
+        return 0;
+}
+
+/*
+ * Function names are static strings, so they are compared by address.
+ * Returns the index of 'func' in 'strings' appending it if needed.
+ */
+static uint32_t string_index(const char **strings, uint32_t *n_strings, const char *func)
+{
+        for (uint32_t i = 0; i < *n_strings; i++)
+                if (strings[i] == func)
+                        return i;
+
+        strings[*n_strings] = func;
+        return (*n_strings)++;
+}
+
+static size_t ring_events(const trace_ring *ring)
+{
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        return head < RING_SIZE ? head : RING_SIZE;
+}
+
+int trace_save(FILE *file)
+{
+        assert(file);
+
+        trace_ring *rings = __atomic_load_n(&RINGS, __ATOMIC_ACQUIRE);
+
+        trace_header header = {};
+        memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        header.version = TRACE_VERSION;
+
+        size_t max_strings = 0;
+        for (trace_ring *ring = rings; ring; ring = ring->next) {
+                max_strings += ring_events(ring);
+                header.n_rings++;
+        }
+
+        const char **strings = (const char **)calloc(max_strings + 1, sizeof(char *));
+        if (!strings)
+                return -1;
+
+        for (trace_ring *ring = rings; ring; ring = ring->next) {
+                size_t n_events = ring_events(ring);
+                for (size_t i = 0; i < n_events; i++)
+                        string_index(strings, &header.n_strings, ring->events[i].func);
+        }
+
+        fwrite(&header, sizeof(header), 1, file);
+
+        for (uint32_t i = 0; i < header.n_strings; i++) {
+                const char *str = strings[i] ? strings[i] : "";
+                uint32_t len = (uint32_t)strlen(str);
+
+                fwrite(&len, sizeof(len), 1, file);
+                fwrite(str, 1, len, file);
+        }
+
+        for (trace_ring *ring = rings; ring; ring = ring->next) {
+                uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+                size_t n_events = ring_events(ring);
+
+                trace_ring_header rh = {};
+                rh.tid      = ring->tid;
+                rh.n_events = (uint32_t)n_events;
+                rh.n_lost   = head - n_events;
+                fwrite(&rh, sizeof(rh), 1, file);
+
+                /* Oldest event goes first */
+                for (size_t i = 0; i < n_events; i++) {
+                        const trace_event *event = ring->events + ((head - n_events + i) & (RING_SIZE - 1));
+
+                        trace_record rec = {};
+                        rec.time     = event->time;
+                        rec.node     = event->node;
+                        rec.func     = string_index(strings, &header.n_strings, event->func);
+                        rec.line     = event->line;
+                        rec.category = event->category;
+                        rec.kind     = event->kind;
+                        fwrite(&rec, sizeof(rec), 1, file);
+                }
+        }
+
+        free(strings);
+        return ferror(file);
+}
+
+static void trace_exit()
+{
+        /* Nothing is recorded from now on */
+        __atomic_store_n(&TRACE_MASK, 0, __ATOMIC_RELAXED);
+
+        const char *name = getenv("ASS_TRACE_FILE");
+        if (!name)
+                name = "trace.bin";
+
+        FILE *file = fopen(name, "wb");
+        if (!file) {
+                fprintf(stderr, ascii(RED, "Can't open trace file %s: %s\n"), name, strerror(errno));
+                return;
+        }
+
+        if (trace_save(file))
+                fprintf(stderr, ascii(RED, "Can't save trace to %s\n"), name);
+
+        fclose(file);
+
+        for (trace_ring *ring = RINGS; ring; ) {
+                trace_ring *next = ring->next;
+                free(ring);
+                ring = next;
+        }
+
+        RINGS = nullptr;
+}
+
+/*
+ * Every driver is traced without any changes in its main().
+ */
+__attribute__((constructor))
+static void trace_init()
+{
+        const char *categories = getenv("ASS_TRACE");
+        if (!categories)
+                return;
+
+        uint32_t mask = 0;
+        if (trace_parse_categories(categories, &mask)) {
+                fprintf(stderr, ascii(RED, "Unknown ASS_TRACE category: %s\n"), categories);
+                return;
+        }
+
+        if (!mask)
+                return;
+
+        __atomic_store_n(&TRACE_MASK, mask, __ATOMIC_RELAXED);
+        atexit(trace_exit);
+}
@@ -5,7 +5,7 @@
 #include <array.h>
 #include <errno.h>
 #include <iommap.h>
-#include <time.h>
+#include <stats.h>
 
 #include <ast/tree.h>
 #include <trans/transpile.h>
@@ -15,6 +15,8 @@ static int file_error(const char *file_name);
 
 int main(int argc, char *argv[])
 {
+        stats_format stats = STATS_NONE;
+        argc = stats_options(argc, argv, &stats);
         if (argc != 3) {
                 fprintf(stderr, ascii(RED, "There must be 2 arguments\n"));
                 return EXIT_FAILURE;
@@ -23,7 +25,7 @@ int main(int argc, char *argv[])
         const char *src_file = argv[1];
         const char *out_file = argv[2];
 
-        clock_t start = clock();
+        size_t total = stats_begin("rev");
         FILE *out = fopen(out_file, "w");
         if (!out)
                 return file_error(out_file);
@@ -33,36 +35,39 @@ int main(int argc, char *argv[])
         if (error)
                 return EXIT_FAILURE;
 
-        array idents = {0};
+        intern_table idents = {0};
+
+        ast_arena arena = {};
+        bind_ast_arena(&arena);
 
         ast_node *err = nullptr;
-        char *reader = md.buf;
-        ast_node *tree = read_ast_tree(&reader, &idents);
+        size_t phase = stats_begin("load_ast_tree");
+        ast_node *tree = load_ast_tree(md.buf, md.size, &idents);
+        stats_end(phase, arena.n_nodes, "nodes");
         mmap_free(&md);
         if (!tree)
                 goto fail;
 
+        phase = stats_begin("trans_stmt");
         err = trans_stmt(out, tree);
+        stats_end(phase, arena.n_nodes, "nodes");
         if (err)
                 goto fail;
 
 fail:
-        char **data = (char **)idents.data;
-        for (size_t i = 0; i < idents.size; i++) {
-                free(data[i]);
-        }
-
-        free_array(&idents, sizeof(char *));
+        free_intern(&idents);
+        free_ast_arena(&arena);
         fclose(out);
 
-        clock_t end = clock();
-
         if (!tree || err || error) {
                 fprintf(stderr, ascii(RED, "Transpilation failed\n"));
                 return EXIT_FAILURE;
         }
 
-        fprintf(stderr, ascii(GREEN, "Transpilation succeed: %lf sec\n"), (end - start) / CLOCKS_PER_SEC);
+        stats_end(total);
+        stats_report(stdout, stats);
+
+        fprintf(stderr, ascii(GREEN, "Transpilation succeed\n"));
         return EXIT_SUCCESS;
 }
 
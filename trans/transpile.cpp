@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <iommap.h>
 #include <logs.h>
+#include <trace.h>
 #include <assert.h>
 #include <ast/tree.h>
 #include <ast/keyword.h>
@@ -61,7 +62,7 @@ static ast_node *trans_error(ast_node *root)
         assert(root);
         fprintf(stderr, ascii(RED, "Syntax error:\n"));
         save_ast_tree(stderr, root);
-        $(dump_tree(root);)
+        trace_dump(dump_tree(root));
         fprintf(stderr, "\n");
         return root;
 }
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <logs.h>
+#include <iommap.h>
+#include <trace.h>
+
+/*
+ * Trace decoder: converts ASS_TRACE_FILE into the HTML log
+ * or Chrome trace JSON (chrome://tracing, Perfetto).
+ */
+
+struct trace_file {
+        trace_header header = {};
+
+        const char **strings = nullptr;
+        uint32_t   *lengths  = nullptr;
+
+        const char *rings = nullptr; /* first ring header */
+        const char *end   = nullptr;
+};
+
+static int input_error(const char *name);
+static int file_error(const char *file_name);
+static int format_error(const char *file_name);
+
+static int read_trace(trace_file *tf, const char *buf, size_t size);
+
+static void write_html  (FILE *out, const trace_file *tf);
+static void write_chrome(FILE *out, const trace_file *tf);
+
+int main(int argc, char *argv[])
+{
+        bool chrome = false;
+
+        int argi = 1;
+        for ( ; argi < argc && argv[argi][0] == '-'; argi++) {
+                if (!strcmp(argv[argi], "--chrome"))
+                        chrome = true;
+                else if (!strcmp(argv[argi], "--html"))
+                        chrome = false;
+                else
+                        return input_error(argv[0]);
+        }
+
+        if (argc - argi != 2)
+                return input_error(argv[0]);
+
+        const char *src_file = argv[argi];
+        const char *out_file = argv[argi + 1];
+
+        mmap_data md = {0};
+        if (mmap_in(&md, src_file))
+                return file_error(src_file);
+
+        trace_file tf = {};
+        if (read_trace(&tf, md.buf, md.size)) {
+                mmap_free(&md);
+                return format_error(src_file);
+        }
+
+        FILE *out = fopen(out_file, "w");
+        if (!out) {
+                free(tf.strings);
+                free(tf.lengths);
+                mmap_free(&md);
+                return file_error(out_file);
+        }
+
+        if (chrome)
+                write_chrome(out, &tf);
+        else
+                write_html(out, &tf);
+
+        fclose(out);
+        free(tf.strings);
+        free(tf.lengths);
+        mmap_free(&md);
+        return EXIT_SUCCESS;
+}
+
+static int read_trace(trace_file *tf, const char *buf, size_t size)
+{
+        const char *end = buf + size;
+        if (size < sizeof(trace_header))
+                return -1;
+
+        memcpy(&tf->header, buf, sizeof(trace_header));
+        if (memcmp(tf->header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) ||
+            tf->header.version != TRACE_VERSION)
+                return -1;
+
+        buf += sizeof(trace_header);
+
+        uint32_t n_strings = tf->header.n_strings;
+        tf->strings = (const char **)calloc(n_strings + 1, sizeof(char *));
+        tf->lengths = (uint32_t    *)calloc(n_strings + 1, sizeof(uint32_t));
+        if (!tf->strings || !tf->lengths)
+                goto fail;
+
+        for (uint32_t i = 0; i < n_strings; i++) {
+                uint32_t len = 0;
+                if ((size_t)(end - buf) < sizeof(len))
+                        goto fail;
+
+                memcpy(&len, buf, sizeof(len));
+                buf += sizeof(len);
+
+                if ((size_t)(end - buf) < len)
+                        goto fail;
+
+                tf->strings[i] = buf;
+                tf->lengths[i] = len;
+                buf += len;
+        }
+
+        tf->rings = buf;
+        tf->end   = end;
+
+        /* Check rings bounds once, so writers don't have to */
+        for (uint32_t i = 0; i < tf->header.n_rings; i++) {
+                trace_ring_header rh = {};
+                if ((size_t)(end - buf) < sizeof(rh))
+                        goto fail;
+
+                memcpy(&rh, buf, sizeof(rh));
+                buf += sizeof(rh);
+
+                if ((size_t)(end - buf) / sizeof(trace_record) < rh.n_events)
+                        goto fail;
+
+                buf += rh.n_events * sizeof(trace_record);
+        }
+
+        return 0;
+
+fail:
+        free(tf->strings);
+        free(tf->lengths);
+        tf->strings = nullptr;
+        tf->lengths = nullptr;
+        return -1;
+}
+
+static const char *category_name(uint8_t category)
+{
+        for (size_t i = 0; i < N_TRACE_CATEGORIES; i++)
+                if (category == 1u << i)
+                        return TRACE_CATEGORIES[i];
+
+        return "unknown";
+}
+
+/*
+ * Calls 'action' for every record of every ring.
+ */
+static void visit_records(const trace_file *tf, FILE *out,
+                          void (*action)(FILE *out, const trace_file *tf, uint32_t tid,
+                                         const trace_record *rec, uint64_t start))
+{
+        /* Timestamps are shown relative to the earliest event */
+        uint64_t start = UINT64_MAX;
+
+        const char *buf = tf->rings;
+        for (uint32_t i = 0; i < tf->header.n_rings; i++) {
+                trace_ring_header rh = {};
+                memcpy(&rh, buf, sizeof(rh));
+                buf += sizeof(rh);
+
+                if (rh.n_events) {
+                        trace_record rec = {};
+                        memcpy(&rec, buf, sizeof(rec));
+                        if (rec.time < start)
+                                start = rec.time;
+                }
+
+                buf += rh.n_events * sizeof(trace_record);
+        }
+
+        buf = tf->rings;
+        for (uint32_t i = 0; i < tf->header.n_rings; i++) {
+                trace_ring_header rh = {};
+                memcpy(&rh, buf, sizeof(rh));
+                buf += sizeof(rh);
+
+                if (rh.n_lost)
+                        fprintf(stderr, ascii(BLUE, "Thread %u: %lu oldest events are lost\n"),
+                                        rh.tid, rh.n_lost);
+
+                for (uint32_t j = 0; j < rh.n_events; j++) {
+                        trace_record rec = {};
+                        memcpy(&rec, buf, sizeof(rec));
+                        buf += sizeof(rec);
+
+                        if (rec.func < tf->header.n_strings)
+                                action(out, tf, rh.tid, &rec, start);
+                }
+        }
+}
+
+static void html_record(FILE *out, const trace_file *tf, uint32_t tid,
+                        const trace_record *rec, uint64_t start)
+{
+        static const char *const KINDS[] = {"", "begin ", "end "};
+
+        fprintf(out, "[%u] %12.3lf us %-9s %s<b>%.*s</b>:%u",
+                     tid, (double)(rec->time - start) * 1e-3, category_name(rec->category),
+                     rec->kind < 3 ? KINDS[rec->kind] : "",
+                     (int)tf->lengths[rec->func], tf->strings[rec->func], rec->line);
+
+        if (rec->node)
+                fprintf(out, " node %#lx", rec->node);
+
+        fprintf(out, "\n");
+}
+
+static void write_html(FILE *out, const trace_file *tf)
+{
+        fprintf(out, "<pre>\n");
+        visit_records(tf, out, html_record);
+        fprintf(out, "</pre>\n");
+}
+
+static void chrome_record(FILE *out, const trace_file *tf, uint32_t tid,
+                          const trace_record *rec, uint64_t start)
+{
+        static const char KINDS[] = {'i', 'B', 'E'};
+
+        /* Function names are C identifiers or phase names, nothing to escape */
+        fprintf(out, "{\"name\": \"%.*s\", \"cat\": \"%s\", \"ph\": \"%c\", "
+                     "\"ts\": %.3lf, \"pid\": 0, \"tid\": %u, "
+                     "\"args\": {\"line\": %u, \"node\": \"%#lx\"}},\n",
+                     (int)tf->lengths[rec->func], tf->strings[rec->func],
+                     category_name(rec->category), rec->kind < 3 ? KINDS[rec->kind] : 'i',
+                     (double)(rec->time - start) * 1e-3, tid, rec->line, rec->node);
+}
+
+static void write_chrome(FILE *out, const trace_file *tf)
+{
+        fprintf(out, "{\"traceEvents\": [\n");
+        visit_records(tf, out, chrome_record);
+
+        /* Trailing comma is not allowed, so close the list with metadata */
+        fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, "
+                     "\"args\": {\"name\": \"assert\"}}\n]}\n");
+}
+
+static int input_error(const char *name)
+{
+        fprintf(stderr, ascii(RED, "Usage: %s [--html|--chrome] [trace.bin] [output]\n"), name);
+        return EXIT_FAILURE;
+}
+
+static int file_error(const char *file_name)
+{
+        fprintf(stderr, ascii(RED, "Can't open file %s: %s\n"),
+                        file_name, strerror(errno));
+
+        return EXIT_FAILURE;
+}
+
+static int format_error(const char *file_name)
+{
+        fprintf(stderr, ascii(RED, "%s is not a trace file\n"), file_name);
+        return EXIT_FAILURE;
+}